@@ -36,10 +36,17 @@
 #include "lima/HwMaxImageSizeCallback.h"
 #include "lima/ThreadUtils.h"
 #include "lima/Event.h"
+#include "lima/Timestamp.h"
+#include "EigerStatistics.h"
 
 #include <eigerapi/EigerDefines.h>
 
 #include <ostream>
+#include <functional>
+#include <atomic>
+#include <future>
+#include <vector>
+#include <deque>
 
 DEB_GLOBAL_NAMESPC(DebModCamera, "Eiger");
 
@@ -75,6 +82,11 @@ class LIBEIGER Camera : public HwMaxImageSizeCallbackGen, public EventCallbackGe
   enum Status { Initializing, Ready, Armed, Exposure, Fault };
   enum CompressionType {NoCompression,LZ4,BSLZ4};
 
+  // result of the asynchronous setters: the future holds the error, if any.
+  // The optional callback is called when the request finishes
+  typedef std::shared_future<void> AsyncResult;
+  typedef std::function<void(bool ok, const std::string& error)> AsyncCallback;
+
   Camera(const std::string& host, int http_port=80, int stream_port=9999);
   ~Camera();
 
@@ -158,6 +170,21 @@ class LIBEIGER Camera : public HwMaxImageSizeCallbackGen, public EventCallbackGe
   void getBeamCenterY(double&);
   void setDetectorDistance(double);
   void getDetectorDistance(double&);
+
+  // -- asynchronous setters, several settings can be applied concurrently
+  AsyncResult setCountrateCorrectionAsync(bool, AsyncCallback = AsyncCallback());
+  AsyncResult setFlatfieldCorrectionAsync(bool, AsyncCallback = AsyncCallback());
+  AsyncResult setRetriggerAsync(bool, AsyncCallback = AsyncCallback());
+  AsyncResult setPixelMaskAsync(bool, AsyncCallback = AsyncCallback());
+  AsyncResult setThresholdEnergyAsync(double, AsyncCallback = AsyncCallback());
+  AsyncResult setThresholdEnergy2Async(double, AsyncCallback = AsyncCallback());
+  AsyncResult setVirtualPixelCorrectionAsync(bool,
+					     AsyncCallback = AsyncCallback());
+  AsyncResult setPhotonEnergyAsync(double, AsyncCallback = AsyncCallback());
+  AsyncResult setWavelengthAsync(double, AsyncCallback = AsyncCallback());
+  AsyncResult setBeamCenterXAsync(double, AsyncCallback = AsyncCallback());
+  AsyncResult setBeamCenterYAsync(double, AsyncCallback = AsyncCallback());
+  AsyncResult setDetectorDistanceAsync(double, AsyncCallback = AsyncCallback());
   void getDataCollectionDate(std::string&);
 
   void setDynamicPixelDepth(bool  dynamic_pixel_depth);
@@ -172,8 +199,14 @@ class LIBEIGER Camera : public HwMaxImageSizeCallbackGen, public EventCallbackGe
   void getSerieId(int&);
   void deleteMemoryFiles();
   void disarm();
+  void setSeriesChaining(bool enable);
+  void getSeriesChaining(bool& enable);
   void setHwRoiPattern(const std::string pattern);
   void getHwRoiPattern(std::string& pattern);
+  void setTraceActive(bool active);
+  void getTraceActive(bool& active);
+  void writeTrace(const std::string& path);
+  void getTriggerLatency(TriggerLatency& latency);
 
   const std::string& getDetectorHost() const;
   int getDetectorStreamPort() const;
@@ -182,19 +215,45 @@ class LIBEIGER Camera : public HwMaxImageSizeCallbackGen, public EventCallbackGe
   friend class Interface;
   friend class SavingCtrlObj;
   friend class Stream;
+  friend class Monitor;
   friend class MultiParamRequest;
   friend class CameraRequest;
+  friend class AsyncSetCallback;
+  friend class SerialSet;
 
   enum InternalStatus {IDLE,RUNNING,ERROR};
   class TriggerCallback;
   friend class TriggerCallback;
   class InitCallback;
   friend class InitCallback;
+  class ChainedArmCallback;
+  friend class ChainedArmCallback;
+
+  enum ChainState {CHAIN_IDLE,CHAIN_ARMING,CHAIN_ARMED};
 
   Camera::Status _getStatus();
 
+  typedef std::function<void()> PrepareOverlap;
+  void _prepareAcq(bool clear_filewriter, PrepareOverlap overlap,
+		   PrepareTiming& timing);
+  bool _useChainedArm(bool clear_filewriter, PrepareOverlap& overlap,
+		      double frame_time, unsigned nb_images,
+		      unsigned nb_triggers, AutoMutex& lock);
+
+  void _seriesFinished();
+  void _chainedArmFinished(bool ok, int serie_id);
+  void _configChanged();
+  bool _takeChainedArm();
+  void _disarmChained();
+
+  // parameter PUTs, one at a time except on Eiger1
+  typedef std::function<void()> SetStart;
+  void _acquireSet();
+  void _releaseSet();
+  void _queueSet(SetStart start);
+
   void _synchronize(); /// Used during plug-in initialization
-  void _trigger_finished(bool ok, bool do_disarm);
+  void _trigger_finished(bool ok, bool do_disarm, int trigger);
   void _initialization_finished(bool ok);
 
   void _updateImageSize();
@@ -202,6 +261,10 @@ class LIBEIGER Camera : public HwMaxImageSizeCallbackGen, public EventCallbackGe
   void getNbTriggeredFrames(int& nb_trig_frames);
   void newFrameAcquired();
   bool allFramesAcquired();
+  void _resetTriggerLatency();
+  void _frameReceived(int frameid, Timestamp rx_tstamp);
+  void _addTriggerLatency(int trigger);
+  void _getFirstFrameLatency(std::vector<double>& latency);
 
   template <typename T>
   struct Cache
@@ -240,10 +303,21 @@ class LIBEIGER Camera : public HwMaxImageSizeCallbackGen, public EventCallbackGe
   Cache<unsigned int>       m_nb_images;
   Cache<unsigned int>       m_nb_triggers;
   int                       m_frames_triggered;
-  int                       m_frames_acquired;
+  // updated for every frame without locking
+  std::atomic<int>          m_frames_acquired;
   double                    m_latency_time;
   TrigMode                  m_trig_mode;
   Cache<std::string>        m_trig_mode_name;
+  //- internal trigger latency, per series
+  struct TriggerTimes
+  {
+    Timestamp sent, first, last, done;
+  };
+  // frames per internal trigger, 0 otherwise. Read for every frame
+  std::atomic<int>          m_latency_nb_images;
+  std::vector<TriggerTimes> m_trigger_times;
+  TriggerLatency            m_trigger_latency;
+  Mutex                     m_latency_lock;
 
   //- camera stuff
   ApiGeneration             m_api;
@@ -259,6 +333,19 @@ class LIBEIGER Camera : public HwMaxImageSizeCallbackGen, public EventCallbackGe
   InternalStatus            m_trigger_state;
   bool                      m_armed;
   int                       m_serie_id;
+  //- series chaining: next series armed as soon as the previous one ends
+  bool                      m_series_chaining;
+  bool                      m_chain_rearm;
+  std::atomic<ChainState>   m_chain_state;
+  int                       m_chain_serie_id;
+  unsigned long             m_chain_config_gen;
+  std::atomic<unsigned long> m_config_gen;
+  //- PUT in progress and the async ones waiting for it
+  Cond                      m_set_cond;
+  bool                      m_set_busy;
+  std::deque<SetStart>      m_set_queue;
+  //- incremented by each _synchronize: the other objects re-read their caches
+  std::atomic<unsigned long> m_sync_gen;
   //- EigerAPI stuff
   eigerapi::Requests*       m_requests;
 
@@ -27,6 +27,10 @@
 #include "EigerCompatibility.h"
 #include "lima/HwInterface.h"
 #include "EigerRoiCtrlObj.h"
+#include "EigerStatistics.h"
+#include "lima/ThreadUtils.h"
+#include "lima/Timestamp.h"
+#include "processlib/Data.h"
 
 namespace lima
 {
@@ -40,8 +44,10 @@ namespace lima
       class Camera;
       class Stream;
       class StreamInfo;
-      class StreamStatistics;
       class Decompress;
+      class Monitor;
+      class MetricsServer;
+      class PerformanceLog;
 
 	/*******************************************************************
 	* \class Interface
@@ -52,7 +58,10 @@ namespace lima
 	DEB_CLASS_NAMESPC(DebModCamera, "EigerInterface", "Eiger");
 
 	public:
-	    Interface(Camera& cam, const char* mmap_file=NULL);
+	    // hugepage_size: frame buffers in 2 MB or 1 GB hugepages, bound
+	    // to numa_node (< 0: the node of the detector network interface)
+	    Interface(Camera& cam, const char* mmap_file=NULL,
+		      long long hugepage_size=0, int numa_node=-1);
 	    virtual ~Interface();
 
 	    //- From HwInterface
@@ -70,11 +79,50 @@ namespace lima
 	    void getLastStreamInfo(StreamInfo& info);
 	    void latchStreamStatistics(StreamStatistics& stat,
 				       bool reset=false);
+	    void latchTransferStatistics(TransferStatistics& stat,
+					 bool reset=false);
+	    void getLastPrepareTiming(PrepareTiming& timing);
+	    void setMirrorDirectories(const std::list<std::string>& dirs);
+	    void getMirrorDirectories(std::list<std::string>& dirs);
+	    // keep the stream along the filewriter, as a live feed
+	    void setFileWriterStream(bool enabled);
+	    void getFileWriterStream(bool& enabled);
+	    void setStreamDecimation(int decimation);
+	    void getStreamDecimation(int& decimation);
+	    // low rate preview through the DCU monitor, rate in Hz (0: off)
+	    void setMonitorRate(double rate);
+	    void getMonitorRate(double& rate);
+	    void getMonitorImage(Data& image);
+	    // display preview of the stream, decoded only when read
+	    void setStreamPreviewRate(double max_rate);
+	    void getStreamPreviewRate(double& max_rate);
+	    void setStreamPreviewBinning(int bin);
+	    void getStreamPreviewBinning(int& bin);
+	    void getStreamPreviewImage(Data& image);
+	    // stream backpressure samples, see Stream::getBackpressureHistory
+	    void getStreamBackpressureHistory(Data& history);
+	    // CPU placement of the plugin threads, process wide. Classes:
+	    // receive, dispatch, curl, polling and decompress
+	    void setThreadCpus(const std::string& thread_class,
+			       const std::string& cpus);
+	    void getThreadCpus(const std::string& thread_class,
+			       std::string& cpus);
+	    void setReceiveFifoPriority(int priority);
+	    void getReceiveFifoPriority(int& priority);
+	    void getThreadPlacement(std::list<std::string>& placement);
 		bool hasHwRoiSupport();
 		void getSupportedHwRois(std::list<Eiger::RoiCtrlObj::PATTERN2ROI>& hwrois) const;
 		void getModelSize(std::string& model) const;
+	    // one JSON line per acquisition appended to path, empty disables it
+	    void setPerformanceLogPath(const std::string& path);
+	    void getPerformanceLogPath(std::string& path);
+	    // Prometheus endpoint on 127.0.0.1:port/metrics, 0 disables it
+	    void setMetricsPort(int port);
+	    void getMetricsPort(int& port);
 
 	private:
+	    void _logAcquisition(bool ok);
+
 	    Camera&         m_cam;
 	    CapList         m_cap_list;
 	    DetInfoCtrlObj* m_det_info;
@@ -84,6 +132,13 @@ namespace lima
 	    EventCtrlObj*   m_event;
 	    Stream*	        m_stream;
 	    Decompress*	    m_decompress;
+	    Monitor*        m_monitor;
+	    MetricsServer*  m_metrics;
+	    PerformanceLog* m_perf_log;
+	    Mutex           m_prepare_lock;
+	    PrepareTiming   m_prepare_timing;
+	    Timestamp       m_prepare_start;
+	    bool            m_filewriter_stream;
 	};
 
     } // namespace Eiger
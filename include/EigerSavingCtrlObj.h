@@ -21,11 +21,15 @@
 // You should have received a copy of the GNU General Public License
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
+#include <list>
 #include <map>
+#include <unordered_set>
 #include "lima/Debug.h"
 #include "lima/HwSavingCtrlObj.h"
+#include "lima/Timestamp.h"
 
 #include "EigerCamera.h"
+#include "EigerStatistics.h"
 
 namespace lima
 {
@@ -45,32 +49,81 @@ namespace lima
       virtual void resetCommonHeader();
       
       void setSerieId(int value);
+      // one frame every decimation is passed to Lima by the stream
+      void setLimaDecimation(int decimation);
       Status getStatus();
       void stop();
+
+      void latchStatistics(TransferStatistics& stat, bool reset=false);
+
+      // the files are also written in these directories (i.e. an archive)
+      // from the same download, each by its own writer thread
+      void setMirrorDirectories(const std::list<std::string>& directories);
+      void getMirrorDirectories(std::list<std::string>& directories);
+
+      // called once all the files of the acquisition are downloaded,
+      // ok without error. Set before the first acquisition
+      typedef std::function<void(bool ok)> SeriesEndCallback;
+      void setSeriesEndCallback(SeriesEndCallback cb);
     private:
       class _PollingThread;
       friend class _PollingThread;
       class _EndDownloadCallback;
       friend class _EndDownloadCallback;
+      class _DownloadScheduler;
 
       virtual void _prepare(int =0) override;
       virtual void _start(int =0) override;
       virtual void _setActive(bool, int =0) override;
 
-      void _download_finished(std::string filename, bool ok, std::string error);
+      void _syncCaches();
+      void _update_listed_files(const std::vector<std::string>& files,
+				const std::string& prefix);
+      double _next_poll_delay();
+      void _get_target_paths(const std::string& directory,
+			     const std::string& file_name,
+			     std::vector<std::string>& paths);
+      void _download_started(double wait);
+      void _download_finished(std::string filename, bool ok, std::string error,
+			      long long size, double elapsed, int nb_retries);
+
+      template <typename T>
+      using Cache = Camera::Cache<T>;
 
       Camera&			m_cam;
+      Cache<std::string>	m_mode_str;
+      Cache<int>		m_frames_per_file_cache;
+      Cache<std::string>	m_name_pattern;
+      unsigned long		m_sync_gen;
       int			m_serie_id;
       int			m_nb_file_to_watch;
       int			m_nb_file_transfer_started;
       int			m_concurrent_download;
       bool			m_poll_master_file;
       double			m_waiting_time;
+      // file discovery
+      std::unordered_set<std::string> m_listed_files;
+      int			m_nb_file_listed;
+      int			m_nb_frames;
+      double			m_frame_period;
+      double			m_list_rtt;
+      Timestamp			m_start_ts;
+      Timestamp			m_last_file_ts;
+      std::vector<double>	m_file_listed_ts;
+      TransferStatistics	m_transfer_stat;
+      std::list<std::string>	m_mirror_directories;
+      // MirrorWriter errors are counted since the Requests creation
+      int			m_mirror_errors_base;
+      int			m_stat_mirror_errors_base;
+      int			m_lima_decimation;
       std::string		m_error_msg;
+      SeriesEndCallback		m_series_end_cb;
+      bool			m_series_end_pending;
       //Synchro
       Cond			m_cond;
       bool			m_quit;
       _PollingThread*		m_polling_thread;
+      _DownloadScheduler*	m_scheduler;
       std::map<std::string,int>	m_availables_header_keys;
     };
   }
@@ -26,11 +26,17 @@
 
 #include <type_traits>
 #include <cmath>
+#include <algorithm>
+#include <atomic>
 
 namespace lima
 {
 namespace Eiger
 {
+// Count, sum, mean, min, max and the sum of the squared deviations
+// from the mean (m2), updated with the Welford algorithm so the std
+// stays accurate on long runs. Partial statistics, i.e. collected by
+// different threads, are combined with merge() (Chan et al.)
 template <typename T,
 	  typename A=typename std::conditional<std::is_integral<T>::value,
 					       long long, double>::type>
@@ -38,7 +44,8 @@ struct Statistics
 {
   int n;
   A sx;
-  A sx2;
+  double mean;
+  double m2;
   T xmin;
   T xmax;
 
@@ -46,49 +53,173 @@ struct Statistics
   { reset(); }
 
   void reset()
-  { sx = sx2 = xmin = xmax = n = 0; }
+  {
+    n = 0;
+    sx = 0;
+    mean = m2 = 0;
+    xmin = xmax = 0;
+  }
 
   void add(T x)
   {
     sx += x;
-    sx2 += x * x;
     ++n;
-    if (x < xmin)
+    double delta = x - mean;
+    mean += delta / n;
+    m2 += delta * (x - mean);
+    if ((n == 1) || (x < xmin))
       xmin = x;
-    if (x > xmax)
+    if ((n == 1) || (x > xmax))
       xmax = x;
   }
 
+  void merge(const Statistics& o)
+  {
+    if (!o.n)
+      return;
+    else if (!n) {
+      *this = o;
+      return;
+    }
+    int nt = n + o.n;
+    double delta = o.mean - mean;
+    mean += delta * o.n / nt;
+    m2 += o.m2 + delta * delta * (double(n) * o.n / nt);
+    sx += o.sx;
+    n = nt;
+    xmin = std::min(xmin, o.xmin);
+    xmax = std::max(xmax, o.xmax);
+  }
+
   operator bool() const
   { return n; }
 
   double ave() const
-  { return n ? (double(sx) / n) : 0; }
+  { return n ? mean : 0; }
 
   double std() const
+  { return n ? std::sqrt(m2 / n) : 0; }
+};
+
+// Exponentially weighted sums of a value and of its weight (i.e. bytes
+// and seconds), decayed with the time constant tau (s): their ratio is
+// the mean over a rolling window of about tau seconds up to the last
+// sample. Partial windows are combined with merge()
+struct RollingRatio
+{
+  double tau;
+  double sx;
+  double sw;
+  double t;
+
+  RollingRatio(double window) : tau(window)
+  { reset(); }
+
+  void reset()
+  { sx = sw = t = 0; }
+
+  void decay(double now)
+  {
+    if (now <= t)
+      return;
+    double f = std::exp((t - now) / tau);
+    sx *= f;
+    sw *= f;
+    t = now;
+  }
+
+  void add(double x, double w, double now)
+  {
+    decay(now);
+    sx += x;
+    sw += w;
+  }
+
+  void merge(const RollingRatio& o)
   {
-    if (!n)
-      return 0;
-    double xm = ave();
-    return std::sqrt(double(sx2) / n - xm * xm);
+    RollingRatio other(o);
+    decay(o.t);
+    other.decay(t);
+    sx += other.sx;
+    sw += other.sw;
   }
+
+  double ratio() const
+  { return (sw > 0) ? (sx / sw) : 0; }
 };
 
+// Stream frames: size (bytes) and time between frames (s). The frames
+// passed to Lima also give the dispatch queue depth after each push and
+// the time (s) the Zmq thread was stalled with the queue full.
+// Backpressure, sampled at each push: frames in Lima not decoded yet
+// (occupancy) or waiting for the decompression to start, and frames in
+// a row found already queued in the socket (a lower bound of its depth).
+// The buffer wait (s) is the dispatch thread blocked on a Lima buffer.
+// The maximum values are the high-water marks. The recent speed is the
+// throughput over the last SPEED_WINDOW seconds of frames
 struct StreamStatistics
 {
+  static constexpr double SPEED_WINDOW = 10;
+
   Statistics<int> stat_size;
   Statistics<double> stat_time;
+  Statistics<int> stat_queue;
+  Statistics<double> stat_stall;
+  Statistics<int> stat_lima;
+  Statistics<int> stat_decompress;
+  Statistics<int> stat_zmq;
+  Statistics<double> stat_buffer_wait;
+  RollingRatio roll_speed;
+
+  StreamStatistics() : roll_speed(SPEED_WINDOW)
+  {}
 
   void reset()
   {
     stat_size.reset();
     stat_time.reset();
+    stat_queue.reset();
+    stat_stall.reset();
+    stat_lima.reset();
+    stat_decompress.reset();
+    stat_zmq.reset();
+    stat_buffer_wait.reset();
+    roll_speed.reset();
+  }
+
+  // a partial collected by another thread
+  void merge(const StreamStatistics& o)
+  {
+    stat_size.merge(o.stat_size);
+    stat_time.merge(o.stat_time);
+    stat_queue.merge(o.stat_queue);
+    stat_stall.merge(o.stat_stall);
+    stat_lima.merge(o.stat_lima);
+    stat_decompress.merge(o.stat_decompress);
+    stat_zmq.merge(o.stat_zmq);
+    stat_buffer_wait.merge(o.stat_buffer_wait);
+    roll_speed.merge(o.roll_speed);
   }
 
-  void add(int size, double elapsed)
+  void add(int size, double elapsed, double now)
   {
     stat_size.add(size);
     stat_time.add(elapsed);
+    roll_speed.add(size, elapsed, now);
+  }
+
+  void add_dispatch(int depth, double stall)
+  {
+    stat_queue.add(depth);
+    if (stall > 0)
+      stat_stall.add(stall);
+  }
+
+  void add_backpressure(int lima, int decompress, int zmq)
+  {
+    stat_lima.add(lima);
+    stat_decompress.add(decompress);
+    stat_zmq.add(zmq);
   }
 
   operator bool() const
@@ -105,6 +236,272 @@ struct StreamStatistics
 
   double ave_speed() const
   { return *this ? (ave_size() / ave_time()) : 0; }
+
+  double recent_speed() const
+  { return roll_speed.ratio(); }
+
+  double ave_queue_depth() const
+  { return stat_queue.ave(); }
+
+  int max_queue_depth() const
+  { return stat_queue.xmax; }
+
+  int nb_stalls() const
+  { return stat_stall.n; }
+
+  double stall_time() const
+  { return stat_stall.sx; }
+
+  double ave_lima_occupancy() const
+  { return stat_lima.ave(); }
+
+  int max_lima_occupancy() const
+  { return stat_lima.xmax; }
+
+  double ave_decompress_depth() const
+  { return stat_decompress.ave(); }
+
+  int max_decompress_depth() const
+  { return stat_decompress.xmax; }
+
+  double ave_zmq_backlog() const
+  { return stat_zmq.ave(); }
+
+  int max_zmq_backlog() const
+  { return stat_zmq.xmax; }
+
+  double ave_buffer_wait() const
+  { return stat_buffer_wait.ave(); }
+
+  double buffer_wait_time() const
+  { return stat_buffer_wait.sx; }
+};
+
+// Filewriter downloads. Per file: size (bytes), download time and wait
+// between the file listing and its download start (s). Aggregate:
+// throughput over the time with downloads in flight and the trend of
+// the DCU FILEWRITER_BUFFER_FREE (per s)
+struct TransferStatistics
+{
+  Statistics<double> stat_size;
+  Statistics<double> stat_time;
+  Statistics<double> stat_wait;
+  Statistics<double> stat_buffer_free;
+  double busy_time;
+  double busy_start;
+  int in_flight;
+  int max_in_flight;
+  int nb_errors;
+  int nb_retries;
+  // copies to the mirror directories, set when latched
+  int nb_mirror_errors;
+  int nb_pending_mirrors;
+  double buffer_free_first_t, buffer_free_first;
+  double buffer_free_last_t, buffer_free_last;
+
+  TransferStatistics()
+  { in_flight = 0; reset(0); }
+
+  // in_flight is the current state, it is kept
+  void reset(double now)
+  {
+    stat_size.reset();
+    stat_time.reset();
+    stat_wait.reset();
+    stat_buffer_free.reset();
+    busy_time = 0;
+    busy_start = now;
+    max_in_flight = in_flight;
+    nb_errors = nb_retries = 0;
+    nb_mirror_errors = nb_pending_mirrors = 0;
+    buffer_free_first_t = buffer_free_first = 0;
+    buffer_free_last_t = buffer_free_last = 0;
+  }
+
+  void start(double wait, double now)
+  {
+    stat_wait.add(wait);
+    if (!in_flight++)
+      busy_start = now;
+    max_in_flight = std::max(max_in_flight, in_flight);
+  }
+
+  void end(bool ok, double size, double elapsed, int retries, double now)
+  {
+    if (in_flight > 0 && !--in_flight)
+      busy_time += now - busy_start;
+    if (ok) {
+      stat_size.add(size);
+      stat_time.add(elapsed);
+    } else
+      ++nb_errors;
+    nb_retries += retries;
+  }
+
+  void add_buffer_free(double value, double now)
+  {
+    if (!stat_buffer_free) {
+      buffer_free_first_t = now;
+      buffer_free_first = value;
+    }
+    stat_buffer_free.add(value);
+    buffer_free_last_t = now;
+    buffer_free_last = value;
+  }
+
+  // busy time up to now
+  void latch(double now)
+  {
+    if (in_flight) {
+      busy_time += now - busy_start;
+      busy_start = now;
+    }
+  }
+
+  int n() const
+  { return std::min(stat_size.n, stat_time.n); }
+
+  double ave_size() const
+  { return stat_size.ave(); }
+
+  double ave_time() const
+  { return stat_time.ave(); }
+
+  double ave_speed() const
+  { return n() ? (ave_size() / ave_time()) : 0; }
+
+  double throughput() const
+  { return (busy_time > 0) ? (stat_size.sx / busy_time) : 0; }
+
+  double ave_wait() const
+  { return stat_wait.ave(); }
+
+  double buffer_free_trend() const
+  {
+    double dt = buffer_free_last_t - buffer_free_first_t;
+    return (dt > 0) ? ((buffer_free_last - buffer_free_first) / dt) : 0;
+  }
+};
+
+// Statistics updated by a single thread without locking. The readers
+// copy a consistent snapshot through the sequence counter (odd while
+// updating), retrying if it changed. A reset is only requested by the
+// readers: the writer applies it on its next update, until then the
+// snapshots are empty
+template <typename S>
+class StatisticsShard
+{
+public:
+  StatisticsShard() : m_seq(0), m_reset_req(0), m_reset_ack(0) {}
+
+  // writer thread only
+  template <typename F>
+  void update(F f)
+  {
+    unsigned seq = m_seq.load(std::memory_order_relaxed);
+    m_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    unsigned reset_req = m_reset_req.load(std::memory_order_acquire);
+    if (reset_req != m_reset_ack) {
+      m_stat = S();
+      m_reset_ack = reset_req;
+    }
+    f(m_stat);
+    m_seq.store(seq + 2, std::memory_order_release);
+  }
+
+  void reset()
+  { m_reset_req.fetch_add(1); }
+
+  void latch(S& stat, bool reset=false)
+  {
+    unsigned seq0, seq1, reset_ack;
+    do {
+      seq0 = m_seq.load(std::memory_order_acquire);
+      stat = m_stat;
+      reset_ack = m_reset_ack;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      seq1 = m_seq.load(std::memory_order_relaxed);
+    } while ((seq0 & 1) || (seq0 != seq1));
+    unsigned reset_req = reset ? m_reset_req.fetch_add(1) :
+				 m_reset_req.load();
+    if (reset_req != reset_ack)
+      stat = S();
+  }
+
+private:
+  std::atomic<unsigned> m_seq;
+  std::atomic<unsigned> m_reset_req;
+  unsigned m_reset_ack;
+  S m_stat;
+};
+
+// Internal triggers of a series, from each TRIGGER command sent (s) to:
+// the first and the last stream frame of the trigger received, and the
+// command completion. The lag is the completion after the last frame,
+// DCU time not spent sending data
+struct TriggerLatency
+{
+  Statistics<double> stat_first;
+  Statistics<double> stat_last;
+  Statistics<double> stat_command;
+  Statistics<double> stat_lag;
+
+  void reset()
+  {
+    stat_first.reset();
+    stat_last.reset();
+    stat_command.reset();
+    stat_lag.reset();
+  }
+
+  void add(double sent, double first, double last, double done)
+  {
+    stat_first.add(first - sent);
+    stat_last.add(last - sent);
+    stat_command.add(done - sent);
+    stat_lag.add(done - last);
+  }
+
+  int n() const
+  { return stat_first.n; }
+
+  double ave_first() const
+  { return stat_first.ave(); }
+
+  double std_first() const
+  { return stat_first.std(); }
+
+  double max_first() const
+  { return stat_first.xmax; }
+
+  double ave_last() const
+  { return stat_last.ave(); }
+
+  double ave_command() const
+  { return stat_command.ave(); }
+
+  double ave_lag() const
+  { return stat_lag.ave(); }
+};
+
+// Elapsed time (in s) of each Interface::prepareAcq step. Some steps
+// run concurrently, so their sum can exceed the total
+struct PrepareTiming
+{
+  double disarm;
+  double clear;
+  double stream;
+  double params;
+  double arm;
+  double stream_armed;
+  double total;
+
+  PrepareTiming()
+  { reset(); }
+
+  void reset()
+  { disarm = clear = stream = params = arm = stream_armed = total = 0; }
 };
 
 template <typename T>
@@ -120,7 +517,51 @@ inline
 std::ostream& operator <<(std::ostream& os, const StreamStatistics& s)
 {
   return os << "<size=" << s.stat_size << ", time=" << s.stat_time << ", "
-	    << "speed=" << (s.ave_speed() / 1e9) << ">";
+	    << "speed=" << (s.ave_speed() / 1e9) << ", "
+	    << "recent_speed=" << (s.recent_speed() / 1e9) << ", "
+	    << "queue=" << s.stat_queue << ", "
+	    << "max_queue=" << s.max_queue_depth() << ", "
+	    << "stall=" << s.stat_stall << ", "
+	    << "lima=" << s.stat_lima << ", "
+	    << "max_lima=" << s.max_lima_occupancy() << ", "
+	    << "decompress=" << s.stat_decompress << ", "
+	    << "max_decompress=" << s.max_decompress_depth() << ", "
+	    << "zmq=" << s.stat_zmq << ", "
+	    << "max_zmq=" << s.max_zmq_backlog() << ", "
+	    << "buffer_wait=" << s.stat_buffer_wait << ">";
+}
+
+inline
+std::ostream& operator <<(std::ostream& os, const TransferStatistics& s)
+{
+  return os << "<size=" << s.stat_size << ", time=" << s.stat_time << ", "
+	    << "speed=" << (s.ave_speed() / 1e6) << ", "
+	    << "throughput=" << (s.throughput() / 1e6) << ", "
+	    << "wait=" << s.stat_wait << ", in_flight=" << s.in_flight << ", "
+	    << "max_in_flight=" << s.max_in_flight << ", "
+	    << "errors=" << s.nb_errors << ", retries=" << s.nb_retries << ", "
+	    << "mirror_errors=" << s.nb_mirror_errors << ", "
+	    << "pending_mirrors=" << s.nb_pending_mirrors << ", "
+	    << "buffer_free=" << s.buffer_free_last << ", "
+	    << "buffer_free_trend=" << s.buffer_free_trend() << ">";
+}
+
+inline
+std::ostream& operator <<(std::ostream& os, const TriggerLatency& l)
+{
+  return os << "<first=" << l.stat_first << ", "
+	    << "max_first=" << l.max_first() << ", "
+	    << "last=" << l.stat_last << ", command=" << l.stat_command << ", "
+	    << "lag=" << l.stat_lag << ">";
+}
+
+inline
+std::ostream& operator <<(std::ostream& os, const PrepareTiming& t)
+{
+  return os << "<disarm=" << t.disarm << ", clear=" << t.clear << ", "
+	    << "stream=" << t.stream << ", params=" << t.params << ", "
+	    << "arm=" << t.arm << ", stream_armed=" << t.stream_armed << ", "
+	    << "total=" << t.total << ">";
 }
 
 } // namespace Eiger
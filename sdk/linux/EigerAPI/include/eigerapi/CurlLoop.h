@@ -59,10 +59,15 @@ namespace eigerapi
 
       CURL* get_handle() const {return m_handle;}
       const std::string& get_url() const {return m_url;}
+      CurlLoop* get_loop() const {return m_loop;}
 
       FutureRequest(const std::string& url);
     protected:
       virtual void _request_finished() {};
+      // called when curl finished the request, before its status is
+      // updated: returning false turns a success into an error
+      virtual bool _complete(CURLcode /*result*/, std::string& /*error*/)
+      { return true; }
 
       void handle_result(CURLcode result);
       void _status_changed();
@@ -82,6 +87,8 @@ namespace eigerapi
       CallbackPtr*			m_cbk;
       bool				m_cbk_in_thread;
       std::string			m_url;
+      CurlLoop*				m_loop;
+      double				m_start;
     };
     typedef std::shared_ptr<FutureRequest> CurlReq;
 
@@ -91,17 +98,23 @@ namespace eigerapi
     void quit();		// quit the curl loop
 
     void add_request(CurlReq);
+    // the request is RUNNING at once but only performed after delay (s)
+    void add_request(CurlReq, double delay);
     void cancel_request(CurlReq);
 
+    pthread_t get_thread_id() const {return m_thread_id;}
+
   private:
     struct ActiveCurlRequest;
     typedef std::unique_ptr<const ActiveCurlRequest> ActReq;
     typedef std::map<CURL*,ActReq> MapRequests;
     typedef std::list<CurlReq> ListRequests;
+    typedef std::multimap<double,CurlReq> DelayedRequests;
     static void* _runFunc(void*);
     void _run();
     void _check_new_requests();
-    bool _wait_input_events();
+    bool _wait_input_events(double max_wait);
+    double _next_delayed_request();
     void _remove_canceled_requests();
 
     // Synchro
@@ -115,6 +128,7 @@ namespace eigerapi
     MapRequests		m_pending_requests;
     ListRequests	m_new_requests;
     ListRequests	m_cancel_requests;
+    DelayedRequests	m_delayed_requests;
   };
 }
 
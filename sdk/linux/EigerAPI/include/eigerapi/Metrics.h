@@ -0,0 +1,113 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERAPI_METRICS_H
+#define EIGERAPI_METRICS_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace eigerapi
+{
+  // Process-wide metrics, rendered in the Prometheus text format.
+  // The metrics are static objects, registered at construction: an
+  // update is a relaxed atomic operation, the registry lock is only
+  // taken when registering and rendering
+  class Metrics
+  {
+  public:
+    class Metric
+    {
+    public:
+      virtual ~Metric();
+      const std::string& name() const { return m_name; }
+    protected:
+      Metric(const char *name, const char *help, const char *type);
+      virtual void _render(std::string& text) const = 0;
+      friend class Metrics;
+
+      std::string	m_name;
+      std::string	m_help;
+      const char	*m_type;
+    };
+
+    // monotonic, only increased
+    class Counter : public Metric
+    {
+    public:
+      Counter(const char *name, const char *help);
+      void add(double value = 1) { _add(m_value,value); }
+    private:
+      virtual void _render(std::string& text) const;
+      std::atomic<double> m_value;
+    };
+
+    class Gauge : public Metric
+    {
+    public:
+      Gauge(const char *name, const char *help);
+      void set(double value)
+      { m_value.store(value,std::memory_order_relaxed); }
+    private:
+      virtual void _render(std::string& text) const;
+      std::atomic<double> m_value;
+    };
+
+    // bounds are the increasing bucket upper limits, +Inf is added
+    class Histogram : public Metric
+    {
+    public:
+      Histogram(const char *name, const char *help,
+		const std::vector<double>& bounds);
+      void observe(double value);
+    private:
+      typedef std::atomic<unsigned long long> Count;
+      virtual void _render(std::string& text) const;
+
+      std::vector<double>	m_bounds;
+      // not cumulative, the last one is +Inf
+      std::unique_ptr<Count[]>	m_buckets;
+      std::atomic<double>	m_sum;
+    };
+
+    // latency buckets, in seconds, from 100us to 10s
+    static std::vector<double> latency_bounds();
+
+    // appends all the registered metrics
+    static void render(std::string& text);
+    // appends a sample line: name{labels} value
+    static void render_sample(std::string& text, const std::string& name,
+			      const std::string& labels, double value);
+    // escapes a label value: backslash, double-quote and line feed
+    static std::string escape(const std::string& value);
+
+  private:
+    static void _add(std::atomic<double>& value, double inc);
+    static void _register(Metric *metric);
+    static void _unregister(Metric *metric);
+  };
+}
+
+#endif // EIGERAPI_METRICS_H
@@ -25,6 +25,7 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <atomic>
 
 #include "eigerapi/CurlLoop.h"
 
@@ -37,6 +38,11 @@ namespace eigerapi
   template <typename T>
   using HeapPtr = std::unique_ptr<T, HeapDeleter<T>>;
 
+  class BlockWriter;
+  class TargetFile;
+  class MirrorWriter;
+  class SpliceDownload;
+
   class Requests
   {
   public:
@@ -119,22 +125,114 @@ namespace eigerapi
 	       const std::string& url,
 	       const std::string& target_path,
 	       bool delete_after_transfer = true,
-	       int buffer_write_size = 64 * 1024);
+	       int buffer_write_size = 4 * 1024 * 1024,
+	       bool direct_io = false);
       virtual ~Transfer();
+
+      // split transfer: the file is fetched by HTTP Range requests,
+      // up to nb_ranges in parallel, once its size is known.
+      // A range failing on a transient error is resumed from its last
+      // written byte after retry_delay, doubled at each of max_retries.
+      // A single range skips the size probe (HEAD). If the server
+      // ignores the Range header, the file is fetched again in one request
+      Transfer(Requests& requests,
+	       const std::string& url,
+	       const std::string& target_path,
+	       bool delete_after_transfer,
+	       int nb_ranges,
+	       long long min_range_size,
+	       bool direct_io,
+	       int max_retries = 0,
+	       double retry_delay = 0.5);
+
+      // zero-copy transfer: raw HTTP GET of path on address, run in its
+      // own thread, the body is spliced from the socket to the file
+      Transfer(Requests& requests,
+	       const std::string& address,
+	       const std::string& path,
+	       const std::string& target_path,
+	       bool delete_after_transfer);
+
+      long long get_download_size() const {return m_download_size;}
+      // Adler-32 of the downloaded data, valid once finished.
+      // Not computed by the zero-copy transfers (0)
+      unsigned int get_checksum() const {return m_checksum;}
+      int get_nb_ranges() const;
+      int get_nb_retries() const;
     private:
+      class SizeProbe;
+      class Range;
+      typedef std::shared_ptr<Transfer> Ptr;
+
       static size_t _write(void *ptr, size_t size, size_t nmemb,Transfer*);
+      virtual bool _complete(CURLcode result, std::string& error);
       virtual void _request_finished();
+
+      void _start_probe(Ptr self);
+      void _start_ranges(Ptr self, long long file_size);
+      void _range_finished(Ptr self, int gen, int index, bool ok,
+			   bool retry, const std::string& error,
+			   unsigned int checksum, long long size);
+      void _restart_whole_file(Ptr self, int gen);
+      void _cancel();
+      void _start_splice(Ptr self);
+      static void* _splice_runFunc(void*);
+      void _splice_run();
+      void _add_mirror(std::shared_ptr<MirrorWriter> writer,
+		       const std::string& path);
       
       Requests&	m_requests;
       bool	m_delete_after_transfer;
-      long	m_download_size;
-      FILE*	m_target_file;
-      HeapPtr<void> m_buffer;
+      std::atomic<long long> m_download_size;
+      bool	m_preallocated;
+      unsigned int m_checksum;
+      std::unique_ptr<BlockWriter> m_writer;
+
+      // split transfer
+      struct RangeResult
+      {
+	long long offset;
+	long long length;	// -1 if unknown
+	bool done;
+	unsigned int checksum;	// of the size bytes written so far
+	long long size;
+	int nb_retries;
+      };
+      int	m_max_ranges;
+      long long	m_min_range_size;
+      int	m_max_retries;
+      double	m_retry_delay;
+      long long	m_file_size;
+      std::shared_ptr<TargetFile> m_file;
+      std::vector<RangeResult> m_ranges;
+      int	m_range_gen;	// ranges of older generations are ignored
+      int	m_nb_ranges_done;
+      std::string m_range_error;
+      std::list<std::weak_ptr<CurlLoop::FutureRequest> > m_sub_requests;
+      // zero-copy transfer
+      std::unique_ptr<SpliceDownload> m_splice;
+    };
+
+    // last image of the monitor interface, as served by the DCU (TIFF)
+    class MonitorImage : public CurlLoop::FutureRequest
+    {
+      friend class Requests;
+    public:
+      MonitorImage(const std::string& url);
+      virtual ~MonitorImage();
+
+      const std::vector<char>& get_data() const {return m_data;}
+    private:
+      static size_t _write_callback(char*, size_t, size_t, MonitorImage*);
+
+      struct curl_slist*	m_headers;
+      std::vector<char>		m_data;
     };
 
     typedef std::shared_ptr<Command> CommandReq;
     typedef std::shared_ptr<Param> ParamReq;
     typedef std::shared_ptr<Transfer> TransferReq;
+    typedef std::shared_ptr<MonitorImage> MonitorImageReq;
 
     enum COMMAND_NAME {INITIALIZE,ARM, DISARM,TRIGGER,CANCEL,ABORT,
 		       FILEWRITER_CLEAR, HV_RESET};
@@ -182,6 +280,7 @@ namespace eigerapi
 		     FILEWRITER_LS2,
 		     STREAM_MODE,
 		     STREAM_HEADER_DETAIL,
+		     MONITOR_MODE,
 		     HEADER_BEAM_CENTER_X,
 		     HEADER_BEAM_CENTER_Y,
 		     HEADER_CHI_INCREMENT,
@@ -198,7 +297,9 @@ namespace eigerapi
 		     ROI_MODE,
     };
 
-    Requests(const std::string& address);
+    // commands and parameters use a dedicated loop, file transfers and
+    // deletions are spread over nb_transfer_loops other loops
+    Requests(const std::string& address, int nb_transfer_loops = 2);
     ~Requests();
 
     std::string get_api_version();
@@ -219,16 +320,59 @@ namespace eigerapi
     ParamReq set_param(PARAM_NAME,const std::string&);
     ParamReq set_param(PARAM_NAME,const char*);
 
+    // nb_ranges < 0: use the set_transfer_ranges value
     TransferReq start_transfer(const std::string& src_filename,
 			       const std::string& target_path,
-			       bool delete_after_transfer = true);
+			       bool delete_after_transfer = true,
+			       int nb_ranges = -1);
+    // the file is downloaded once and written to all the target paths.
+    // The first is the primary: the transfer status only depends on it,
+    // the others are written by one background writer per sink index
+    TransferReq start_transfer(const std::string& src_filename,
+			       const std::vector<std::string>& target_paths,
+			       bool delete_after_transfer = true,
+			       int nb_ranges = -1);
+    // secondary sinks: copies being written and failed ones
+    int get_nb_pending_mirrors() const;
+    int get_nb_mirror_errors() const;
+    // download with a raw HTTP client splicing the socket to the file,
+    // without user space copies. Replaces the ranges, retries and
+    // O_DIRECT; not used for the transfers with mirrors
+    void set_transfer_zero_copy(bool zero_copy);
+    // write the downloaded files with O_DIRECT, bypassing the page cache
+    void set_transfer_direct_io(bool direct_io);
+    // files of at least 2 * min_range_size are split in up to nb_ranges
+    // parallel HTTP Range requests. nb_ranges <= 1 disables it
+    void set_transfer_ranges(int nb_ranges, long long min_range_size);
+    // transient transfer errors are retried with an exponential backoff,
+    // resuming from the last written byte. max_retries = 0 disables it
+    void set_transfer_retries(int max_retries, double first_delay);
+    int get_transfer_nb_ranges() const {return m_transfer_nb_ranges;}
+    // smoothed local disk write time per MB (seconds) of the transfers
+    double get_transfer_write_latency() const;
     CurlReq delete_file(const std::string& filename, bool full_url = false);
+    // the monitor mode has to be enabled
+    MonitorImageReq get_monitor_image();
     
     void cancel(CurlReq request);
+
+    // threads of the command and transfer loops
+    void get_loop_threads(std::vector<pthread_t>& thread_ids) const;
   private:
     ParamReq _create_get_param(PARAM_NAME);
     template <class T>
     ParamReq _set_param(PARAM_NAME,const T&);
+    CurlLoop& _get_transfer_loop();
+    TransferReq _start_transfer(const std::string& src_filename,
+				const std::string& target_path,
+				const std::vector<std::string>& mirror_paths,
+				bool delete_after_transfer,
+				int nb_ranges);
+    void _add_mirrors(TransferReq transfer,
+		      const std::vector<std::string>& mirror_paths);
+    std::shared_ptr<MirrorWriter> _get_mirror_writer(unsigned int index);
+    void _splice_started(TransferReq transfer);
+    void _splice_finished();
 
 
     typedef std::map<int,std::string> CACHE_TYPE;
@@ -236,7 +380,22 @@ namespace eigerapi
     std::string m_api_version;
     CACHE_TYPE	m_cmd_cache_url;
     CACHE_TYPE	m_param_cache_url;
+    std::string	m_monitor_image_url;
     CurlLoop	m_loop;
+    std::vector<std::unique_ptr<CurlLoop> > m_transfer_loops;
+    unsigned int	m_next_transfer_loop;
+    bool		m_transfer_direct_io;
+    int			m_transfer_nb_ranges;
+    long long		m_transfer_min_range_size;
+    int			m_transfer_max_retries;
+    double		m_transfer_retry_delay;
+    bool		m_transfer_zero_copy;
+    mutable pthread_mutex_t	m_transfer_lock;
+    std::vector<std::shared_ptr<MirrorWriter> > m_mirror_writers;
+    // zero-copy transfer threads, waited for at destruction
+    pthread_cond_t	m_splice_cond;
+    int			m_nb_splice_running;
+    std::list<std::weak_ptr<Transfer> > m_splice_transfers;
   };
 }
 
@@ -0,0 +1,74 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERAPI_TRACE_H
+#define EIGERAPI_TRACE_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace eigerapi
+{
+  // Chrome/Perfetto trace-event recorder, process wide. Inactive, an
+  // event only costs an atomic load. Active, it is copied into a slot
+  // preallocated by start(): the events beyond max_events are dropped
+  // and counted. Times are CLOCK_MONOTONIC seconds, from now()
+  class Trace
+  {
+  public:
+    static const size_t DEFAULT_MAX_EVENTS = 1 << 20;
+
+    static bool is_active()
+    { return s_active.load(std::memory_order_relaxed); }
+
+    // the previous events are cleared
+    static void start(size_t max_events = DEFAULT_MAX_EVENTS);
+    static void stop();
+    // stops the recording and writes the JSON trace file
+    static void write(const std::string& path);
+    static void get_nb_events(size_t& nb_events, size_t& nb_dropped);
+
+    static double now();
+    // span [start, end], frame < 0 for no frame argument
+    static void complete(const char *name, const char *cat,
+			 double start, double end, long long frame = -1);
+    static void instant(const char *name, const char *cat,
+			long long frame = -1);
+
+  private:
+    struct Event;
+    static void _record(const char *name, const char *cat, char phase,
+			double ts, double dur, long long frame);
+    static void _pause();
+
+    static std::atomic<bool> s_active;
+    static std::vector<Event> s_events;
+    static std::atomic<size_t> s_next;
+    static std::atomic<size_t> s_dropped;
+    // recording threads past the is_active() check
+    static std::atomic<int> s_writers;
+  };
+}
+
+#endif // EIGERAPI_TRACE_H
@@ -0,0 +1,328 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9 
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sstream>
+
+#include "BlockWriter.h"
+#include "eigerapi/EigerDefines.h"
+
+using namespace eigerapi;
+
+/*----------------------------------------------------------------------------
+			   Class Adler32
+----------------------------------------------------------------------------*/
+void Adler32::update(const void *data, size_t size)
+{
+  static const unsigned int BASE = 65521;
+  // largest n such that 255n(n+1)/2 + (n+1)(BASE-1) <= 2^32-1
+  static const size_t NMAX = 5552;
+
+  const unsigned char *p = (const unsigned char*)data;
+  unsigned int a = m_a, b = m_b;
+  while(size > 0)
+    {
+      size_t n = std::min(size, NMAX);
+      size -= n;
+      while(n--)
+	{
+	  a += *p++;
+	  b += a;
+	}
+      a %= BASE;
+      b %= BASE;
+    }
+  m_a = a, m_b = b;
+}
+
+unsigned int Adler32::combine(unsigned int adler1, unsigned int adler2,
+			      long long len2)
+{
+  static const unsigned long BASE = 65521;
+
+  unsigned long rem = len2 % BASE;
+  unsigned long sum1 = adler1 & 0xffff;
+  unsigned long sum2 = (rem * sum1) % BASE;
+  sum1 += (adler2 & 0xffff) + BASE - 1;
+  sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + BASE - rem;
+  if(sum1 >= BASE) sum1 -= BASE;
+  if(sum1 >= BASE) sum1 -= BASE;
+  if(sum2 >= (BASE << 1)) sum2 -= (BASE << 1);
+  if(sum2 >= BASE) sum2 -= BASE;
+  return sum1 | (sum2 << 16);
+}
+
+/*----------------------------------------------------------------------------
+			   Class TargetFile
+----------------------------------------------------------------------------*/
+std::atomic<double> TargetFile::s_write_latency(0.);
+
+static inline double _now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+TargetFile::TargetFile(const std::string& path, bool direct_io) :
+  m_path(path),
+  m_fd(-1),
+  m_direct_io(direct_io)
+{
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+  if(m_direct_io)
+    {
+      m_fd = open(path.c_str(),flags | O_DIRECT,0644);
+      // not all the filesystems support it (tmpfs, some NFS versions)
+      if(m_fd < 0 && errno == EINVAL)
+	m_direct_io = false;
+    }
+  if(m_fd < 0)
+    m_fd = open(path.c_str(),flags,0644);
+  if(m_fd < 0)
+    {
+      char str_errno[1024];
+      const char *error_msg = strerror_r(errno,str_errno,sizeof(str_errno));
+      std::ostringstream error_buffer;
+      error_buffer << "Can't open destination file " << path;
+      THROW_EIGER_EXCEPTION(error_buffer.str().c_str(), error_msg);
+    }
+}
+
+TargetFile::~TargetFile()
+{
+  if(m_fd >= 0)
+    ::close(m_fd);
+  std::vector<Mirror>::iterator i, end = m_mirrors.end();
+  for(i = m_mirrors.begin();i != end;++i)
+    i->first->close(i->second,-1,false);
+}
+
+void TargetFile::add_mirror(MirrorWriterPtr writer, const std::string& path)
+{
+  m_mirrors.push_back(Mirror(writer,writer->open(path,m_path)));
+}
+
+void TargetFile::preallocate(long long size)
+{
+  // only a hint: a failure does not prevent writing
+  if(m_fd >= 0 && size > 0)
+    fallocate(m_fd,0,0,size);
+}
+
+bool TargetFile::write(const char *data, size_t len, long long offset,
+		       std::string& error)
+{
+  // small tail writes are dominated by the syscall cost, not timed
+  static const size_t MIN_TIMED_SIZE = 1024 * 1024;
+  double start = (len >= MIN_TIMED_SIZE) ? _now() : 0.;
+  size_t total = len;
+  while(len > 0)
+    {
+      ssize_t written = pwrite(m_fd,data,len,offset);
+      if(written < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  return _set_error("pwrite",error);
+	}
+      data += written, len -= written, offset += written;
+    }
+  std::vector<Mirror>::iterator i, end = m_mirrors.end();
+  for(i = m_mirrors.begin();i != end;++i)
+    i->first->write(i->second,data - total,total,offset - total);
+  if(start > 0.)
+    {
+      double latency = (_now() - start) * (1024. * 1024.) / total;
+      double previous = s_write_latency;
+      s_write_latency = previous > 0. ?
+			previous + 0.2 * (latency - previous) : latency;
+    }
+  return true;
+}
+
+bool TargetFile::splice(int pipe_fd, size_t len, long long offset,
+			std::string& error)
+{
+  loff_t file_offset = offset;
+  while(len > 0)
+    {
+      ssize_t written = ::splice(pipe_fd,NULL,m_fd,&file_offset,len,
+				 SPLICE_F_MOVE);
+      if(written < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  return _set_error("splice",error);
+	}
+      else if(!written)		// the pipe can't be short of data
+	{
+	  error = "splice " + m_path + ": pipe empty";
+	  return false;
+	}
+      len -= written;
+    }
+  return true;
+}
+
+bool TargetFile::close(long long size, std::string& error, bool complete)
+{
+  if(m_fd < 0)
+    return true;
+
+  bool ok = true;
+  if(size >= 0 && ftruncate(m_fd,size))
+    ok = _set_error("ftruncate",error);
+  if(::close(m_fd) && ok)
+    ok = _set_error("close",error);
+  m_fd = -1;
+
+  // the mirrors read the dropped blocks back from the closed file
+  std::vector<Mirror>::iterator i, end = m_mirrors.end();
+  for(i = m_mirrors.begin();i != end;++i)
+    i->first->close(i->second,size,complete && ok);
+  m_mirrors.clear();
+  return ok;
+}
+
+bool TargetFile::_set_error(const char *op, std::string& error)
+{
+  char str_errno[1024];
+  const char *error_msg = strerror_r(errno,str_errno,sizeof(str_errno));
+  std::ostringstream error_buffer;
+  error_buffer << op << " " << m_path << ": " << error_msg;
+  error = error_buffer.str();
+  return false;
+}
+
+/*----------------------------------------------------------------------------
+			   Class BlockWriter
+----------------------------------------------------------------------------*/
+BlockWriter::BlockWriter(const std::string& path,
+			 size_t block_size,
+			 bool direct_io) :
+  m_file(new TargetFile(path,direct_io)),
+  m_owner(true),
+  m_offset(0),
+  m_fill(0),
+  m_size(0)
+{
+  _alloc_buffer(block_size);
+}
+
+BlockWriter::BlockWriter(TargetFilePtr file, long long offset,
+			 size_t block_size) :
+  m_file(file),
+  m_owner(false),
+  m_offset(offset),
+  m_fill(0),
+  m_size(0)
+{
+  _alloc_buffer(block_size);
+}
+
+void BlockWriter::_alloc_buffer(size_t block_size)
+{
+  m_block_size = (std::max(block_size, size_t(ALIGNMENT)) + ALIGNMENT - 1) &
+		 ~(ALIGNMENT - 1);
+  void *ptr;
+  if(posix_memalign(&ptr,ALIGNMENT,m_block_size))
+    THROW_EIGER_EXCEPTION("Can't allocate write buffer memory","");
+  m_buffer.reset((char*)ptr);
+}
+
+bool BlockWriter::write(const void *data, size_t size)
+{
+  if(!m_error.empty())
+    return false;
+
+  const char *p = (const char*)data;
+  while(size > 0)
+    {
+      size_t n = std::min(size, m_block_size - m_fill);
+      memcpy(m_buffer.get() + m_fill,p,n);
+      m_fill += n, p += n, size -= n;
+      if(m_fill == m_block_size && !_write_block(m_fill,m_fill))
+	return false;
+    }
+  return true;
+}
+
+bool BlockWriter::flush()
+{
+  if(!m_error.empty())
+    return false;
+  if(!m_fill)
+    return true;
+
+  // O_DIRECT needs aligned sizes: pad, the file is truncated at the end.
+  // Only the tail of the file can be unaligned
+  size_t len = m_fill;
+  if(m_file->is_direct_io())
+    {
+      size_t aligned_len = (len + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+      memset(m_buffer.get() + len,0,aligned_len - len);
+      len = aligned_len;
+    }
+  return _write_block(len,m_fill);
+}
+
+bool BlockWriter::flush_partial()
+{
+  if(!m_file->is_direct_io())
+    return flush();
+  if(!m_error.empty())
+    return false;
+
+  size_t len = m_fill & ~(ALIGNMENT - 1);
+  if(!len)
+    {
+      m_fill = 0;
+      return true;
+    }
+  return _write_block(len,len);
+}
+
+bool BlockWriter::finish(bool complete)
+{
+  bool ok = flush();
+  if(m_owner && !m_file->close(m_offset + m_size,m_error,complete && ok))
+    ok = false;
+  return ok;
+}
+
+bool BlockWriter::_write_block(size_t len, size_t data_len)
+{
+  if(!m_file->write(m_buffer.get(),len,m_offset + m_size,m_error))
+    return false;
+  m_checksum.update(m_buffer.get(),data_len);
+  m_size += data_len;
+  m_fill = 0;
+  return true;
+}
@@ -0,0 +1,137 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9 
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERAPI_BLOCKWRITER_H
+#define EIGERAPI_BLOCKWRITER_H
+
+#include <atomic>
+#include <string>
+
+#include "eigerapi/Requests.h"
+#include "MirrorWriter.h"
+
+namespace eigerapi
+{
+  // Adler-32 running checksum (RFC 1950)
+  class Adler32
+  {
+  public:
+    Adler32() : m_a(1), m_b(0) {}
+    void update(const void *data, size_t size);
+    unsigned int get() const {return (m_b << 16) | m_a;}
+    // checksum of the concatenation of two blocks, len2 is the 2nd size
+    static unsigned int combine(unsigned int adler1, unsigned int adler2,
+				long long len2);
+  private:
+    unsigned int m_a;
+    unsigned int m_b;
+  };
+
+  // Destination file of a download, shared by the ranges of a split
+  // transfer. It can be preallocated and opened with O_DIRECT. The
+  // written blocks are also passed to the mirrors
+  class TargetFile
+  {
+  public:
+    static const size_t ALIGNMENT = 4 * 1024;
+
+    TargetFile(const std::string& path, bool direct_io = false);
+    ~TargetFile();
+
+    void preallocate(long long size);
+    void add_mirror(MirrorWriterPtr writer, const std::string& path);
+    bool write(const char *data, size_t len, long long offset,
+	       std::string& error);
+    // move len bytes from a pipe, without user space copy.
+    // Not forwarded to the mirrors
+    bool splice(int pipe_fd, size_t len, long long offset,
+		std::string& error);
+    // the mirrors are kept only if complete
+    bool close(long long size, std::string& error, bool complete = true);
+
+    bool is_direct_io() const {return m_direct_io;}
+    const std::string& get_path() const {return m_path;}
+
+    // smoothed pwrite time per MB (seconds) over all the target files
+    static double get_write_latency() {return s_write_latency;}
+  private:
+    static std::atomic<double> s_write_latency;
+
+    bool _set_error(const char *op, std::string& error);
+
+    typedef std::pair<MirrorWriterPtr,MirrorWriter::FilePtr> Mirror;
+
+    std::string		m_path;
+    int			m_fd;
+    bool		m_direct_io;
+    std::vector<Mirror>	m_mirrors;
+  };
+  typedef std::shared_ptr<TargetFile> TargetFilePtr;
+
+  // Download sink: the data is gathered in large aligned blocks written
+  // with pwrite at the given offset of the target file.
+  // Not thread safe, it is fed by a single curl loop
+  class BlockWriter
+  {
+  public:
+    static const size_t ALIGNMENT = TargetFile::ALIGNMENT;
+    static const size_t DEFAULT_BLOCK_SIZE = 4 * 1024 * 1024;
+
+    // the writer owns the file
+    BlockWriter(const std::string& path,
+		size_t block_size = DEFAULT_BLOCK_SIZE,
+		bool direct_io = false);
+    // the writer fills the file from offset, the owner closes it
+    BlockWriter(TargetFilePtr file, long long offset,
+		size_t block_size = DEFAULT_BLOCK_SIZE);
+
+    TargetFilePtr get_file() const {return m_file;}
+    void preallocate(long long size) {m_file->preallocate(size);}
+    bool write(const void *data, size_t size);
+    bool flush();
+    // after an interrupted download: with O_DIRECT only the aligned part
+    // is written, the tail is dropped so the download resumes aligned
+    bool flush_partial();
+    bool finish(bool complete = true);
+
+    long long get_size() const {return m_size;}
+    // checksum of the get_size() bytes written
+    unsigned int get_checksum() const {return m_checksum.get();}
+    const std::string& get_error() const {return m_error;}
+  private:
+    void _alloc_buffer(size_t block_size);
+    bool _write_block(size_t len, size_t data_len);
+
+    TargetFilePtr	m_file;
+    bool		m_owner;
+    long long		m_offset;
+    size_t		m_block_size;
+    HeapPtr<char>	m_buffer;
+    size_t		m_fill;
+    long long		m_size;
+    Adler32		m_checksum;
+    std::string		m_error;
+  };
+}
+
+#endif // EIGERAPI_BLOCKWRITER_H
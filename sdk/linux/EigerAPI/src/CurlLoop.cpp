@@ -23,9 +23,13 @@
 #include <fcntl.h>
 #include <string.h>
 #include <sys/select.h>
+#include <sys/time.h>
+#include <time.h>
 
 #include "eigerapi/CurlLoop.h"
 #include "eigerapi/EigerDefines.h"
+#include "eigerapi/Metrics.h"
+#include "eigerapi/Trace.h"
 #include "AutoMutex.h"
 
 #include <regex>
@@ -47,6 +51,12 @@ struct CURL_INIT
   }
 } global_init;
 
+static Metrics::Histogram rest_duration("eiger_rest_request_duration_seconds",
+					"Detector REST API request duration",
+					Metrics::latency_bounds());
+static Metrics::Counter rest_errors("eiger_rest_request_errors_total",
+				    "Detector REST API requests failed");
+
 
 // -------------------- CurlLoop::Request --------------------
 
@@ -54,7 +64,9 @@ CurlLoop::FutureRequest::FutureRequest(const std::string& url) :
   m_status(IDLE),
   m_http_code(0),
   m_cbk(NULL),
-  m_url(url)
+  m_url(url),
+  m_loop(NULL),
+  m_start(0)
 {
   if(pthread_mutex_init(&m_lock,NULL))
     THROW_EIGER_EXCEPTION("pthread_mutex_init","Can't initialize the lock");
@@ -78,16 +90,45 @@ CurlLoop::FutureRequest::~FutureRequest()
   pthread_mutex_destroy(&m_lock);
 }
 
-inline void CurlLoop::FutureRequest::handle_result(CURLcode result)
+void CurlLoop::FutureRequest::handle_result(CURLcode result)
 {
+  std::string error;
+  bool completed = _complete(result, error);
+
+  if(m_start > 0)
+    {
+      double end = Trace::now();
+      // without the scheme and host
+      size_t host_end = m_url.find('/',m_url.find("//") + 2);
+      const char *name = m_url.c_str();
+      if(host_end != std::string::npos)
+	name += host_end + 1;
+      if(Trace::is_active())
+	Trace::complete(name,"rest",m_start,end);
+      // the file downloads are not API requests
+      if(strstr(name,"/api/"))
+	{
+	  rest_duration.observe(end - m_start);
+	  if(!completed || result != CURLE_OK)
+	    rest_errors.add();
+	}
+      m_start = 0;
+    }
+
   Lock lock(&m_lock);
   if(m_status == FutureRequest::RUNNING)
     {
+      if(!completed)
+	result = CURLE_WRITE_ERROR;
       switch(result)
 	{
 	case CURLE_OK:
 	  m_status = FutureRequest::OK;
 	  break;
+	case CURLE_WRITE_ERROR:
+	  m_status = FutureRequest::ERROR;
+	  m_error_code = error.empty() ? curl_easy_strerror(result) : error;
+	  break;
 	default: // error
 	  m_status = FutureRequest::ERROR;
 	  m_error_code = curl_easy_strerror(result);
@@ -223,7 +264,10 @@ struct CurlLoop::ActiveCurlRequest
 
   ActiveCurlRequest(CurlReq r, CURLM *mh)
     : req(r), multi_handle(mh)
-  { curl_multi_add_handle(multi_handle, req->get_handle()); }
+  {
+    req->m_start = Trace::now();
+    curl_multi_add_handle(multi_handle, req->get_handle());
+  }
 
   ~ActiveCurlRequest()
   { curl_multi_remove_handle(multi_handle, req->get_handle()); };
@@ -290,6 +334,35 @@ void CurlLoop::add_request(CurlReq new_request)
 
   m_new_requests.push_back(new_request);
   new_request->m_status = FutureRequest::RUNNING;
+  new_request->m_loop = this;
+
+  if(write(m_pipes[1],"|",1) == -1 && errno != EAGAIN)
+    THROW_EIGER_EXCEPTION("write into pipe","synchronization failed");
+
+  pthread_cond_broadcast(&m_cond);
+}
+
+static inline double _monotonic_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void CurlLoop::add_request(CurlReq new_request, double delay)
+{
+  if(delay <= 0.)
+    {
+      add_request(new_request);
+      return;
+    }
+
+  Lock alock(&m_lock);
+
+  DelayedRequests::value_type value(_monotonic_now() + delay,new_request);
+  m_delayed_requests.insert(value);
+  new_request->m_status = FutureRequest::RUNNING;
+  new_request->m_loop = this;
 
   if(write(m_pipes[1],"|",1) == -1 && errno != EAGAIN)
     THROW_EIGER_EXCEPTION("write into pipe","synchronization failed");
@@ -331,7 +404,22 @@ inline void CurlLoop::_check_new_requests()
   m_new_requests.clear();
 }
 
-inline bool CurlLoop::_wait_input_events()
+// move the due delayed requests to the new ones, return the time until
+// the next one or -1
+inline double CurlLoop::_next_delayed_request()
+{
+  if(m_delayed_requests.empty())
+    return -1.;
+
+  double now = _monotonic_now();
+  DelayedRequests::iterator i = m_delayed_requests.begin();
+  for(;i != m_delayed_requests.end() && i->first <= now;
+      i = m_delayed_requests.erase(i))
+    m_new_requests.push_back(i->second);
+  return m_delayed_requests.empty() ? -1. : i->first - now;
+}
+
+inline bool CurlLoop::_wait_input_events(double max_wait)
 {
   fd_set fdread;
   fd_set fdwrite;
@@ -348,6 +436,9 @@ inline bool CurlLoop::_wait_input_events()
   struct timeval* timeoutPt;
   long curl_timeout = -1;
   curl_multi_timeout(m_multi_handle,&curl_timeout);
+  // wake up for the next delayed request
+  if(max_wait >= 0. && (curl_timeout < 0 || max_wait * 1000 < curl_timeout))
+    curl_timeout = long(max_wait * 1000) + 1;
   if(curl_timeout >=0)
     {
       timeout.tv_sec = curl_timeout / 1000;
@@ -388,6 +479,13 @@ inline void CurlLoop::_remove_canceled_requests()
       MapRequests::iterator request = m_pending_requests.find(req->get_handle());
       if(request != m_pending_requests.end())
 	m_pending_requests.erase(request);
+
+      DelayedRequests::iterator d = m_delayed_requests.begin();
+      while(d != m_delayed_requests.end())
+	if(d->second == req)
+	  d = m_delayed_requests.erase(d);
+	else
+	  ++d;
     }
   m_cancel_requests.clear();
 }
@@ -397,9 +495,25 @@ void CurlLoop::_run()
   Lock lock(&m_lock);
   while(!m_quit)
     {
+      double next_delayed = _next_delayed_request();
       while(!m_quit && 
 	    m_pending_requests.empty() && m_new_requests.empty())
-	pthread_cond_wait(&m_cond,&m_lock);
+	{
+	  if(next_delayed < 0.)
+	    pthread_cond_wait(&m_cond,&m_lock);
+	  else
+	    {
+	      struct timeval now;
+	      struct timespec deadline;
+	      gettimeofday(&now,NULL);
+	      long long ns = ((long long)now.tv_sec * 1000000LL + now.tv_usec) * 1000LL +
+			     (long long)(next_delayed * 1e9);
+	      deadline.tv_sec = ns / 1000000000LL;
+	      deadline.tv_nsec = ns % 1000000000LL;
+	      pthread_cond_timedwait(&m_cond,&m_lock,&deadline);
+	    }
+	  next_delayed = _next_delayed_request();
+	}
       if(m_quit)
 	break;
 
@@ -408,7 +522,7 @@ void CurlLoop::_run()
 
       {
 	Unlock u(lock);
-	if (!_wait_input_events())
+	if (!_wait_input_events(next_delayed))
 	  continue;
 	
 	// flush pipe
@@ -445,4 +559,5 @@ void CurlLoop::_run()
 
   //cleanup
   m_pending_requests.clear();
+  m_delayed_requests.clear();
 }
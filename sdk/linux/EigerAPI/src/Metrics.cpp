@@ -0,0 +1,221 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <pthread.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "eigerapi/Metrics.h"
+#include "AutoMutex.h"
+
+using namespace eigerapi;
+
+struct _Registry
+{
+  _Registry() { pthread_mutex_init(&lock,NULL); }
+  ~_Registry() { pthread_mutex_destroy(&lock); }
+
+  pthread_mutex_t	lock;
+  std::vector<Metrics::Metric*> metrics;
+};
+
+// constructed by the first metric, so destroyed after the last one
+static _Registry& _get_registry()
+{
+  static _Registry registry;
+  return registry;
+}
+
+static std::string _format(double value)
+{
+  if(std::isinf(value))
+    return value > 0 ? "+Inf" : "-Inf";
+  else if(std::isnan(value))
+    return "NaN";
+  // the shortest representation read back as the same value
+  char buffer[32];
+  for(int precision = 6;precision <= 17;++precision)
+    {
+      snprintf(buffer,sizeof(buffer),"%.*g",precision,value);
+      if(strtod(buffer,NULL) == value)
+	break;
+    }
+  return buffer;
+}
+
+/*----------------------------------------------------------------------------
+			   Class Metrics::Metric
+----------------------------------------------------------------------------*/
+Metrics::Metric::Metric(const char *name, const char *help,
+			const char *type) :
+  m_name(name),
+  m_help(help),
+  m_type(type)
+{
+  Metrics::_register(this);
+}
+
+Metrics::Metric::~Metric()
+{
+  Metrics::_unregister(this);
+}
+
+/*----------------------------------------------------------------------------
+			   Class Metrics::Counter
+----------------------------------------------------------------------------*/
+Metrics::Counter::Counter(const char *name, const char *help) :
+  Metric(name,help,"counter"),
+  m_value(0)
+{
+}
+
+void Metrics::Counter::_render(std::string& text) const
+{
+  render_sample(text,m_name,"",m_value.load(std::memory_order_relaxed));
+}
+
+/*----------------------------------------------------------------------------
+			   Class Metrics::Gauge
+----------------------------------------------------------------------------*/
+Metrics::Gauge::Gauge(const char *name, const char *help) :
+  Metric(name,help,"gauge"),
+  m_value(0)
+{
+}
+
+void Metrics::Gauge::_render(std::string& text) const
+{
+  render_sample(text,m_name,"",m_value.load(std::memory_order_relaxed));
+}
+
+/*----------------------------------------------------------------------------
+			   Class Metrics::Histogram
+----------------------------------------------------------------------------*/
+Metrics::Histogram::Histogram(const char *name, const char *help,
+			      const std::vector<double>& bounds) :
+  Metric(name,help,"histogram"),
+  m_bounds(bounds),
+  m_buckets(new Count[bounds.size() + 1]),
+  m_sum(0)
+{
+  for(size_t i = 0;i <= m_bounds.size();++i)
+    m_buckets[i] = 0;
+}
+
+void Metrics::Histogram::observe(double value)
+{
+  size_t bucket = std::lower_bound(m_bounds.begin(),m_bounds.end(),value) -
+		  m_bounds.begin();
+  m_buckets[bucket].fetch_add(1,std::memory_order_relaxed);
+  _add(m_sum,value);
+}
+
+// the buckets are read one by one, a concurrent observation may only
+// be partially visible: the count is taken from the buckets read, so
+// it stays consistent with them
+void Metrics::Histogram::_render(std::string& text) const
+{
+  std::string bucket_name = m_name + "_bucket";
+  unsigned long long count = 0;
+  for(size_t i = 0;i <= m_bounds.size();++i)
+    {
+      count += m_buckets[i].load(std::memory_order_relaxed);
+      double le = (i < m_bounds.size()) ? m_bounds[i] : INFINITY;
+      render_sample(text,bucket_name,"le=\"" + _format(le) + "\"",count);
+    }
+  render_sample(text,m_name + "_sum","",m_sum.load(std::memory_order_relaxed));
+  render_sample(text,m_name + "_count","",count);
+}
+
+/*----------------------------------------------------------------------------
+			   Class Metrics
+----------------------------------------------------------------------------*/
+std::vector<double> Metrics::latency_bounds()
+{
+  return {1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2,
+	  0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+}
+
+void Metrics::render(std::string& text)
+{
+  _Registry& registry = _get_registry();
+  Lock lock(&registry.lock);
+  for(const Metric *metric: registry.metrics)
+    {
+      text += "# HELP " + metric->m_name + " " + metric->m_help + "\n";
+      text += "# TYPE " + metric->m_name + " " + metric->m_type + "\n";
+      metric->_render(text);
+    }
+}
+
+void Metrics::render_sample(std::string& text, const std::string& name,
+			    const std::string& labels, double value)
+{
+  text += name;
+  if(!labels.empty())
+    text += "{" + labels + "}";
+  text += " " + _format(value) + "\n";
+}
+
+std::string Metrics::escape(const std::string& value)
+{
+  std::string escaped;
+  for(char c: value)
+    {
+      if(c == '\\' || c == '"')
+	escaped += '\\';
+      else if(c == '\n')
+	{
+	  escaped += "\\n";
+	  continue;
+	}
+      escaped += c;
+    }
+  return escaped;
+}
+
+void Metrics::_add(std::atomic<double>& value, double inc)
+{
+  double current = value.load(std::memory_order_relaxed);
+  while(!value.compare_exchange_weak(current,current + inc,
+				     std::memory_order_relaxed));
+}
+
+void Metrics::_register(Metric *metric)
+{
+  _Registry& registry = _get_registry();
+  Lock lock(&registry.lock);
+  registry.metrics.push_back(metric);
+}
+
+void Metrics::_unregister(Metric *metric)
+{
+  _Registry& registry = _get_registry();
+  Lock lock(&registry.lock);
+  std::vector<Metric*>& metrics = registry.metrics;
+  metrics.erase(std::remove(metrics.begin(),metrics.end(),metric),
+		metrics.end());
+}
@@ -0,0 +1,286 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "MirrorWriter.h"
+#include "AutoMutex.h"
+#include "eigerapi/EigerDefines.h"
+
+using namespace eigerapi;
+
+/*----------------------------------------------------------------------------
+			   Class MirrorWriter::File
+----------------------------------------------------------------------------*/
+class MirrorWriter::File
+{
+public:
+  File(const std::string& path, const std::string& primary_path) :
+    m_path(path), m_primary_path(primary_path), m_fd(-1) {}
+  ~File()
+  {
+    if(m_fd >= 0)
+      ::close(m_fd);
+  }
+
+  std::string	m_path;
+  std::string	m_primary_path;
+  int		m_fd;
+  std::string	m_error;
+  // blocks not queued, copied from the primary file at the end.
+  // Protected by the MirrorWriter lock
+  std::vector<std::pair<long long,size_t> > m_dropped;
+};
+
+/*----------------------------------------------------------------------------
+			   Class MirrorWriter
+----------------------------------------------------------------------------*/
+MirrorWriter::MirrorWriter(size_t max_queued) :
+  m_queued(0),
+  m_max_queued(max_queued),
+  m_nb_open(0),
+  m_nb_errors(0),
+  m_quit(false),
+  m_thread_id(0)
+{
+  if(pthread_mutex_init(&m_lock,NULL))
+    THROW_EIGER_EXCEPTION("pthread_mutex_init","Can't initialize the lock");
+  if(pthread_cond_init(&m_cond,NULL))
+    THROW_EIGER_EXCEPTION("pthread_cond_init",
+			  "Can't initialize the variable condition");
+  if(pthread_create(&m_thread_id,NULL,_runFunc,this))
+    THROW_EIGER_EXCEPTION("pthread_create","Can't start the mirror thread");
+}
+
+MirrorWriter::~MirrorWriter()
+{
+  {
+    Lock lock(&m_lock);
+    m_quit = true;
+    pthread_cond_broadcast(&m_cond);
+  }
+  pthread_join(m_thread_id,NULL);
+
+  pthread_cond_destroy(&m_cond);
+  pthread_mutex_destroy(&m_lock);
+}
+
+MirrorWriter::FilePtr MirrorWriter::open(const std::string& path,
+					 const std::string& primary_path)
+{
+  Lock lock(&m_lock);
+  ++m_nb_open;
+  return FilePtr(new File(path,primary_path));
+}
+
+void MirrorWriter::write(FilePtr file, const char *data, size_t len,
+			 long long offset)
+{
+  Lock lock(&m_lock);
+  if(m_queued + len > m_max_queued)
+    {
+      file->m_dropped.push_back(std::make_pair(offset,len));
+      return;
+    }
+
+  m_jobs.push_back(Job());
+  Job& job = m_jobs.back();
+  job.file = file;
+  job.data.assign(data,data + len);
+  job.offset = offset;
+  job.close = false;
+  m_queued += len;
+  pthread_cond_broadcast(&m_cond);
+}
+
+void MirrorWriter::close(FilePtr file, long long size, bool complete)
+{
+  Lock lock(&m_lock);
+  m_jobs.push_back(Job());
+  Job& job = m_jobs.back();
+  job.file = file;
+  job.close = true;
+  job.size = size;
+  job.complete = complete;
+  pthread_cond_broadcast(&m_cond);
+}
+
+int MirrorWriter::get_nb_pending() const
+{
+  Lock lock(&m_lock);
+  return m_nb_open;
+}
+
+int MirrorWriter::get_nb_errors() const
+{
+  Lock lock(&m_lock);
+  return m_nb_errors;
+}
+
+void* MirrorWriter::_runFunc(void *mirrorPt)
+{
+  ((MirrorWriter*)mirrorPt)->_run();
+  return NULL;
+}
+
+void MirrorWriter::_run()
+{
+  Lock lock(&m_lock);
+  while(true)
+    {
+      while(!m_quit && m_jobs.empty())
+	pthread_cond_wait(&m_cond,&m_lock);
+      if(m_jobs.empty())	// quit once drained
+	break;
+
+      Job job(std::move(m_jobs.front()));
+      m_jobs.pop_front();
+      File& file = *job.file;
+      if(job.close)
+	{
+	  {
+	    Unlock u(lock);
+	    _close(file,job.size,job.complete);
+	  }
+	  --m_nb_open;
+	  if(!file.m_error.empty())
+	    ++m_nb_errors;
+	}
+      else
+	{
+	  {
+	    Unlock u(lock);
+	    _write(file,job.data.data(),job.data.size(),job.offset);
+	  }
+	  m_queued -= job.data.size();
+	}
+    }
+}
+
+void MirrorWriter::_write(File& file, const char *data, size_t len,
+			  long long offset)
+{
+  if(!file.m_error.empty())
+    return;
+  if(file.m_fd < 0)
+    {
+      file.m_fd = ::open(file.m_path.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+      if(file.m_fd < 0)
+	return _set_error(file,"open");
+    }
+
+  while(len > 0)
+    {
+      ssize_t written = pwrite(file.m_fd,data,len,offset);
+      if(written < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  return _set_error(file,"pwrite");
+	}
+      data += written, len -= written, offset += written;
+    }
+}
+
+void MirrorWriter::_close(File& file, long long size, bool complete)
+{
+  if(!complete)
+    {
+      if(file.m_fd >= 0)
+	{
+	  ::close(file.m_fd);
+	  file.m_fd = -1;
+	}
+      unlink(file.m_path.c_str());
+      return;
+    }
+
+  std::vector<std::pair<long long,size_t> > dropped;
+  {
+    Lock lock(&m_lock);
+    dropped.swap(file.m_dropped);
+  }
+  // nothing queued: an empty file still has to be created
+  if(file.m_fd < 0 && file.m_error.empty())
+    _write(file,NULL,0,0);
+
+  if(!dropped.empty() && file.m_error.empty())
+    {
+      int primary_fd = ::open(file.m_primary_path.c_str(),O_RDONLY);
+      if(primary_fd < 0)
+	_set_error(file,"open primary");
+      std::vector<char> buffer(4 * 1024 * 1024);
+      std::vector<std::pair<long long,size_t> >::iterator i;
+      for(i = dropped.begin();primary_fd >= 0 && i != dropped.end();++i)
+	{
+	  long long offset = i->first;
+	  size_t len = i->second;
+	  while(len > 0 && file.m_error.empty())
+	    {
+	      ssize_t nb_read = pread(primary_fd,buffer.data(),
+				      std::min(len,buffer.size()),offset);
+	      if(nb_read < 0 && errno == EINTR)
+		continue;
+	      else if(nb_read < 0)
+		_set_error(file,"pread primary");
+	      else if(!nb_read)		// the tail padding is not in the file
+		break;
+	      else
+		{
+		  _write(file,buffer.data(),nb_read,offset);
+		  offset += nb_read, len -= nb_read;
+		}
+	    }
+	}
+      if(primary_fd >= 0)
+	::close(primary_fd);
+    }
+
+  if(file.m_error.empty() && size >= 0 && ftruncate(file.m_fd,size))
+    _set_error(file,"ftruncate");
+  if(file.m_fd >= 0)
+    {
+      if(::close(file.m_fd) && file.m_error.empty())
+	_set_error(file,"close");
+      file.m_fd = -1;
+    }
+  if(!file.m_error.empty())
+    unlink(file.m_path.c_str());
+}
+
+void MirrorWriter::_set_error(File& file, const char *op)
+{
+  char str_errno[1024];
+  const char *error_msg = strerror_r(errno,str_errno,sizeof(str_errno));
+  file.m_error = std::string(op) + ": " + error_msg;
+  if(file.m_fd >= 0)
+    {
+      ::close(file.m_fd);
+      file.m_fd = -1;
+    }
+}
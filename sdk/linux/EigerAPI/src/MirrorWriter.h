@@ -0,0 +1,90 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERAPI_MIRRORWRITER_H
+#define EIGERAPI_MIRRORWRITER_H
+
+#include <pthread.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace eigerapi
+{
+  // Writes copies of the downloaded files to a secondary sink (i.e. an
+  // archive) in its own thread, so a slow sink never blocks the curl
+  // loops. Over max_queued bytes waiting, the blocks are dropped and
+  // read back from the primary file once it is closed
+  class MirrorWriter
+  {
+  public:
+    static const size_t DEFAULT_MAX_QUEUED = 256 * 1024 * 1024;
+
+    class File;
+    typedef std::shared_ptr<File> FilePtr;
+
+    MirrorWriter(size_t max_queued = DEFAULT_MAX_QUEUED);
+    // the pending copies are finished first
+    ~MirrorWriter();
+
+    FilePtr open(const std::string& path, const std::string& primary_path);
+    void write(FilePtr file, const char *data, size_t len, long long offset);
+    // the primary file is closed: the copy is truncated at size,
+    // or removed if not complete
+    void close(FilePtr file, long long size, bool complete);
+
+    int get_nb_pending() const;
+    int get_nb_errors() const;
+  private:
+    struct Job
+    {
+      FilePtr		file;
+      std::vector<char>	data;
+      long long		offset;
+      bool		close;
+      long long		size;
+      bool		complete;
+    };
+
+    static void* _runFunc(void*);
+    void _run();
+    void _write(File& file, const char *data, size_t len, long long offset);
+    void _close(File& file, long long size, bool complete);
+    void _set_error(File& file, const char *op);
+
+    mutable pthread_mutex_t	m_lock;
+    pthread_cond_t		m_cond;
+    std::list<Job>		m_jobs;
+    size_t			m_queued;
+    size_t			m_max_queued;
+    int				m_nb_open;
+    int				m_nb_errors;
+    bool			m_quit;
+    pthread_t			m_thread_id;
+  };
+  typedef std::shared_ptr<MirrorWriter> MirrorWriterPtr;
+}
+
+#endif // EIGERAPI_MIRRORWRITER_H
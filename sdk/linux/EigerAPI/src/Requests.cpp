@@ -32,6 +32,9 @@
 #include "eigerapi/Requests.h"
 #include "eigerapi/EigerDefines.h"
 #include "AutoMutex.h"
+#include "BlockWriter.h"
+#include "MirrorWriter.h"
+#include "SpliceDownload.h"
 
 using namespace eigerapi;
 
@@ -44,8 +47,10 @@ static const char* CSTR_EIGERCONFIG		= "config";
 static const char* CSTR_EIGERSTATUS		= "status";
 static const char* CSTR_EIGERCOMMAND		= "command";
 static const char* CSTR_EIGERFILES		= "files";
+static const char* CSTR_EIGERIMAGES		= "images";
 static const char* CSTR_SUBSYSTEMFILEWRITER	= "filewriter";
 static const char* CSTR_SUBSYSTEMSTREAM		= "stream";
+static const char* CSTR_SUBSYSTEMMONITOR	= "monitor";
 static const char* CSTR_SUBSYSTEMDETECTOR	= "detector";
 static const char* CSTR_DATA			= "data";
 static const char* CSTR_EIGERVERSION		= "version";
@@ -155,6 +160,8 @@ ParamIndex ParamDescription[] = {
   // Stream settings
   {Requests::STREAM_MODE,			{"mode", CSTR_SUBSYSTEMSTREAM}},
   {Requests::STREAM_HEADER_DETAIL,		{"header_detail", CSTR_SUBSYSTEMSTREAM}},
+  // Monitor settings
+  {Requests::MONITOR_MODE,			{"mode", CSTR_SUBSYSTEMMONITOR}},
   // Saving Header
   {Requests::HEADER_BEAM_CENTER_X,		{"beam_center_x"}},
   {Requests::HEADER_BEAM_CENTER_Y,		{"beam_center_y"}},
@@ -195,9 +202,27 @@ std::string ResourceDescription::build_url(const std::ostringstream& base_url,
 }
 
 // Requests class
-Requests::Requests(const std::string& address) :
-  m_address(address)
+Requests::Requests(const std::string& address, int nb_transfer_loops) :
+  m_address(address),
+  m_next_transfer_loop(0),
+  m_transfer_direct_io(false),
+  m_transfer_nb_ranges(4),
+  m_transfer_min_range_size(64 * 1024 * 1024),
+  m_transfer_max_retries(5),
+  m_transfer_retry_delay(0.5),
+  m_transfer_zero_copy(false),
+  m_nb_splice_running(0)
 {
+  if(pthread_mutex_init(&m_transfer_lock,NULL))
+    THROW_EIGER_EXCEPTION("pthread_mutex_init","Can't initialize the lock");
+  if(pthread_cond_init(&m_splice_cond,NULL))
+    THROW_EIGER_EXCEPTION("pthread_cond_init",
+			  "Can't initialize the variable condition");
+  if(nb_transfer_loops < 1)
+    nb_transfer_loops = 1;
+  for(int i = 0;i < nb_transfer_loops;++i)
+    m_transfer_loops.emplace_back(new CurlLoop());
+
   std::ostringstream base_url;
   base_url << "http://" << address << '/';
 
@@ -229,10 +254,41 @@ Requests::Requests(const std::string& address) :
       ParamIndex& index = ParamDescription[i];
       m_param_cache_url[index.name] = index.desc.build_url(base_url,api);
     }
+  ResourceDescription monitor_image("monitor",CSTR_SUBSYSTEMMONITOR,
+				    CSTR_EIGERIMAGES);
+  m_monitor_image_url = monitor_image.build_url(base_url,api);
 }
 
 Requests::~Requests()
 {
+  // zero-copy transfers are not run by the loops, stop them first
+  std::list<std::weak_ptr<Transfer> > splice_transfers;
+  {
+    Lock lock(&m_transfer_lock);
+    splice_transfers.swap(m_splice_transfers);
+  }
+  std::list<std::weak_ptr<Transfer> >::iterator t, t_end;
+  t_end = splice_transfers.end();
+  for(t = splice_transfers.begin();t != t_end;++t)
+    {
+      TransferReq transfer = t->lock();
+      if(transfer)
+	transfer->_cancel();
+    }
+  {
+    Lock lock(&m_transfer_lock);
+    while(m_nb_splice_running)
+      pthread_cond_wait(&m_splice_cond,&m_transfer_lock);
+  }
+
+  // finished transfers can still post deletions on the other loops
+  std::vector<std::unique_ptr<CurlLoop> >::iterator i, end;
+  end = m_transfer_loops.end();
+  for(i = m_transfer_loops.begin();i != end;++i)
+    (*i)->quit();
+  m_loop.quit();
+  pthread_cond_destroy(&m_splice_cond);
+  pthread_mutex_destroy(&m_transfer_lock);
 }
 
 std::string Requests::get_api_version()
@@ -359,20 +415,157 @@ ParamReq Requests::set_param(PARAM_NAME name,const char* value)
 
 TransferReq  Requests::start_transfer(const std::string& src_filename,
 				      const std::string& dest_path,
-				      bool delete_after_transfer)
+				      bool delete_after_transfer,
+				      int nb_ranges)
+{
+  return _start_transfer(src_filename,dest_path,std::vector<std::string>(),
+			 delete_after_transfer,nb_ranges);
+}
+
+TransferReq Requests::_start_transfer(const std::string& src_filename,
+				      const std::string& dest_path,
+				      const std::vector<std::string>& mirror_paths,
+				      bool delete_after_transfer,
+				      int nb_ranges)
 {
   std::ostringstream url;
   url << "http://" << m_address << '/' << CSTR_DATA << '/'
       << src_filename;
   
-  TransferReq transfer(new Transfer(*this,
-						  url.str(),
-						  dest_path,
-						  delete_after_transfer));
-  m_loop.add_request(transfer);
+  if(nb_ranges < 0)
+    nb_ranges = m_transfer_nb_ranges;
+  TransferReq transfer;
+  if(m_transfer_zero_copy && mirror_paths.empty())
+    {
+      std::ostringstream path;
+      path << '/' << CSTR_DATA << '/' << src_filename;
+      transfer.reset(new Transfer(*this,
+				  m_address,
+				  path.str(),
+				  dest_path,
+				  delete_after_transfer));
+      transfer->_start_splice(transfer);
+    }
+  else if(nb_ranges > 1 || m_transfer_max_retries > 0)
+    {
+      transfer.reset(new Transfer(*this,
+				  url.str(),
+				  dest_path,
+				  delete_after_transfer,
+				  std::max(nb_ranges,1),
+				  m_transfer_min_range_size,
+				  m_transfer_direct_io,
+				  m_transfer_max_retries,
+				  m_transfer_retry_delay));
+      _add_mirrors(transfer,mirror_paths);
+      transfer->_start_probe(transfer);
+    }
+  else
+    {
+      transfer.reset(new Transfer(*this,
+				  url.str(),
+				  dest_path,
+				  delete_after_transfer,
+				  BlockWriter::DEFAULT_BLOCK_SIZE,
+				  m_transfer_direct_io));
+      _add_mirrors(transfer,mirror_paths);
+      _get_transfer_loop().add_request(transfer);
+    }
   return transfer;
 }
 
+TransferReq Requests::start_transfer(const std::string& src_filename,
+				     const std::vector<std::string>& target_paths,
+				     bool delete_after_transfer,
+				     int nb_ranges)
+{
+  if(target_paths.empty())
+    THROW_EIGER_EXCEPTION("start_transfer","no target path");
+
+  std::vector<std::string> mirror_paths(target_paths.begin() + 1,
+					target_paths.end());
+  return _start_transfer(src_filename,target_paths[0],mirror_paths,
+			 delete_after_transfer,nb_ranges);
+}
+
+void Requests::_add_mirrors(TransferReq transfer,
+			    const std::vector<std::string>& mirror_paths)
+{
+  for(unsigned int i = 0;i < mirror_paths.size();++i)
+    transfer->_add_mirror(_get_mirror_writer(i),mirror_paths[i]);
+}
+
+std::shared_ptr<MirrorWriter> Requests::_get_mirror_writer(unsigned int index)
+{
+  Lock lock(&m_transfer_lock);
+  while(m_mirror_writers.size() <= index)
+    m_mirror_writers.push_back(std::make_shared<MirrorWriter>());
+  return m_mirror_writers[index];
+}
+
+int Requests::get_nb_pending_mirrors() const
+{
+  Lock lock(&m_transfer_lock);
+  int nb_pending = 0;
+  std::vector<std::shared_ptr<MirrorWriter> >::const_iterator i;
+  for(i = m_mirror_writers.begin();i != m_mirror_writers.end();++i)
+    nb_pending += (*i)->get_nb_pending();
+  return nb_pending;
+}
+
+int Requests::get_nb_mirror_errors() const
+{
+  Lock lock(&m_transfer_lock);
+  int nb_errors = 0;
+  std::vector<std::shared_ptr<MirrorWriter> >::const_iterator i;
+  for(i = m_mirror_writers.begin();i != m_mirror_writers.end();++i)
+    nb_errors += (*i)->get_nb_errors();
+  return nb_errors;
+}
+
+void Requests::_splice_started(TransferReq transfer)
+{
+  Lock lock(&m_transfer_lock);
+  m_splice_transfers.remove_if([](const std::weak_ptr<Transfer>& t)
+			       { return t.expired(); });
+  m_splice_transfers.push_back(transfer);
+  ++m_nb_splice_running;
+}
+
+void Requests::_splice_finished()
+{
+  Lock lock(&m_transfer_lock);
+  if(!--m_nb_splice_running)
+    pthread_cond_broadcast(&m_splice_cond);
+}
+
+void Requests::set_transfer_zero_copy(bool zero_copy)
+{
+  m_transfer_zero_copy = zero_copy;
+}
+
+void Requests::set_transfer_direct_io(bool direct_io)
+{
+  m_transfer_direct_io = direct_io;
+}
+
+void Requests::set_transfer_retries(int max_retries, double first_delay)
+{
+  m_transfer_max_retries = max_retries;
+  m_transfer_retry_delay = first_delay;
+}
+
+double Requests::get_transfer_write_latency() const
+{
+  return TargetFile::get_write_latency();
+}
+
+void Requests::set_transfer_ranges(int nb_ranges, long long min_range_size)
+{
+  m_transfer_nb_ranges = nb_ranges;
+  m_transfer_min_range_size = min_range_size;
+}
+
 CurlReq Requests::delete_file(const std::string& filename,bool full_url)
 {
   std::ostringstream url;
@@ -385,13 +578,47 @@ CurlReq Requests::delete_file(const std::string& filename,bool full_url)
  CurlReq delete_req(new CurlLoop::FutureRequest(url.str()));
  CURL* handle = delete_req->get_handle();
  curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "DELETE"); 
- m_loop.add_request(delete_req);
+ _get_transfer_loop().add_request(delete_req);
  return delete_req;
 }
 
+Requests::MonitorImageReq Requests::get_monitor_image()
+{
+  MonitorImageReq image(new MonitorImage(m_monitor_image_url));
+  // up to 64 MB, not on the command loop
+  _get_transfer_loop().add_request(image);
+  return image;
+}
+
 void Requests::cancel(CurlReq req)
 {
-  m_loop.cancel_request(req);
+  CurlLoop *loop = req->get_loop();
+  if(loop)
+    {
+      loop->cancel_request(req);
+      return;
+    }
+  // split transfers are not run by a loop, their sub-requests are
+  TransferReq transfer = std::dynamic_pointer_cast<Transfer>(req);
+  if(transfer)
+    transfer->_cancel();
+}
+
+void Requests::get_loop_threads(std::vector<pthread_t>& thread_ids) const
+{
+  thread_ids.clear();
+  thread_ids.push_back(m_loop.get_thread_id());
+  std::vector<std::unique_ptr<CurlLoop> >::const_iterator i;
+  for(i = m_transfer_loops.begin();i != m_transfer_loops.end();++i)
+    thread_ids.push_back((*i)->get_thread_id());
+}
+
+CurlLoop& Requests::_get_transfer_loop()
+{
+  Lock alock(&m_transfer_lock);
+  CurlLoop& loop = *m_transfer_loops[m_next_transfer_loop];
+  m_next_transfer_loop = (m_next_transfer_loop + 1) % m_transfer_loops.size();
+  return loop;
 }
 //Class Command
 Requests::Command::Command(const std::string& url) :
@@ -767,6 +994,215 @@ size_t Requests::Param::_write_callback(char *ptr,size_t size,
   return size_to_copy;
 }
 
+/*----------------------------------------------------------------------------
+			   Class MonitorImage
+----------------------------------------------------------------------------*/
+Requests::MonitorImage::MonitorImage(const std::string& url) :
+  CurlLoop::FutureRequest(url),
+  m_headers(NULL)
+{
+  m_headers = curl_slist_append(m_headers,"Accept: application/tiff");
+  curl_easy_setopt(m_handle, CURLOPT_HTTPHEADER, m_headers);
+  curl_easy_setopt(m_handle, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(m_handle, CURLOPT_WRITEFUNCTION, _write_callback);
+  curl_easy_setopt(m_handle, CURLOPT_WRITEDATA, this);
+}
+
+Requests::MonitorImage::~MonitorImage()
+{
+  if(m_headers)
+    curl_slist_free_all(m_headers);
+}
+
+size_t Requests::MonitorImage::_write_callback(char *ptr, size_t size,
+					       size_t nmemb,
+					       MonitorImage *image)
+{
+  size_t len = size * nmemb;
+  std::vector<char>& data = image->m_data;
+  if(data.empty())
+    {
+      curl_off_t content_length = -1;
+      curl_easy_getinfo(image->m_handle,
+			CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,&content_length);
+      if(content_length > 0)
+	data.reserve(content_length);
+    }
+  data.insert(data.end(),ptr,ptr + len);
+  return len;
+}
+
+/*----------------------------------------------------------------------------
+			   Class Transfer::SizeProbe
+----------------------------------------------------------------------------*/
+// HEAD request on the file, the ranges are started once its size is known
+class Requests::Transfer::SizeProbe : public CurlLoop::FutureRequest
+{
+public:
+  SizeProbe(Transfer::Ptr transfer) :
+    CurlLoop::FutureRequest(transfer->get_url()),
+    m_transfer(transfer)
+  {
+    curl_easy_setopt(m_handle, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(m_handle, CURLOPT_FAILONERROR, 1L);
+  }
+
+private:
+  virtual void _request_finished()
+  {
+    Transfer::Ptr transfer;
+    transfer.swap(m_transfer);
+    if(m_status == CANCEL)
+      return;
+
+    // unknown size: the file is fetched in one request
+    long long file_size = -1;
+    curl_off_t content_length;
+    if(m_status == OK &&
+       curl_easy_getinfo(m_handle,CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+			 &content_length) == CURLE_OK)
+      file_size = content_length;
+    transfer->_start_ranges(transfer,file_size);
+  }
+
+  Transfer::Ptr m_transfer;
+};
+
+/*----------------------------------------------------------------------------
+			   Class Transfer::Range
+----------------------------------------------------------------------------*/
+// Part of a split transfer, written in place in the shared target file
+class Requests::Transfer::Range : public CurlLoop::FutureRequest
+{
+public:
+  // size < 0: up to the end of the file. Without range_header the whole
+  // file is requested
+  Range(Transfer::Ptr transfer, int index, long long offset, long long size,
+	bool range_header) :
+    CurlLoop::FutureRequest(transfer->get_url()),
+    m_transfer(transfer),
+    m_index(index),
+    m_size(size),
+    m_range_header(range_header),
+    m_writer(transfer->m_file,offset),
+    m_gen(transfer->m_range_gen),
+    m_checked(false),
+    m_received(0),
+    m_retry(false),
+    m_no_range(false)
+  {
+    if(m_range_header)
+      {
+	std::ostringstream range;
+	range << offset << '-';
+	if(m_size >= 0)
+	  range << (offset + m_size - 1);
+	curl_easy_setopt(m_handle, CURLOPT_RANGE, range.str().c_str());
+      }
+    curl_easy_setopt(m_handle, CURLOPT_FAILONERROR, 1L);
+    // a stalled connection is a transient error
+    curl_easy_setopt(m_handle, CURLOPT_LOW_SPEED_LIMIT, 1024L);
+    curl_easy_setopt(m_handle, CURLOPT_LOW_SPEED_TIME, 30L);
+    curl_easy_setopt(m_handle, CURLOPT_WRITEFUNCTION, _write);
+    curl_easy_setopt(m_handle, CURLOPT_WRITEDATA, this);
+  }
+
+private:
+  static size_t _write(void *ptr, size_t size, size_t nmemb, Range *range)
+  {
+    if(!range->m_checked)
+      {
+	// a server ignoring the Range header sends the whole file (200):
+	// the transfer is restarted as a single whole-file request
+	long http_code = 0;
+	curl_easy_getinfo(range->m_handle,CURLINFO_RESPONSE_CODE,&http_code);
+	if(range->m_range_header && http_code != 206)
+	  {
+	    range->m_no_range = (http_code == 200);
+	    range->m_error = "HTTP Range not supported by the server";
+	    return 0;
+	  }
+	range->m_checked = true;
+      }
+
+    size_t len = size * nmemb;
+    if(!range->m_writer.write(ptr,len))
+      return 0;
+    range->m_received += len;
+    range->m_transfer->m_download_size += len;
+    return len;
+  }
+
+  static bool _is_transient(CURLcode result, long http_code)
+  {
+    switch(result)
+      {
+      case CURLE_COULDNT_CONNECT:
+      case CURLE_PARTIAL_FILE:
+      case CURLE_OPERATION_TIMEDOUT:
+      case CURLE_GOT_NOTHING:
+      case CURLE_SEND_ERROR:
+      case CURLE_RECV_ERROR:
+	return true;
+      case CURLE_HTTP_RETURNED_ERROR:
+	return http_code >= 500;
+      default:
+	return false;
+      }
+  }
+
+  virtual bool _complete(CURLcode result, std::string& error)
+  {
+    bool ok = (result == CURLE_OK);
+    bool flushed = ok ? m_writer.flush() : m_writer.flush_partial();
+    // bytes dropped by flush_partial are fetched again
+    m_transfer->m_download_size -= m_received - m_writer.get_size();
+
+    if(!m_error.empty())
+      error = m_error;
+    else if(!flushed)
+      error = m_writer.get_error();
+    else if(ok && m_size >= 0 && m_writer.get_size() != m_size)
+      {
+	error = "Incomplete range";
+	m_retry = true;
+      }
+    else if(!ok)
+      {
+	long http_code = 0;
+	curl_easy_getinfo(m_handle,CURLINFO_RESPONSE_CODE,&http_code);
+	m_retry = _is_transient(result,http_code);
+      }
+    return error.empty();
+  }
+
+  virtual void _request_finished()
+  {
+    Transfer::Ptr transfer;
+    transfer.swap(m_transfer);
+    if(m_status == CANCEL)
+      return;
+    if(m_no_range)
+      transfer->_restart_whole_file(transfer,m_gen);
+    else
+      transfer->_range_finished(transfer,m_gen,m_index,m_status == OK,
+				m_retry,m_error_code,
+				m_writer.get_checksum(),m_writer.get_size());
+  }
+
+  Transfer::Ptr	m_transfer;
+  int		m_index;
+  long long	m_size;
+  bool		m_range_header;
+  BlockWriter	m_writer;
+  int		m_gen;
+  bool		m_checked;
+  long long	m_received;
+  bool		m_retry;
+  bool		m_no_range;
+  std::string	m_error;
+};
+
 /*----------------------------------------------------------------------------
 			   Class Transfer
 ----------------------------------------------------------------------------*/
@@ -774,53 +1210,396 @@ Requests::Transfer::Transfer(Requests& requests,
 			     const std::string& url,
 			     const std::string& target_path,
 			     bool delete_after_transfer,
-			     int buffer_write_size) :
+			     int buffer_write_size,
+			     bool direct_io) :
   CurlLoop::FutureRequest(url),
   m_requests(requests),
   m_delete_after_transfer(delete_after_transfer),
-  m_download_size(0)
-{
-  void *ptr;
-  if(posix_memalign(&ptr,4*1024,buffer_write_size))
-    THROW_EIGER_EXCEPTION("Can't allocate write buffer memory","");
-  m_buffer.reset(ptr);
-  m_target_file = fopen(target_path.c_str(),"w+");
-  if(!m_target_file)
-    {
-      char str_errno[1024];
-      strerror_r(errno,str_errno,sizeof(str_errno));
-      std::ostringstream error_buffer;
-      error_buffer << "Can't open destination file " << target_path;
-      THROW_EIGER_EXCEPTION(error_buffer.str().c_str(), str_errno);
-    }
-  setbuffer(m_target_file,(char*)m_buffer.get(),buffer_write_size);
+  m_download_size(0),
+  m_preallocated(false),
+  m_checksum(0),
+  m_max_ranges(1),
+  m_min_range_size(0),
+  m_max_retries(0),
+  m_retry_delay(0.),
+  m_file_size(-1),
+  m_range_gen(0),
+  m_nb_ranges_done(0)
+{
+  m_writer.reset(new BlockWriter(target_path,buffer_write_size,direct_io));
+  // do not write HTTP error pages into the destination file
+  curl_easy_setopt(m_handle, CURLOPT_FAILONERROR, 1L);
   curl_easy_setopt(m_handle, CURLOPT_WRITEFUNCTION, _write);
   curl_easy_setopt(m_handle, CURLOPT_WRITEDATA, this);
 }
+
+Requests::Transfer::Transfer(Requests& requests,
+			     const std::string& url,
+			     const std::string& target_path,
+			     bool delete_after_transfer,
+			     int nb_ranges,
+			     long long min_range_size,
+			     bool direct_io,
+			     int max_retries,
+			     double retry_delay) :
+  CurlLoop::FutureRequest(url),
+  m_requests(requests),
+  m_delete_after_transfer(delete_after_transfer),
+  m_download_size(0),
+  m_preallocated(true),
+  m_checksum(0),
+  m_max_ranges(nb_ranges),
+  m_min_range_size(min_range_size),
+  m_max_retries(max_retries),
+  m_retry_delay(retry_delay),
+  m_file_size(-1),
+  m_file(new TargetFile(target_path,direct_io)),
+  m_range_gen(0),
+  m_nb_ranges_done(0)
+{
+}
+
+Requests::Transfer::Transfer(Requests& requests,
+			     const std::string& address,
+			     const std::string& path,
+			     const std::string& target_path,
+			     bool delete_after_transfer) :
+  CurlLoop::FutureRequest("http://" + address + path),
+  m_requests(requests),
+  m_delete_after_transfer(delete_after_transfer),
+  m_download_size(0),
+  m_preallocated(true),
+  m_checksum(0),
+  m_max_ranges(1),
+  m_min_range_size(0),
+  m_max_retries(0),
+  m_retry_delay(0.),
+  m_file_size(-1),
+  m_file(new TargetFile(target_path)),
+  m_range_gen(0),
+  m_nb_ranges_done(0),
+  m_splice(new SpliceDownload(address,path))
+{
+}
+
 Requests::Transfer::~Transfer()
 {
-  if(m_target_file)
-    fclose(m_target_file);
+}
+
+int Requests::Transfer::get_nb_ranges() const
+{
+  Lock lock(&m_lock);
+  return m_ranges.size();
+}
+
+int Requests::Transfer::get_nb_retries() const
+{
+  Lock lock(&m_lock);
+  int nb_retries = 0;
+  std::vector<RangeResult>::const_iterator i, end = m_ranges.end();
+  for(i = m_ranges.begin();i != end;++i)
+    nb_retries += i->nb_retries;
+  return nb_retries;
+}
+
+void Requests::Transfer::_start_probe(Ptr self)
+{
+  // a single range does not need the file size: no HEAD round trip
+  if(m_max_ranges <= 1)
+    {
+      {
+	Lock lock(&m_lock);
+	m_status = RUNNING;
+      }
+      _start_ranges(self,-1);
+      return;
+    }
+
+  CurlReq probe(new SizeProbe(self));
+  {
+    Lock lock(&m_lock);
+    m_status = RUNNING;
+    m_sub_requests.push_back(probe);
+  }
+  m_requests._get_transfer_loop().add_request(probe);
+}
+
+void Requests::Transfer::_start_ranges(Ptr self, long long file_size)
+{
+  int nb_ranges = 1;
+  long long range_size = -1;
+  if(m_min_range_size > 0 && file_size >= 2 * m_min_range_size)
+    {
+      nb_ranges = std::min<long long>(m_max_ranges,
+				      file_size / m_min_range_size);
+      // range boundaries on write blocks, needed by O_DIRECT
+      const long long block_size = BlockWriter::DEFAULT_BLOCK_SIZE;
+      range_size = (file_size + nb_ranges - 1) / nb_ranges;
+      range_size = (range_size + block_size - 1) / block_size * block_size;
+      nb_ranges = (file_size + range_size - 1) / range_size;
+    }
+  m_file->preallocate(file_size);
+
+  std::vector<CurlReq> ranges;
+  {
+    Lock lock(&m_lock);
+    if(m_status != RUNNING)	// cancelled
+      return;
+    m_file_size = file_size;
+    m_ranges.resize(nb_ranges);
+    for(int i = 0;i < nb_ranges;++i)
+      {
+	long long offset = (range_size > 0) ? i * range_size : 0;
+	long long size = (range_size > 0) ?
+			 std::min(range_size,file_size - offset) : file_size;
+	RangeResult& result = m_ranges[i];
+	result.offset = offset;
+	result.length = size;
+	result.done = false;
+	result.checksum = Adler32().get();
+	result.size = 0;
+	result.nb_retries = 0;
+	CurlReq range(new Range(self,i,offset,size,nb_ranges > 1));
+	m_sub_requests.push_back(range);
+	ranges.push_back(range);
+      }
+  }
+  std::vector<CurlReq>::iterator i, end = ranges.end();
+  for(i = ranges.begin();i != end;++i)
+    m_requests._get_transfer_loop().add_request(*i);
+}
+
+void Requests::Transfer::_range_finished(Ptr self, int gen, int index,
+					 bool ok, bool retry,
+					 const std::string& error,
+					 unsigned int checksum, long long size)
+{
+  static const double MAX_RETRY_DELAY = 30.;
+
+  bool all_done = false;
+  CurlReq retry_req;
+  double delay = 0.;
+  {
+    Lock lock(&m_lock);
+    if(gen != m_range_gen)	// range of a restarted transfer
+      return;
+    RangeResult& result = m_ranges[index];
+    result.checksum = Adler32::combine(result.checksum,checksum,size);
+    result.size += size;
+    if(!ok && result.length >= 0 && result.size == result.length)
+      ok = true;		// failed after the last byte
+
+    if(!ok && retry && result.nb_retries < m_max_retries &&
+       m_status == RUNNING)
+      {
+	// resume from the last written byte
+	delay = std::min(m_retry_delay * (1 << result.nb_retries),
+			 MAX_RETRY_DELAY);
+	++result.nb_retries;
+	long long offset = result.offset + result.size;
+	long long length = (result.length >= 0) ?
+			   result.length - result.size : -1;
+	bool range_header = m_ranges.size() > 1 || offset > 0;
+	retry_req.reset(new Range(self,index,offset,length,range_header));
+	m_sub_requests.push_back(retry_req);
+      }
+    else
+      {
+	result.done = true;
+	if(!ok && m_range_error.empty())
+	  m_range_error = error;
+	all_done = (++m_nb_ranges_done == int(m_ranges.size()));
+      }
+  }
+
+  if(retry_req)
+    m_requests._get_transfer_loop().add_request(retry_req,delay);
+  // the file status is set (and the DCU file deleted) once all are done
+  else if(all_done)
+    handle_result(CURLE_OK);
+}
+
+void Requests::Transfer::_restart_whole_file(Ptr self, int gen)
+{
+  std::list<std::weak_ptr<CurlLoop::FutureRequest> > sub_requests;
+  CurlReq whole_file;
+  {
+    Lock lock(&m_lock);
+    if(gen != m_range_gen || m_status != RUNNING)
+      return;
+    // the bytes already written are overwritten with the same data
+    ++m_range_gen;
+    sub_requests.swap(m_sub_requests);
+    // the retries already made still count against m_max_retries
+    int nb_retries = 0;
+    std::vector<RangeResult>::const_iterator r, rend = m_ranges.end();
+    for(r = m_ranges.begin();r != rend;++r)
+      nb_retries += r->nb_retries;
+    m_ranges.resize(1);
+    RangeResult& result = m_ranges[0];
+    result.offset = 0;
+    result.length = m_file_size;
+    result.done = false;
+    result.checksum = Adler32().get();
+    result.size = 0;
+    result.nb_retries = nb_retries;
+    m_nb_ranges_done = 0;
+    whole_file.reset(new Range(self,0,0,m_file_size,false));
+    m_sub_requests.push_back(whole_file);
+  }
+
+  std::list<std::weak_ptr<CurlLoop::FutureRequest> >::iterator i, end;
+  end = sub_requests.end();
+  for(i = sub_requests.begin();i != end;++i)
+    {
+      CurlReq req = i->lock();
+      if(req && req->get_loop())
+	req->get_loop()->cancel_request(req);
+    }
+  m_requests._get_transfer_loop().add_request(whole_file);
+}
+
+void Requests::Transfer::_start_splice(Ptr self)
+{
+  {
+    Lock lock(&m_lock);
+    m_status = RUNNING;
+  }
+  m_requests._splice_started(self);
+
+  pthread_t thread_id;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+  Ptr *arg = new Ptr(self);
+  int rc = pthread_create(&thread_id,&attr,_splice_runFunc,arg);
+  pthread_attr_destroy(&attr);
+  if(rc)
+    {
+      delete arg;
+      {
+	Lock lock(&m_lock);
+	m_range_error = "Can't start the transfer thread";
+      }
+      handle_result(CURLE_OK);
+      m_requests._splice_finished();
+    }
+}
+
+void* Requests::Transfer::_splice_runFunc(void *arg)
+{
+  Ptr self;
+  self.swap(*(Ptr*)arg);
+  delete (Ptr*)arg;
+  self->_splice_run();
+  return NULL;
+}
+
+void Requests::Transfer::_splice_run()
+{
+  std::string error;
+  if(!m_splice->run(*m_file,m_download_size,error))
+    {
+      Lock lock(&m_lock);
+      m_range_error = error;
+    }
+  handle_result(CURLE_OK);
+  m_requests._splice_finished();
+}
+
+void Requests::Transfer::_add_mirror(std::shared_ptr<MirrorWriter> writer,
+				     const std::string& path)
+{
+  TargetFilePtr file = m_writer ? m_writer->get_file() : m_file;
+  file->add_mirror(writer,path);
+}
+
+void Requests::Transfer::_cancel()
+{
+  std::list<std::weak_ptr<CurlLoop::FutureRequest> > sub_requests;
+  {
+    Lock lock(&m_lock);
+    if(m_status != RUNNING)
+      return;
+    m_status = CANCEL;
+    sub_requests.swap(m_sub_requests);
+  }
+  if(m_splice)
+    m_splice->cancel();
+  std::list<std::weak_ptr<CurlLoop::FutureRequest> >::iterator i, end;
+  end = sub_requests.end();
+  for(i = sub_requests.begin();i != end;++i)
+    {
+      CurlReq req = i->lock();
+      if(req && req->get_loop())
+	req->get_loop()->cancel_request(req);
+    }
 }
 
 size_t
 Requests::Transfer::_write(void *ptr, size_t size,
 			    size_t nmemb, Requests::Transfer *transfer)
 {
+  BlockWriter& writer = *transfer->m_writer;
+  if(!transfer->m_preallocated)
+    {
+      curl_off_t content_length = -1;
+      curl_easy_getinfo(transfer->m_handle,
+			CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,&content_length);
+      writer.preallocate(content_length);
+      transfer->m_preallocated = true;
+    }
+
+  size_t len = size * nmemb;
+  if(!writer.write(ptr,len))
+    return 0;		// curl aborts with CURLE_WRITE_ERROR
+  transfer->m_download_size += len;
+  return len;
+}
 
-  FILE *stream = transfer->m_target_file;
-  size_t write_size = fwrite(ptr, size, nmemb, stream);
+bool Requests::Transfer::_complete(CURLcode result, std::string& error)
+{
+  if(m_writer)
+    {
+      bool ok = m_writer->finish(result == CURLE_OK);
+      if(!ok)
+	error = m_writer->get_error();
+      m_checksum = m_writer->get_checksum();
+      return ok;
+    }
 
-  Lock lock(&transfer->m_lock);
-  if(write_size > 0)
-    transfer->m_download_size += size * nmemb;
+  if(m_splice)
+    {
+      error = m_range_error;
+      std::string close_error;
+      long long size = m_download_size;
+      if(!m_file->close(size,close_error,error.empty()) && error.empty())
+	error = close_error;
+      return error.empty();
+    }
 
-  return write_size;
+  // split transfer: all the ranges are finished
+  unsigned int checksum = Adler32().get();
+  long long size = 0;
+  std::vector<RangeResult>::const_iterator i, end = m_ranges.end();
+  for(i = m_ranges.begin();i != end;++i)
+    {
+      checksum = Adler32::combine(checksum,i->checksum,i->size);
+      size += i->size;
+    }
+  m_checksum = checksum;
+
+  error = m_range_error;
+  if(error.empty() && m_file_size >= 0 && size != m_file_size)
+    error = "Incomplete file";
+  std::string close_error;
+  if(!m_file->close(size,close_error,error.empty()) && error.empty())
+    error = close_error;
+  return error.empty();
 }
 
 void Requests::Transfer::_request_finished()
 {
-  fclose(m_target_file);m_target_file = NULL;
   // start new request to delete the file
   if(m_status == FutureRequest::OK &&
      m_delete_after_transfer)
@@ -0,0 +1,302 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "SpliceDownload.h"
+#include "BlockWriter.h"
+#include "AutoMutex.h"
+#include "eigerapi/EigerDefines.h"
+
+using namespace eigerapi;
+
+static const size_t MAX_HEADER_SIZE = 64 * 1024;
+static const size_t PIPE_SIZE = 1024 * 1024;
+
+SpliceDownload::SpliceDownload(const std::string& address,
+			       const std::string& path) :
+  m_address(address),
+  m_path(path),
+  m_socket(-1),
+  m_cancel(false)
+{
+  if(pthread_mutex_init(&m_lock,NULL))
+    THROW_EIGER_EXCEPTION("pthread_mutex_init","Can't initialize the lock");
+}
+
+SpliceDownload::~SpliceDownload()
+{
+  if(m_socket >= 0)
+    ::close(m_socket);
+  pthread_mutex_destroy(&m_lock);
+}
+
+void SpliceDownload::cancel()
+{
+  Lock lock(&m_lock);
+  m_cancel = true;
+  // wake up a blocked recv or splice
+  if(m_socket >= 0)
+    shutdown(m_socket,SHUT_RDWR);
+}
+
+bool SpliceDownload::run(TargetFile& file,
+			 std::atomic<long long>& downloaded,
+			 std::string& error)
+{
+  std::string body_start;
+  long long content_length = -1;
+  if(!_connect(error) || !_send_request(error) ||
+     !_read_header(body_start,content_length,error))
+    return false;
+
+  file.preallocate(content_length);
+  long long offset = body_start.size();
+  if(offset > 0 && !file.write(body_start.data(),offset,0,error))
+    return false;
+  downloaded += offset;
+
+  int pipe_fds[2];
+  if(pipe2(pipe_fds,O_CLOEXEC))
+    return _set_error("pipe2",error);
+  // larger moves per splice, only a hint
+  fcntl(pipe_fds[1],F_SETPIPE_SZ,PIPE_SIZE);
+
+  bool ok = true;
+  while(content_length < 0 || offset < content_length)
+    {
+      size_t len = PIPE_SIZE;
+      if(content_length >= 0)
+	len = std::min<long long>(len,content_length - offset);
+      ssize_t nb_read = splice(m_socket,NULL,pipe_fds[1],NULL,len,
+			       SPLICE_F_MOVE | SPLICE_F_MORE);
+      if(nb_read < 0 && errno == EINTR)
+	continue;
+      else if(nb_read < 0)
+	{
+	  if(errno == EAGAIN)
+	    error = "Receive timeout";
+	  else
+	    _set_error("splice",error);
+	  ok = false;
+	  break;
+	}
+      else if(!nb_read)		// connection closed
+	break;
+      if(!file.splice(pipe_fds[0],nb_read,offset,error))
+	{
+	  ok = false;
+	  break;
+	}
+      offset += nb_read;
+      downloaded += nb_read;
+    }
+  ::close(pipe_fds[0]);
+  ::close(pipe_fds[1]);
+
+  Lock lock(&m_lock);
+  if(m_cancel)
+    {
+      error = "Cancelled";
+      ok = false;
+    }
+  else if(ok && content_length >= 0 && offset != content_length)
+    {
+      error = "Incomplete file";
+      ok = false;
+    }
+  return ok;
+}
+
+bool SpliceDownload::_connect(std::string& error)
+{
+  std::string host = m_address, port = "80";
+  size_t pos = m_address.rfind(':');
+  if(pos != std::string::npos && m_address.find(']',pos) == std::string::npos)
+    {
+      host = m_address.substr(0,pos);
+      port = m_address.substr(pos + 1);
+    }
+  if(host.size() > 2 && host[0] == '[')		// IPv6 literal
+    host = host.substr(1,host.size() - 2);
+
+  struct addrinfo hints;
+  memset(&hints,0,sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *addresses;
+  int rc = getaddrinfo(host.c_str(),port.c_str(),&hints,&addresses);
+  if(rc)
+    {
+      error = std::string("getaddrinfo ") + host + ": " + gai_strerror(rc);
+      return false;
+    }
+
+  int fd = -1;
+  for(struct addrinfo *a = addresses;a && fd < 0;a = a->ai_next)
+    {
+      fd = socket(a->ai_family,a->ai_socktype | SOCK_CLOEXEC,a->ai_protocol);
+      if(fd >= 0 && connect(fd,a->ai_addr,a->ai_addrlen))
+	{
+	  ::close(fd);
+	  fd = -1;
+	}
+    }
+  freeaddrinfo(addresses);
+  if(fd < 0)
+    return _set_error("connect",error);
+
+  // a stalled DCU makes recv and splice fail with EAGAIN
+  struct timeval timeout = {TIMEOUT,0};
+  setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+  setsockopt(fd,SOL_SOCKET,SO_SNDTIMEO,&timeout,sizeof(timeout));
+
+  Lock lock(&m_lock);
+  m_socket = fd;
+  if(m_cancel)
+    {
+      error = "Cancelled";
+      return false;
+    }
+  return true;
+}
+
+bool SpliceDownload::_send_request(std::string& error)
+{
+  std::ostringstream request;
+  request << "GET " << m_path << " HTTP/1.1\r\n"
+	  << "Host: " << m_address << "\r\n"
+	  << "Accept-Encoding: identity\r\n"
+	  << "Connection: close\r\n\r\n";
+  std::string buffer = request.str();
+  const char *data = buffer.data();
+  size_t len = buffer.size();
+  while(len > 0)
+    {
+      ssize_t sent = send(m_socket,data,len,MSG_NOSIGNAL);
+      if(sent < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  return _set_error("send",error);
+	}
+      data += sent, len -= sent;
+    }
+  return true;
+}
+
+bool SpliceDownload::_read_header(std::string& body_start,
+				  long long& content_length,
+				  std::string& error)
+{
+  std::string header;
+  size_t end;
+  char buffer[16 * 1024];
+  while((end = header.find("\r\n\r\n")) == std::string::npos)
+    {
+      if(header.size() > MAX_HEADER_SIZE)
+	{
+	  error = "HTTP header too large";
+	  return false;
+	}
+      ssize_t nb_read = recv(m_socket,buffer,sizeof(buffer),0);
+      if(nb_read < 0 && errno == EINTR)
+	continue;
+      else if(nb_read < 0)
+	return _set_error("recv",error);
+      else if(!nb_read)
+	{
+	  error = "Connection closed in HTTP header";
+	  return false;
+	}
+      header.append(buffer,nb_read);
+    }
+  body_start = header.substr(end + 4);
+  header.resize(end);
+
+  std::istringstream lines(header);
+  std::string line;
+  std::getline(lines,line);
+  int http_code = 0;
+  if(sscanf(line.c_str(),"HTTP/%*d.%*d %d",&http_code) != 1)
+    {
+      error = "Bad HTTP status line: " + line;
+      return false;
+    }
+  if(http_code != 200)
+    {
+      error = line.substr(std::min<size_t>(line.find(' ') + 1,line.size()));
+      if(!error.empty() && *error.rbegin() == '\r')
+	error.resize(error.size() - 1);
+      return false;
+    }
+
+  while(std::getline(lines,line))
+    {
+      if(!line.empty() && *line.rbegin() == '\r')
+	line.resize(line.size() - 1);
+      size_t colon = line.find(':');
+      if(colon == std::string::npos)
+	continue;
+      std::string name = line.substr(0,colon);
+      size_t start = line.find_first_not_of(" \t",colon + 1);
+      std::string value = (start != std::string::npos) ?
+			  line.substr(start) : "";
+      if(!strcasecmp(name.c_str(),"Content-Length"))
+	content_length = atoll(value.c_str());
+      else if((!strcasecmp(name.c_str(),"Transfer-Encoding") ||
+	       !strcasecmp(name.c_str(),"Content-Encoding")) &&
+	      strcasecmp(value.c_str(),"identity"))
+	{
+	  error = "Unsupported " + name + ": " + value;
+	  return false;
+	}
+    }
+  // not part of the file
+  if(content_length >= 0 && (long long)body_start.size() > content_length)
+    body_start.resize(content_length);
+  return true;
+}
+
+bool SpliceDownload::_set_error(const char *op, std::string& error)
+{
+  char str_errno[1024];
+  const char *error_msg = strerror_r(errno,str_errno,sizeof(str_errno));
+  std::ostringstream error_buffer;
+  error_buffer << op << " " << m_address << m_path << ": " << error_msg;
+  error = error_buffer.str();
+  return false;
+}
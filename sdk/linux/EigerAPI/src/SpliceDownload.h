@@ -0,0 +1,69 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERAPI_SPLICEDOWNLOAD_H
+#define EIGERAPI_SPLICEDOWNLOAD_H
+
+#include <pthread.h>
+
+#include <atomic>
+#include <string>
+
+namespace eigerapi
+{
+  class TargetFile;
+
+  // Minimal HTTP/1.1 GET client for the uncompressed DCU files.
+  // Once the header is parsed, the body is moved from the socket to
+  // the target file through a pipe with splice(), never copied to user
+  // space. Only identity encoded bodies are supported
+  class SpliceDownload
+  {
+  public:
+    static const int TIMEOUT = 30;	// s without any byte received
+
+    // address: "host" or "host:port", path: URL path of the file
+    SpliceDownload(const std::string& address, const std::string& path);
+    ~SpliceDownload();
+
+    // blocking, downloaded is updated as the body is written
+    bool run(TargetFile& file, std::atomic<long long>& downloaded,
+	     std::string& error);
+    // from another thread: the run stops at once
+    void cancel();
+  private:
+    bool _connect(std::string& error);
+    bool _send_request(std::string& error);
+    bool _read_header(std::string& body_start, long long& content_length,
+		      std::string& error);
+    bool _set_error(const char *op, std::string& error);
+
+    std::string		m_address;
+    std::string		m_path;
+    mutable pthread_mutex_t m_lock;
+    int			m_socket;
+    bool		m_cancel;
+  };
+}
+
+#endif // EIGERAPI_SPLICEDOWNLOAD_H
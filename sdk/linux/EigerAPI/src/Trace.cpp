@@ -0,0 +1,196 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <sys/syscall.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "eigerapi/Trace.h"
+#include "eigerapi/EigerDefines.h"
+#include "AutoMutex.h"
+
+using namespace eigerapi;
+
+struct Trace::Event
+{
+  char		name[64];
+  const char	*cat;
+  char		phase;
+  double	ts;
+  double	dur;
+  long long	frame;
+  pid_t		tid;
+};
+
+std::atomic<bool> Trace::s_active(false);
+std::vector<Trace::Event> Trace::s_events;
+std::atomic<size_t> Trace::s_next(0);
+std::atomic<size_t> Trace::s_dropped(0);
+std::atomic<int> Trace::s_writers(0);
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pid_t _get_tid()
+{
+  static thread_local pid_t tid = syscall(SYS_gettid);
+  return tid;
+}
+
+double Trace::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// the writers increment s_writers before checking s_active: once
+// inactive and without writers, the events can be read or reallocated
+void Trace::_pause()
+{
+  s_active = false;
+  while(s_writers)
+    sched_yield();
+}
+
+void Trace::start(size_t max_events)
+{
+  Lock lock(&s_lock);
+  _pause();
+  if(s_events.size() != max_events)
+    {
+      std::vector<Event> events(max_events);
+      s_events.swap(events);
+    }
+  s_next = 0;
+  s_dropped = 0;
+  s_active = true;
+}
+
+void Trace::stop()
+{
+  Lock lock(&s_lock);
+  _pause();
+}
+
+void Trace::get_nb_events(size_t& nb_events, size_t& nb_dropped)
+{
+  nb_dropped = s_dropped;
+  nb_events = std::min(s_next.load(),s_events.size());
+}
+
+void Trace::_record(const char *name, const char *cat, char phase,
+		    double ts, double dur, long long frame)
+{
+  ++s_writers;
+  if(s_active)
+    {
+      size_t i = s_next.fetch_add(1,std::memory_order_relaxed);
+      if(i < s_events.size())
+	{
+	  Event& event = s_events[i];
+	  // keep the end of long names, i.e. URLs
+	  size_t len = strlen(name);
+	  if(len >= sizeof(event.name))
+	    name += len - sizeof(event.name) + 1;
+	  strncpy(event.name,name,sizeof(event.name) - 1);
+	  event.name[sizeof(event.name) - 1] = '\0';
+	  event.cat = cat;
+	  event.phase = phase;
+	  event.ts = ts;
+	  event.dur = dur;
+	  event.frame = frame;
+	  event.tid = _get_tid();
+	}
+      else
+	s_dropped.fetch_add(1,std::memory_order_relaxed);
+    }
+  --s_writers;
+}
+
+void Trace::complete(const char *name, const char *cat,
+		     double start, double end, long long frame)
+{
+  if(is_active())
+    _record(name,cat,'X',start,end - start,frame);
+}
+
+void Trace::instant(const char *name, const char *cat, long long frame)
+{
+  if(is_active())
+    _record(name,cat,'i',now(),0,frame);
+}
+
+static void _write_string(FILE *f, const char *s)
+{
+  fputc('"',f);
+  for(;*s;++s)
+    {
+      if(*s == '"' || *s == '\\')
+	fputc('\\',f);
+      if((unsigned char) *s >= 0x20)
+	fputc(*s,f);
+    }
+  fputc('"',f);
+}
+
+void Trace::write(const std::string& path)
+{
+  Lock lock(&s_lock);
+  _pause();
+
+  FILE *f = fopen(path.c_str(),"w");
+  if(!f)
+    THROW_EIGER_EXCEPTION("Trace::write",strerror(errno));
+
+  size_t nb_events = std::min(s_next.load(),s_events.size());
+  pid_t pid = getpid();
+  fprintf(f,"{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%zu},\n"
+	  "\"traceEvents\":[\n",s_dropped.load());
+  for(size_t i = 0;i < nb_events;++i)
+    {
+      const Event& event = s_events[i];
+      fputs(i ? ",\n{\"name\":" : "{\"name\":",f);
+      _write_string(f,event.name);
+      fputs(",\"cat\":",f);
+      _write_string(f,event.cat);
+      fprintf(f,",\"ph\":\"%c\",\"ts\":%.3f,",event.phase,event.ts * 1e6);
+      if(event.phase == 'X')
+	fprintf(f,"\"dur\":%.3f,",event.dur * 1e6);
+      else
+	fputs("\"s\":\"t\",",f);
+      fprintf(f,"\"pid\":%d,\"tid\":%d",int(pid),int(event.tid));
+      if(event.frame >= 0)
+	fprintf(f,",\"args\":{\"frame\":%lld}",event.frame);
+      fputc('}',f);
+    }
+  fputs("\n]}\n",f);
+  if(fclose(f))
+    THROW_EIGER_EXCEPTION("Trace::write",strerror(errno));
+}
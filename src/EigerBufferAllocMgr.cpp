@@ -0,0 +1,273 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9 
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <linux/mempolicy.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include "EigerBufferAllocMgr.h"
+#include "lima/Exceptions.h"
+#include "lima/Timestamp.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT	26
+#endif
+
+using namespace lima;
+using namespace lima::Eiger;
+
+static const long long BUFFER_ALIGNMENT = 4096;
+
+static bool _readSysFile(const std::string& path, std::string& value)
+{
+  std::ifstream file(path.c_str());
+  return bool(std::getline(file, value));
+}
+
+static std::string _errnoString()
+{
+  char buffer[256];
+  const char *error_msg = strerror_r(errno, buffer, sizeof(buffer));
+  return error_msg;
+}
+
+HugePageBufferAllocMgr::HugePageBufferAllocMgr(long long page_size,
+					       int numa_node)
+  : m_page_size(page_size),
+    m_numa_node(numa_node),
+    m_nb_buffers(0),
+    m_buffer_size(0),
+    m_map(NULL),
+    m_map_size(0)
+{
+  DEB_CONSTRUCTOR();
+  DEB_PARAM() << DEB_VAR2(page_size, numa_node);
+
+  if ((page_size != (2LL << 20)) && (page_size != (1LL << 30)))
+    THROW_HW_ERROR(InvalidValue) << "Invalid hugepage size: " << page_size
+				 << ", must be 2 MB or 1 GB";
+}
+
+HugePageBufferAllocMgr::~HugePageBufferAllocMgr()
+{
+  DEB_DESTRUCTOR();
+  releaseBuffers();
+}
+
+long long HugePageBufferAllocMgr::_getBufferSize(const FrameDim& frame_dim)
+{
+  long long size = frame_dim.getMemSize();
+  return (size + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT * BUFFER_ALIGNMENT;
+}
+
+// free pages of the pool, on the bound node if any
+long long HugePageBufferAllocMgr::_getFreePages() const
+{
+  std::ostringstream path;
+  if (m_numa_node >= 0)
+    path << "/sys/devices/system/node/node" << m_numa_node;
+  else
+    path << "/sys/kernel/mm";
+  path << "/hugepages/hugepages-" << (m_page_size >> 10) << "kB"
+       << "/free_hugepages";
+  std::string value;
+  if (!_readSysFile(path.str(), value))
+    return 0;
+  return atoll(value.c_str());
+}
+
+int HugePageBufferAllocMgr::getMaxNbBuffers(const FrameDim& frame_dim)
+{
+  DEB_MEMBER_FUNCT();
+  long long buffer_size = _getBufferSize(frame_dim);
+  if (!buffer_size)
+    return 0;
+  // the current buffers are released before a new allocation
+  long long nb_pages = _getFreePages() + m_map_size / m_page_size;
+  long long max_nb_buffers = nb_pages * m_page_size / buffer_size;
+  DEB_RETURN() << DEB_VAR1(max_nb_buffers);
+  return int(std::min<long long>(max_nb_buffers,
+				 std::numeric_limits<int>::max()));
+}
+
+void HugePageBufferAllocMgr::allocBuffers(int nb_buffers,
+					  const FrameDim& frame_dim)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(nb_buffers, frame_dim);
+
+  long long buffer_size = _getBufferSize(frame_dim);
+  if (m_map && (nb_buffers == m_nb_buffers) &&
+      (buffer_size == m_buffer_size)) {
+    m_frame_dim = frame_dim;
+    return;
+  }
+  releaseBuffers();
+  if (!nb_buffers || !buffer_size)
+    return;
+
+  long long size = nb_buffers * buffer_size;
+  size_t map_size = (size + m_page_size - 1) / m_page_size * m_page_size;
+  // a bound fault without free page on the node would be a SIGBUS
+  bool bind = (m_numa_node >= 0);
+  long long nb_pages = map_size / m_page_size;
+  if (bind && (_getFreePages() < nb_pages)) {
+    DEB_WARNING() << "Not enough free hugepages on NUMA node " << m_numa_node
+		  << ": buffers not bound";
+    bind = false;
+  }
+
+  int page_shift = __builtin_ctzll(m_page_size);
+  int flags = (MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+	       (page_shift << MAP_HUGE_SHIFT));
+  void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (map == MAP_FAILED)
+    THROW_HW_ERROR(Error) << "Could not map " << map_size << " bytes of "
+			  << (m_page_size >> 20) << " MB hugepages: "
+			  << _errnoString();
+  m_map = (char *) map;
+  m_map_size = map_size;
+
+  // before the first touch, the pages are allocated on the bound node
+  if (bind) {
+    unsigned long node_mask[16] = {};
+    const int bits = sizeof(node_mask[0]) * 8;
+    if (m_numa_node < int(sizeof(node_mask) * 8))
+      node_mask[m_numa_node / bits] = 1UL << (m_numa_node % bits);
+    if (syscall(SYS_mbind, m_map, m_map_size, MPOL_BIND, node_mask,
+		sizeof(node_mask) * 8, 0))
+      DEB_WARNING() << "Could not bind the buffers to NUMA node "
+		    << m_numa_node << ": " << _errnoString();
+  }
+
+  Timestamp t0 = Timestamp::now();
+  for (size_t offset = 0; offset < m_map_size; offset += m_page_size)
+    *(volatile char *) (m_map + offset) = 0;
+  if (mlock(m_map, m_map_size))
+    DEB_WARNING() << "Could not lock the buffers: " << _errnoString();
+  DEB_TRACE() << "Pre-faulted " << m_map_size << " bytes in "
+	      << (Timestamp::now() - t0) << " s";
+
+  m_frame_dim = frame_dim;
+  m_nb_buffers = nb_buffers;
+  m_buffer_size = buffer_size;
+}
+
+const FrameDim& HugePageBufferAllocMgr::getFrameDim()
+{
+  return m_frame_dim;
+}
+
+void HugePageBufferAllocMgr::getNbBuffers(int& nb_buffers)
+{
+  nb_buffers = m_nb_buffers;
+}
+
+void HugePageBufferAllocMgr::releaseBuffers()
+{
+  DEB_MEMBER_FUNCT();
+  if (m_map) {
+    munlock(m_map, m_map_size);
+    munmap(m_map, m_map_size);
+  }
+  m_map = NULL;
+  m_map_size = 0;
+  m_nb_buffers = 0;
+  m_buffer_size = 0;
+  m_frame_dim = FrameDim();
+}
+
+void *HugePageBufferAllocMgr::getBufferPtr(int buffer_nb)
+{
+  DEB_MEMBER_FUNCT();
+  if ((buffer_nb < 0) || (buffer_nb >= m_nb_buffers))
+    THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(buffer_nb);
+  return m_map + buffer_nb * m_buffer_size;
+}
+
+int HugePageBufferAllocMgr::getHostNumaNode(const std::string& host)
+{
+  DEB_STATIC_FUNCT();
+  DEB_PARAM() << DEB_VAR1(host);
+
+  // the local address routing to the host gives the interface
+  struct addrinfo hints = {}, *res;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  if (getaddrinfo(host.c_str(), "80", &hints, &res))
+    return -1;
+  sockaddr_in local = {};
+  socklen_t local_len = sizeof(local);
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  bool ok = ((fd >= 0) && !connect(fd, res->ai_addr, res->ai_addrlen) &&
+	     !getsockname(fd, (sockaddr *) &local, &local_len));
+  if (fd >= 0)
+    close(fd);
+  freeaddrinfo(res);
+  if (!ok)
+    return -1;
+
+  std::string if_name;
+  struct ifaddrs *if_list;
+  if (getifaddrs(&if_list))
+    return -1;
+  for (struct ifaddrs *i = if_list; i; i = i->ifa_next) {
+    if (!i->ifa_addr || (i->ifa_addr->sa_family != AF_INET))
+      continue;
+    sockaddr_in *addr = (sockaddr_in *) i->ifa_addr;
+    if (addr->sin_addr.s_addr == local.sin_addr.s_addr) {
+      if_name = i->ifa_name;
+      break;
+    }
+  }
+  freeifaddrs(if_list);
+
+  std::string value;
+  std::string path = "/sys/class/net/" + if_name + "/device/numa_node";
+  int numa_node = -1;
+  if (!if_name.empty() && _readSysFile(path, value))
+    numa_node = atoi(value.c_str());
+  DEB_TRACE() << DEB_VAR2(if_name, numa_node);
+  return numa_node;
+}
+
+std::string HugePageBufferAllocMgr::getNumaNodeCpus(int numa_node)
+{
+  std::ostringstream path;
+  path << "/sys/devices/system/node/node" << numa_node << "/cpulist";
+  std::string cpus;
+  _readSysFile(path.str(), cpus);
+  return cpus;
+}
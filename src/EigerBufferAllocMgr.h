@@ -0,0 +1,73 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9 
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERBUFFERALLOCMGR_H
+#define EIGERBUFFERALLOCMGR_H
+
+#include "lima/Debug.h"
+#include "lima/HwBufferMgr.h"
+
+#include <string>
+
+namespace lima
+{
+  namespace Eiger
+  {
+    // Frame buffers in one hugepage mapping (2 MB or 1 GB pages),
+    // optionally bound to a NUMA node. The pages are faulted in and
+    // locked when the buffers are allocated, at prepareAcq, so the
+    // first frames of a series do not take page faults
+    class HugePageBufferAllocMgr : public BufferAllocMgr
+    {
+      DEB_CLASS_NAMESPC(DebModCamera,"HugePageBufferAllocMgr","Eiger");
+    public:
+      // numa_node < 0: no binding
+      HugePageBufferAllocMgr(long long page_size, int numa_node);
+      virtual ~HugePageBufferAllocMgr();
+
+      virtual int getMaxNbBuffers(const FrameDim& frame_dim);
+      virtual void allocBuffers(int nb_buffers, const FrameDim& frame_dim);
+      virtual const FrameDim& getFrameDim();
+      virtual void getNbBuffers(int& nb_buffers);
+      virtual void releaseBuffers();
+      virtual void *getBufferPtr(int buffer_nb);
+
+      // node of the network interface routing to host, -1 if unknown
+      static int getHostNumaNode(const std::string& host);
+      static std::string getNumaNodeCpus(int numa_node);
+
+    private:
+      static long long _getBufferSize(const FrameDim& frame_dim);
+      long long _getFreePages() const;
+
+      long long	m_page_size;
+      int	m_numa_node;
+      FrameDim	m_frame_dim;
+      int	m_nb_buffers;
+      long long	m_buffer_size;
+      char	*m_map;
+      size_t	m_map_size;
+    };
+  }
+}
+#endif	// EIGERBUFFERALLOCMGR_H
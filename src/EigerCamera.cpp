@@ -31,7 +31,11 @@
 #include <pthread.h>
 #include "EigerCamera.h"
 #include "EigerCameraRequests.h"
+#include "EigerStatistics.h"
+#include "EigerThreadPlacement.h"
 #include "lima/Timestamp.h"
+#include <eigerapi/Metrics.h>
+#include <eigerapi/Trace.h>
 
 using namespace lima;
 using namespace lima::Eiger;
@@ -47,6 +51,9 @@ using namespace eigerapi;
 #define setParam(param, value)			\
   setEigerParam(*this, param, value)
 
+#define setParamAsync(param, value, cbk)	\
+  setEigerParamAsync(*this, param, value, cbk)
+
 #define setCachedParam(param, cache, value)	\
   setEigerCachedParam(*this, param, cache, value)
 
@@ -56,6 +63,14 @@ using namespace eigerapi;
 #define getParam(param, value)			\
   getEigerParam(*this, param, value)
 
+static Metrics::Histogram first_frame_latency(
+				"eiger_trigger_first_frame_latency_seconds",
+				"Internal trigger sent to its first frame "
+				"received", Metrics::latency_bounds());
+static Metrics::Histogram trigger_duration("eiger_trigger_duration_seconds",
+					   "Internal trigger sent to its "
+					   "last frame received",
+					   Metrics::latency_bounds());
 
 /*----------------------------------------------------------------------------
 			    Callback class
@@ -64,9 +79,9 @@ class Camera::TriggerCallback : public Callback
 {
   DEB_CLASS_NAMESPC(DebModCamera, "Camera::TriggerCallback", "Eiger");
 public:
-  TriggerCallback(Camera& cam, bool disarm, double duration)
+  TriggerCallback(Camera& cam, bool disarm, double duration, int trigger)
     : m_cam(cam), m_disarm(disarm), m_duration(duration),
-      m_start_ts(Timestamp::now())
+      m_trigger(trigger), m_start_ts(Timestamp::now())
   {}
 
   void status_changed(CurlLoop::FutureRequest::Status status,
@@ -89,12 +104,13 @@ public:
     }
     if (!ok)
       DEB_ERROR() << DEB_VAR1(error); 
-    m_cam._trigger_finished(ok, m_disarm);
+    m_cam._trigger_finished(ok, m_disarm, m_trigger);
   }
 private:
   Camera& m_cam;
   bool m_disarm;
   double m_duration;
+  int m_trigger;
   Timestamp m_start_ts;
 };
 
@@ -119,6 +135,42 @@ private:
   Camera& m_cam;
 };
 
+class Camera::ChainedArmCallback : public Callback
+{
+  DEB_CLASS_NAMESPC(DebModCamera, "Camera::ChainedArmCallback", "Eiger");
+public:
+  ChainedArmCallback(Camera& cam, CommandReq arm_cmd)
+    : m_cam(cam), m_arm_cmd(arm_cmd)
+  {}
+
+  void status_changed(CurlLoop::FutureRequest::Status status,
+		      std::string error)
+  {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR2(status, error);
+    // the command holds this callback: break the reference cycle
+    CommandReq arm_cmd;
+    arm_cmd.swap(m_arm_cmd);
+    bool ok = (status == CurlLoop::FutureRequest::OK);
+    int serie_id = -1;
+    if (ok) {
+      try {
+	serie_id = arm_cmd->get_serie_id();
+      } catch(const eigerapi::EigerException &e) {
+	error = e.what();
+	ok = false;
+      }
+    }
+    if (!ok)
+      DEB_ERROR() << DEB_VAR1(error);
+    m_cam._chainedArmFinished(ok, serie_id);
+  }
+
+private:
+  Camera& m_cam;
+  CommandReq m_arm_cmd;
+};
+
 //-----------------------------------------------------------------------------
 ///  Ctor
 //-----------------------------------------------------------------------------
@@ -126,6 +178,7 @@ Camera::Camera(const std::string& host, int http_port, int stream_port)	///< [in
   : 		m_frames_triggered(0),
 		m_frames_acquired(0),
                 m_latency_time(0.),
+		m_latency_nb_images(0),
 		m_auto_summation(false),
                 m_detectorImageType(Bpp16),
 		m_dynamic_pixel_depth(false),
@@ -133,6 +186,14 @@ Camera::Camera(const std::string& host, int http_port, int stream_port)	///< [in
 		m_trigger_state(IDLE),
 		m_armed(false),
 		m_serie_id(0),
+		m_series_chaining(false),
+		m_chain_rearm(false),
+		m_chain_state(CHAIN_IDLE),
+		m_chain_serie_id(-1),
+		m_chain_config_gen(0),
+		m_config_gen(0),
+		m_set_busy(false),
+		m_sync_gen(0),
                 m_exp_time(1.),
                 m_detector_host(host),
                 m_detector_http_port(http_port),
@@ -144,6 +205,14 @@ Camera::Camera(const std::string& host, int http_port, int stream_port)	///< [in
     std::string http_address = host + ":" + std::to_string(http_port);
     m_requests = new Requests(http_address);
 
+    std::vector<pthread_t> loop_threads;
+    m_requests->get_loop_threads(loop_threads);
+    for (unsigned int i = 0; i < loop_threads.size(); ++i) {
+      std::string name = "curl loop " + std::to_string(i);
+      ThreadPlacement::registerThread(ThreadPlacement::Curl,
+				      loop_threads[i], name);
+    }
+
     // Detect EigerAPI version
     m_api_version = m_requests->get_api_version();
     DEB_TRACE() << DEB_VAR1(m_api_version);
@@ -191,6 +260,10 @@ Camera::Camera(const std::string& host, int http_port, int stream_port)	///< [in
 Camera::~Camera()
 {
     DEB_DESTRUCTOR();
+    std::vector<pthread_t> loop_threads;
+    m_requests->get_loop_threads(loop_threads);
+    for (unsigned int i = 0; i < loop_threads.size(); ++i)
+      ThreadPlacement::unregisterThread(loop_threads[i]);
     delete m_requests;
 }
 
@@ -241,6 +314,24 @@ void Camera::_initialization_finished(bool ok)
 void Camera::prepareAcq()
 {
   DEB_MEMBER_FUNCT();
+  PrepareTiming timing;
+  _prepareAcq(false, PrepareOverlap(), timing);
+  DEB_TRACE() << DEB_VAR1(timing);
+}
+
+//-----------------------------------------------------------------------------
+/// Send the acquisition parameters and arm the detector.
+/// The filewriter clear command and the changed parameters are sent
+/// without waiting for each other (the parameters are queued one after
+/// the other on Eiger2), the overlap function (if any) is called while
+/// they are in progress
+//-----------------------------------------------------------------------------
+void Camera::_prepareAcq(bool clear_filewriter, PrepareOverlap overlap,
+			 PrepareTiming& timing)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(clear_filewriter);
+
   AutoMutex aLock(m_cond.mutex());
   if(m_armed)
     THROW_HW_ERROR(Error) << "Camera already armed";
@@ -270,14 +361,40 @@ void Camera::prepareAcq()
 
   DEB_PARAM() << DEB_VAR3(frame_time, nb_images, nb_triggers);
 
-  setCachedParam(Requests::FRAME_TIME, m_frame_time, frame_time);
-  setCachedParam(Requests::NIMAGES, m_nb_images, nb_images);
-  setCachedParam(Requests::NTRIGGER, m_nb_triggers, nb_triggers);
+  if(_useChainedArm(clear_filewriter, overlap, frame_time, nb_images,
+		    nb_triggers, aLock))
+    return;
+
+  Timestamp t0 = Timestamp::now();
+  CommandReq clear_cmd;
+  if(clear_filewriter)
+    clear_cmd = startEigerCommand(*this, Requests::FILEWRITER_CLEAR);
+
+  MultiParamRequest params(*this);
+  params.addCachedSet(Requests::FRAME_TIME, m_frame_time, frame_time);
+  params.addCachedSet(Requests::NIMAGES, m_nb_images, nb_images);
+  params.addCachedSet(Requests::NTRIGGER, m_nb_triggers, nb_triggers);
+
+  if(overlap)
+    {
+      AutoMutexUnlock u(aLock);
+      overlap();
+    }
+
+  if(clear_cmd)
+    {
+      waitEigerCommand(*this, clear_cmd);
+      timing.clear = Timestamp::now() - t0;
+    }
+  params.wait();
+  timing.params = Timestamp::now() - t0;
 
   DEB_TRACE() << "Arm start";
+  Timestamp t1 = Timestamp::now();
   double timeout = 5 * 60.; // 5 min timeout
   CommandReq arm_cmd = sendCommandTimeout(Requests::ARM, timeout);
-  DEB_TRACE() << "Arm end";
+  timing.arm = Timestamp::now() - t1;
+  DEB_TRACE() << "Arm end: " << DEB_VAR1(timing.arm);
   m_armed = true;
   try {
     m_serie_id = arm_cmd->get_serie_id();
@@ -285,6 +402,174 @@ void Camera::prepareAcq()
     HANDLE_EIGERERROR(arm_cmd, e);
   }
   m_frames_triggered = m_frames_acquired = 0;
+  _resetTriggerLatency();
+  m_chain_rearm = (m_series_chaining && !clear_filewriter);
+}
+
+//-----------------------------------------------------------------------------
+/// Use the series armed at the end of the previous one, if any.
+/// It is kept only if the detector configuration did not change,
+/// otherwise it is disarmed
+//-----------------------------------------------------------------------------
+bool Camera::_useChainedArm(bool clear_filewriter, PrepareOverlap& overlap,
+			    double frame_time, unsigned nb_images,
+			    unsigned nb_triggers, AutoMutex& lock)
+{
+  DEB_MEMBER_FUNCT();
+
+  while(m_chain_state == CHAIN_ARMING)
+    m_cond.wait();
+  if(!_takeChainedArm())
+    return false;
+
+  // the overlap function can change the (stream) configuration
+  if(overlap)
+    {
+      AutoMutexUnlock u(lock);
+      overlap();
+      overlap = PrepareOverlap();
+    }
+
+  bool same_config = (!clear_filewriter &&
+		      (frame_time == m_frame_time) &&
+		      (nb_images == m_nb_images) &&
+		      (nb_triggers == m_nb_triggers) &&
+		      (m_config_gen == m_chain_config_gen));
+  DEB_TRACE() << DEB_VAR2(same_config, m_chain_serie_id);
+  if(!same_config)
+    {
+      DEB_TRACE() << "Configuration changed: disarming chained series";
+      AutoMutexUnlock u(lock);
+      sendCommand(Requests::DISARM);
+      return false;
+    }
+
+  m_armed = true;
+  m_serie_id = m_chain_serie_id;
+  m_frames_triggered = m_frames_acquired = 0;
+  _resetTriggerLatency();
+  m_chain_rearm = m_series_chaining;
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+/// Called by the Stream when a series ends normally: if chaining is
+/// enabled the detector is armed again with the same configuration.
+/// Only with internal triggers: armed in advance, an external trigger
+/// would start the series before the Lima acquisition
+//-----------------------------------------------------------------------------
+void Camera::_seriesFinished()
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_cond.mutex());
+  bool int_trig = ((m_trig_mode == IntTrig) || (m_trig_mode == IntTrigMult));
+  bool rearm = (m_chain_rearm && m_series_chaining && int_trig && !m_armed &&
+		(m_chain_state == CHAIN_IDLE));
+  m_chain_rearm = false;
+  DEB_TRACE() << DEB_VAR1(rearm);
+  if(!rearm)
+    return;
+
+  m_chain_state = CHAIN_ARMING;
+  m_chain_config_gen = m_config_gen;
+  CommandReq arm_cmd = m_requests->get_command(Requests::ARM);
+  AutoMutexUnlock u(lock);
+  DEB_TRACE() << "Chained arm start";
+  CallbackPtr cbk(new ChainedArmCallback(*this, arm_cmd));
+  arm_cmd->register_callback(cbk, true);
+}
+
+//-----------------------------------------------------------------------------
+/// Called before a parameter is sent: a series chained with the previous
+/// configuration is no longer reused by _useChainedArm.
+/// Lock-free, the MultiParamRequest calls it with the camera lock held
+//-----------------------------------------------------------------------------
+void Camera::_configChanged()
+{
+  ++m_config_gen;
+}
+
+//-----------------------------------------------------------------------------
+/// Take the series armed in advance, if any: the caller either uses it
+/// or disarms it. Lock-free, so it can be called with or without the
+/// camera lock; only the transitions to CHAIN_ARMED are waited for
+//-----------------------------------------------------------------------------
+bool Camera::_takeChainedArm()
+{
+  ChainState armed = CHAIN_ARMED;
+  return m_chain_state.compare_exchange_strong(armed, CHAIN_IDLE);
+}
+
+//-----------------------------------------------------------------------------
+/// Called by the synchronous setters: the detector is not left armed
+/// while reconfigured
+//-----------------------------------------------------------------------------
+void Camera::_disarmChained()
+{
+  DEB_MEMBER_FUNCT();
+  if(!_takeChainedArm())
+    return;
+  DEB_TRACE() << "Configuration changed: disarming chained series";
+  sendCommand(Requests::DISARM);
+}
+
+//-----------------------------------------------------------------------------
+/// The Eiger2 DCU handles the parameter PUTs one at a time: a synchronous
+/// setter waits for the PUT in progress, the async ones and those of the
+/// MultiParamRequest are queued and started in turn by the completion of
+/// the previous one. Queuing never blocks, so it can be done with the
+/// camera lock held
+//-----------------------------------------------------------------------------
+void Camera::_acquireSet()
+{
+  if(m_api == Eiger1)
+    return;
+  AutoMutex lock(m_set_cond.mutex());
+  while(m_set_busy)
+    m_set_cond.wait();
+  m_set_busy = true;
+}
+
+void Camera::_releaseSet()
+{
+  if(m_api == Eiger1)
+    return;
+  AutoMutex lock(m_set_cond.mutex());
+  if(m_set_queue.empty())
+    {
+      m_set_busy = false;
+      m_set_cond.broadcast();
+      return;
+    }
+  SetStart start = std::move(m_set_queue.front());
+  m_set_queue.pop_front();
+  lock.unlock();
+  start();
+}
+
+void Camera::_queueSet(SetStart start)
+{
+  if(m_api != Eiger1)
+    {
+      AutoMutex lock(m_set_cond.mutex());
+      if(m_set_busy)
+	{
+	  m_set_queue.push_back(std::move(start));
+	  return;
+	}
+      m_set_busy = true;
+    }
+  start();
+}
+
+void Camera::_chainedArmFinished(bool ok, int serie_id)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(ok, serie_id);
+  AutoMutex lock(m_cond.mutex());
+  m_chain_state = ok ? CHAIN_ARMED : CHAIN_IDLE;
+  m_chain_serie_id = serie_id;
+  m_cond.broadcast();
 }
 
 
@@ -300,12 +585,19 @@ void Camera::startAcq()
     {
       CommandReq trigger = m_requests->get_command(Requests::TRIGGER);
       m_trigger_state = RUNNING;
+      int trigger_nb = m_frames_triggered / m_nb_images;
       m_frames_triggered += m_nb_images;
       bool disarm_at_end = (m_frames_triggered == m_nb_frames);
-      DEB_TRACE() << "Trigger start: " << DEB_VAR1(disarm_at_end);
+      DEB_TRACE() << "Trigger start: " << DEB_VAR2(trigger_nb, disarm_at_end);
       double duration = m_nb_images * m_frame_time;
       AutoMutexUnlock u(lock);
-      CallbackPtr cbk(new TriggerCallback(*this, disarm_at_end, duration));
+      {
+	AutoMutex latency_lock(m_latency_lock);
+	m_trigger_times.resize(trigger_nb + 1);
+	m_trigger_times[trigger_nb].sent = Timestamp::now();
+      }
+      CallbackPtr cbk(new TriggerCallback(*this, disarm_at_end, duration,
+					  trigger_nb));
       trigger->register_callback(cbk, disarm_at_end);
     }
   
@@ -319,6 +611,7 @@ void Camera::stopAcq()
 {
   DEB_MEMBER_FUNCT();
   AutoMutex lock(m_cond.mutex());
+  m_chain_rearm = false;
   if (!m_armed)
     return;
 
@@ -594,7 +887,6 @@ void Camera::getNbFrames(int& nb_frames) ///< [out] current number of frames to
 void Camera::getNbHwAcquiredFrames(int &nb_acq_frames) ///< [out] number of acquired files
 { 
   DEB_MEMBER_FUNCT();
-  AutoMutex lock(m_cond.mutex());
   nb_acq_frames = m_frames_acquired;
   DEB_RETURN() << DEB_VAR1(nb_acq_frames);
 }
@@ -796,6 +1088,8 @@ void Camera::_synchronize()
   else
     THROW_HW_ERROR(InvalidValue) << "Unexpected compression type: "
 				 << DEB_VAR1(compression_type);
+
+  ++m_sync_gen;
 }
 
 //----------------------------------------------------------------------------
@@ -829,11 +1123,20 @@ void Camera::_updateImageSize()
 /*----------------------------------------------------------------------------
 	This method is called when the trigger is finished
   ----------------------------------------------------------------------------*/
-void Camera::_trigger_finished(bool ok, bool do_disarm)
+void Camera::_trigger_finished(bool ok, bool do_disarm, int trigger)
 {
   DEB_MEMBER_FUNCT();
-  DEB_PARAM() << DEB_VAR1(ok);
-  
+  DEB_PARAM() << DEB_VAR2(ok, trigger);
+
+  {
+    AutoMutex lock(m_latency_lock);
+    // the series could have been reset meanwhile
+    if (ok && (trigger < int(m_trigger_times.size()))) {
+      m_trigger_times[trigger].done = Timestamp::now();
+      _addTriggerLatency(trigger);
+    }
+  }
+
   DEB_TRACE() << "Trigger end";
   if(!ok) {
     DEB_ERROR() << "Error in trigger command";
@@ -849,17 +1152,94 @@ void Camera::_trigger_finished(bool ok, bool do_disarm)
 void Camera::newFrameAcquired()
 {
   DEB_MEMBER_FUNCT();
-  AutoMutex lock(m_cond.mutex());
-  ++m_frames_acquired;
-  DEB_TRACE() << DEB_VAR1(m_frames_acquired);
+  int frames_acquired = ++m_frames_acquired;
+  DEB_TRACE() << DEB_VAR1(frames_acquired);
+}
+
+//-----------------------------------------------------------------------------
+/// Called by the Stream for every frame received: the arrival of the
+/// first and the last frame of each internal trigger is recorded
+//-----------------------------------------------------------------------------
+void Camera::_frameReceived(int frameid, Timestamp rx_tstamp)
+{
+  int nb_images = m_latency_nb_images.load(std::memory_order_relaxed);
+  if (!nb_images)
+    return;
+  int image = frameid % nb_images;
+  bool first = (image == 0), last = (image == nb_images - 1);
+  if (!first && !last)
+    return;
+
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(frameid, rx_tstamp);
+  AutoMutex lock(m_latency_lock);
+  unsigned int trigger = frameid / nb_images;
+  if (trigger >= m_trigger_times.size())
+    return;
+  TriggerTimes& times = m_trigger_times[trigger];
+  if (first)
+    times.first = rx_tstamp;
+  if (last) {
+    times.last = rx_tstamp;
+    _addTriggerLatency(trigger);
+  }
+}
+
+// m_latency_lock must be held. Added once the last frame arrived
+// and the command finished, whatever the order
+void Camera::_addTriggerLatency(int trigger)
+{
+  DEB_MEMBER_FUNCT();
+  const TriggerTimes& times = m_trigger_times[trigger];
+  if (!times.first.isSet() || !times.last.isSet() || !times.done.isSet())
+    return;
+  m_trigger_latency.add(times.sent, times.first, times.last, times.done);
+  first_frame_latency.observe(times.first - times.sent);
+  trigger_duration.observe(times.last - times.sent);
+  DEB_TRACE() << DEB_VAR2(trigger, m_trigger_latency);
+}
+
+// a new series: only internal triggers are measured
+void Camera::_resetTriggerLatency()
+{
+  DEB_MEMBER_FUNCT();
+  bool int_trig = (m_trig_mode == IntTrig) || (m_trig_mode == IntTrigMult);
+  AutoMutex lock(m_latency_lock);
+  m_latency_nb_images = int_trig ? int(m_nb_images) : 0;
+  m_trigger_times.clear();
+  m_trigger_latency.reset();
+}
+
+// TRIGGER sent to the first frame, for each trigger of the series
+void Camera::_getFirstFrameLatency(std::vector<double>& latency)
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_latency_lock);
+  latency.clear();
+  for (const auto& times : m_trigger_times)
+    if (times.first.isSet())
+      latency.push_back(times.first - times.sent);
+}
+
+//-----------------------------------------------------------------------------
+/// Latency of the internal triggers of the current (or last) series:
+/// TRIGGER command sent to the first and last stream frame received,
+/// and to its completion. Stream mode only
+//-----------------------------------------------------------------------------
+void Camera::getTriggerLatency(TriggerLatency& latency)
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_latency_lock);
+  latency = m_trigger_latency;
+  DEB_RETURN() << DEB_VAR1(latency);
 }
 
 bool Camera::allFramesAcquired()
 {
   DEB_MEMBER_FUNCT();
-  AutoMutex lock(m_cond.mutex());
-  DEB_PARAM() << DEB_VAR2(m_frames_acquired, m_nb_frames);
-  bool finished = (m_frames_acquired == m_nb_frames);
+  int frames_acquired = m_frames_acquired;
+  DEB_PARAM() << DEB_VAR2(frames_acquired, m_nb_frames);
+  bool finished = (frames_acquired == m_nb_frames);
   DEB_RETURN() << DEB_VAR1(finished);
   return finished;
 }
@@ -1253,6 +1633,126 @@ void Camera::getDetectorDistance(double& value) ///< [out]
   getParam(Requests::HEADER_DETECTOR_DISTANCE,value);
 }
 
+//-----------------------------------------------------------------------------
+///  Count rate correction asynchronous setter
+//-----------------------------------------------------------------------------
+Camera::AsyncResult Camera::setCountrateCorrectionAsync(bool value, AsyncCallback cbk)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(value);
+  return setParamAsync(Requests::COUNTRATE_CORRECTION,value,cbk);
+}
+
+//-----------------------------------------------------------------------------
+///  FlatfieldCorrection asynchronous setter
+//-----------------------------------------------------------------------------
+Camera::AsyncResult Camera::setFlatfieldCorrectionAsync(bool value, AsyncCallback cbk)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(value);
+  return setParamAsync(Requests::FLATFIELD_CORRECTION,value,cbk);
+}
+
+//-----------------------------------------------------------------------------
+///  Retrigger mode asynchronous setter
+//-----------------------------------------------------------------------------
+Camera::AsyncResult Camera::setRetriggerAsync(bool value, AsyncCallback cbk)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(value);
+  return setParamAsync(Requests::RETRIGGER,value,cbk);
+}
+
+//-----------------------------------------------------------------------------
+///  PixelMask asynchronous setter
+//-----------------------------------------------------------------------------
+Camera::AsyncResult Camera::setPixelMaskAsync(bool value, AsyncCallback cbk)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(value);
+  return setParamAsync(Requests::PIXEL_MASK,value,cbk);
+}
+
+//-----------------------------------------------------------------------------
+///  ThresholdEnergy asynchronous setter
+//-----------------------------------------------------------------------------
+Camera::AsyncResult Camera::setThresholdEnergyAsync(double value, AsyncCallback cbk)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(value);
+  return setParamAsync(Requests::THRESHOLD_ENERGY,value,cbk);
+}
+
+//-----------------------------------------------------------------------------
+///  ThresholdEnergy2 asynchronous setter
+//-----------------------------------------------------------------------------
+Camera::AsyncResult Camera::setThresholdEnergy2Async(double value, AsyncCallback cbk)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(value);
+  return setParamAsync(Requests::THRESHOLD_ENERGY2,value,cbk);
+}
+
+//-----------------------------------------------------------------------------
+///  VirtualPixelCorrection asynchronous setter
+//-----------------------------------------------------------------------------
+Camera::AsyncResult Camera::setVirtualPixelCorrectionAsync(bool value, AsyncCallback cbk)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(value);
+  return setParamAsync(Requests::VIRTUAL_PIXEL_CORRECTION,value,cbk);
+}
+
+//-----------------------------------------------------------------------------
+///  PhotonEnergy asynchronous setter
+//-----------------------------------------------------------------------------
+Camera::AsyncResult Camera::setPhotonEnergyAsync(double value, AsyncCallback cbk)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(value);
+  return setParamAsync(Requests::PHOTON_ENERGY,value,cbk);
+}
+
+//-----------------------------------------------------------------------------
+///  Wavelength asynchronous setter
+//-----------------------------------------------------------------------------
+Camera::AsyncResult Camera::setWavelengthAsync(double value, AsyncCallback cbk)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(value);
+  return setParamAsync(Requests::HEADER_WAVELENGTH,value,cbk);
+}
+
+//-----------------------------------------------------------------------------
+///  BeamCenterX asynchronous setter
+//-----------------------------------------------------------------------------
+Camera::AsyncResult Camera::setBeamCenterXAsync(double value, AsyncCallback cbk)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(value);
+  return setParamAsync(Requests::HEADER_BEAM_CENTER_X,value,cbk);
+}
+
+//-----------------------------------------------------------------------------
+///  BeamCenterY asynchronous setter
+//-----------------------------------------------------------------------------
+Camera::AsyncResult Camera::setBeamCenterYAsync(double value, AsyncCallback cbk)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(value);
+  return setParamAsync(Requests::HEADER_BEAM_CENTER_Y,value,cbk);
+}
+
+//-----------------------------------------------------------------------------
+///  DetectorDistance asynchronous setter
+//-----------------------------------------------------------------------------
+Camera::AsyncResult Camera::setDetectorDistanceAsync(double value, AsyncCallback cbk)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(value);
+  return setParamAsync(Requests::HEADER_DETECTOR_DISTANCE,value,cbk);
+}
+
 //-----------------------------------------------------------------------------
 ///  DataCollectionDate getter
 //-----------------------------------------------------------------------------
@@ -1379,6 +1879,78 @@ void Camera::disarm()
   sendCommand(Requests::DISARM);
 }
 
+//-----------------------------------------------------------------------------
+/// Keep the stream connected and arm the next series as soon as the
+/// previous one ends. The next prepareAcq reuses it if the detector
+/// configuration did not change (stream mode only)
+//-----------------------------------------------------------------------------
+void Camera::setSeriesChaining(bool enable)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(enable);
+  AutoMutex lock(m_cond.mutex());
+  m_series_chaining = enable;
+  if (enable)
+    return;
+
+  m_chain_rearm = false;
+  while (m_chain_state == CHAIN_ARMING)
+    m_cond.wait();
+  if (!_takeChainedArm())
+    return;
+
+  lock.unlock();
+  DEB_TRACE() << "Disarming chained series";
+  sendCommand(Requests::DISARM);
+}
+
+void Camera::getSeriesChaining(bool& enable)
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_cond.mutex());
+  enable = m_series_chaining;
+  DEB_RETURN() << DEB_VAR1(enable);
+}
+
+//-----------------------------------------------------------------------------
+/// Record the frame lifecycle and the REST requests as trace events,
+/// process wide. Starting clears the previous recording
+//-----------------------------------------------------------------------------
+void Camera::setTraceActive(bool active)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(active);
+  if (active)
+    Trace::start();
+  else
+    Trace::stop();
+}
+
+void Camera::getTraceActive(bool& active)
+{
+  DEB_MEMBER_FUNCT();
+  active = Trace::is_active();
+  DEB_RETURN() << DEB_VAR1(active);
+}
+
+//-----------------------------------------------------------------------------
+/// Stop the recording and write it as a Chrome trace-event JSON file,
+/// to be opened in Perfetto or chrome://tracing
+//-----------------------------------------------------------------------------
+void Camera::writeTrace(const std::string& path)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(path);
+  try {
+    Trace::write(path);
+  } catch (const EigerException &e) {
+    THROW_HW_ERROR(Error) << e.what();
+  }
+  size_t nb_events, nb_dropped;
+  Trace::get_nb_events(nb_events, nb_dropped);
+  DEB_TRACE() << DEB_VAR2(nb_events, nb_dropped);
+}
+
 const std::string& Camera::getDetectorHost() const
 {
   return m_detector_host;
@@ -25,6 +25,9 @@
 #ifndef EIGERCAMERAREQUESTS_H
 #define EIGERCAMERAREQUESTS_H
 
+#include <functional>
+#include <future>
+
 #include <eigerapi/Requests.h>
 #include "EigerCamera.h"
 
@@ -44,6 +47,97 @@ typedef eigerapi::CurlLoop::FutureRequest::CallbackPtr CallbackPtr;
     THROW_HW_ERROR(Error) << (req)->get_url() << ":" << (e).what();	\
 }
 
+/*----------------------------------------------------------------------------
+			    class AsyncSetCallback
+ ----------------------------------------------------------------------------*/
+// Completes the future returned by the Camera::set...Async methods
+// and starts the next queued PUT
+class AsyncSetCallback : public Callback
+{
+  DEB_CLASS_NAMESPC(DebModCamera, "AsyncSetCallback", "Eiger");
+
+public:
+  AsyncSetCallback(Camera& cam, Camera::AsyncCallback cbk)
+    : m_cam(cam), m_cbk(cbk)
+  {}
+
+  Camera::AsyncResult get_future()
+  { return m_promise.get_future().share(); }
+
+  void set_url(const std::string& url)
+  { m_url = url; }
+
+  void status_changed(eigerapi::CurlLoop::FutureRequest::Status status,
+		      std::string error)
+  {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR3(m_url, status, error);
+    finished(status == eigerapi::CurlLoop::FutureRequest::OK, error);
+  }
+
+  void finished(bool ok, const std::string& error)
+  {
+    DEB_MEMBER_FUNCT();
+    if (ok) {
+      m_promise.set_value();
+    } else {
+      DEB_ERROR() << m_url << ":" << error;
+      std::string desc = m_url + ":" + error;
+      m_promise.set_exception(std::make_exception_ptr(LIMA_HW_EXC(Error,
+								  desc)));
+    }
+    m_cam._releaseSet();
+    if (m_cbk)
+      m_cbk(ok, error);
+  }
+
+private:
+  Camera& m_cam;
+  std::string m_url;
+  Camera::AsyncCallback m_cbk;
+  std::promise<void> m_promise;
+};
+
+// Disarms the series chained in advance and then starts a queued PUT:
+// the thread starting the PUT does not wait for the DISARM
+class ChainedDisarmCallback : public Callback
+{
+  DEB_CLASS_NAMESPC(DebModCamera, "ChainedDisarmCallback", "Eiger");
+
+public:
+  ChainedDisarmCallback(CommandReq disarm_cmd, std::function<void()> next)
+    : m_disarm_cmd(disarm_cmd), m_next(next)
+  {}
+
+  void status_changed(eigerapi::CurlLoop::FutureRequest::Status status,
+		      std::string error)
+  {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR2(status, error);
+    // the command holds this callback: break the reference cycle
+    m_disarm_cmd.reset();
+    if (status != eigerapi::CurlLoop::FutureRequest::OK)
+      DEB_ERROR() << DEB_VAR1(error);
+    m_next();
+  }
+
+private:
+  CommandReq m_disarm_cmd;
+  std::function<void()> m_next;
+};
+
+// holds the Camera parameter PUT token, see Camera::_acquireSet
+class SerialSet
+{
+public:
+  SerialSet(Camera& cam) : m_cam(cam)
+  { m_cam._acquireSet(); }
+  ~SerialSet()
+  { m_cam._releaseSet(); }
+private:
+  Camera& m_cam;
+};
+
 /*----------------------------------------------------------------------------
 			    class Camera request helpers
  ----------------------------------------------------------------------------*/
@@ -56,8 +150,15 @@ public:
   CommandReq doSendCommandTimeout(eigerapi::Requests::COMMAND_NAME cmd,
 				  double timeout, DebObj *deb_ptr, A ack)
   {
-    DEB_FROM_PTR(deb_ptr);
     CommandReq req = m_requests->get_command(cmd);
+    return doWaitCommandTimeout(req, timeout, deb_ptr, ack);
+  }
+
+  template <typename A>
+  CommandReq doWaitCommandTimeout(CommandReq req, double timeout,
+				  DebObj *deb_ptr, A ack)
+  {
+    DEB_FROM_PTR(deb_ptr);
     try {
       req->wait(timeout);
     } catch(const eigerapi::EigerException &e) {
@@ -73,6 +174,9 @@ public:
 		      DebObj *deb_ptr, A ack)
   {
     DEB_FROM_PTR(deb_ptr);
+    m_cam._configChanged();
+    m_cam._disarmChained();
+    SerialSet serial(m_cam);
     ParamReq req = m_requests->set_param(param, value);
     try {
       req->wait();
@@ -83,6 +187,56 @@ public:
     return req;
   }
 
+  // the PUT is queued behind the one in progress (except on Eiger1).
+  // The completion is called from a separate thread, so it can start
+  // the next PUT and the user callback (if any) can send other requests.
+  // A series chained in advance is disarmed by an async DISARM sent
+  // before the PUT
+  template <typename T>
+  Camera::AsyncResult doSetParamAsync(eigerapi::Requests::PARAM_NAME param,
+				      T value, Camera::AsyncCallback cbk)
+  {
+    m_cam._configChanged();
+    std::shared_ptr<AsyncSetCallback> set_cbk(new AsyncSetCallback(m_cam,
+								   cbk));
+    Camera::AsyncResult result = set_cbk->get_future();
+    Camera *cam = &m_cam;
+    m_cam._queueSet([cam, param, value, set_cbk]() {
+	auto start = [cam, param, value, set_cbk]() {
+	  startSetParam(cam->m_requests, param, value, set_cbk);
+	};
+	if (!cam->_takeChainedArm()) {
+	  start();
+	  return;
+	}
+	try {
+	  CommandReq disarm_cmd = cam->m_requests->get_command(
+					eigerapi::Requests::DISARM);
+	  CallbackPtr disarm_cbk(new ChainedDisarmCallback(disarm_cmd, start));
+	  disarm_cmd->register_callback(disarm_cbk, true);
+	} catch (const eigerapi::EigerException& e) {
+	  set_cbk->finished(false, e.what());
+	}
+      });
+    return result;
+  }
+
+  // start a PUT whose completion is reported to set_cbk
+  template <typename T>
+  static void startSetParam(eigerapi::Requests *requests,
+			    eigerapi::Requests::PARAM_NAME param, T value,
+			    std::shared_ptr<AsyncSetCallback> set_cbk)
+  {
+    try {
+      ParamReq req = requests->set_param(param, value);
+      set_cbk->set_url(req->get_url());
+      CallbackPtr req_cbk(set_cbk);
+      req->register_callback(req_cbk, true);
+    } catch (const eigerapi::EigerException& e) {
+      set_cbk->finished(false, e.what());
+    }
+  }
+
   template <typename T, typename A>
   ParamReq doGetParam(eigerapi::Requests::PARAM_NAME param, T& value,
 		      DebObj *deb_ptr, A ack)
@@ -100,13 +254,16 @@ public:
   }
 
   template <typename A>
-  TransferReq doStartTransfer(std::string src_file_name, std::string dest_path,
-			      AutoMutex& lock, DebObj *deb_ptr, A ack)
+  TransferReq doStartTransfer(std::string src_file_name,
+			      const std::vector<std::string>& dest_paths,
+			      AutoMutex& lock, int nb_ranges, DebObj *deb_ptr,
+			      A ack)
   {
     DEB_FROM_PTR(deb_ptr);
     TransferReq req;
     try {
-      req = m_requests->start_transfer(src_file_name, dest_path);
+      req = m_requests->start_transfer(src_file_name, dest_paths, true,
+				       nb_ranges);
     } catch(eigerapi::EigerException& e) {
       Event *event = new Event(Hardware,Event::Error, Event::Saving,
 			       Event::SaveOpenError,e.what());
@@ -130,9 +287,21 @@ public:
 #define sendEigerCommandTimeout(cam, cmd, timeout)	\
   CameraRequest(cam).doSendCommandTimeout(cmd, timeout, DEB_PTR(), SuccessAck())
 
+#define startEigerCommand(cam, cmd)			\
+  CameraRequest(cam).m_requests->get_command(cmd)
+
+#define waitEigerCommand(cam, req)			\
+  waitEigerCommandTimeout(cam, req, eigerapi::CurlLoop::FutureRequest::TIMEOUT)
+
+#define waitEigerCommandTimeout(cam, req, timeout)	\
+  CameraRequest(cam).doWaitCommandTimeout(req, timeout, DEB_PTR(), SuccessAck())
+
 #define setEigerParam(cam, param, value)		\
   CameraRequest(cam).doSetParam(param, value, DEB_PTR(), SuccessAck())
 
+#define setEigerParamAsync(cam, param, value, cbk)	\
+  CameraRequest(cam).doSetParamAsync(param, value, cbk)
+
 #define setEigerCachedParam(cam, param, cache, value)	\
   setEigerCachedParamForce(cam, param, cache, value, false)
 
@@ -146,9 +315,13 @@ public:
 #define getEigerParam(cam, param, value)		\
   CameraRequest(cam).doGetParam(param, value, DEB_PTR(), SuccessAck())
 
-#define startEigerTransfer(cam, src_file_name, dest_path, lock)		\
-  CameraRequest(cam).doStartTransfer(src_file_name, dest_path, lock, DEB_PTR(),\
-				     SuccessAck())
+// dest_paths: primary target first, then its mirrors
+#define startEigerTransfer(cam, src_file_name, dest_paths, lock)		\
+  startEigerTransferRanges(cam, src_file_name, dest_paths, lock, -1)
+
+#define startEigerTransferRanges(cam, src_file_name, dest_paths, lock, ranges) \
+  CameraRequest(cam).doStartTransfer(src_file_name, dest_paths, lock, ranges, \
+				     DEB_PTR(), SuccessAck())
 
 
 /*----------------------------------------------------------------------------
@@ -173,21 +346,70 @@ public:
   void addGet(Name name, T& var)
   { add(name, m_cam.m_requests->get_param(name, var)); }
 
+  // only send the value if it differs from the cache, which is updated
+  // once the request succeeded. Except on Eiger1 the PUT is queued
+  // (see Camera::_queueSet) and waited for in wait()
+  template <typename T, typename V>
+  void addCachedSet(Name name, Camera::Cache<T>& cache, V value)
+  {
+    auto change_info(cache.change(value));
+    if (!change_info)
+      return;
+    m_cam._configChanged();
+    if (m_parallel) {
+      add(name, m_cam.m_requests->set_param(name, change_info.new_val));
+    } else {
+      std::shared_ptr<AsyncSetCallback> set_cbk(
+			new AsyncSetCallback(m_cam, Camera::AsyncCallback()));
+      m_results.push_back(set_cbk->get_future());
+      eigerapi::Requests *requests = m_cam.m_requests;
+      auto new_val = change_info.new_val;
+      m_cam._queueSet([requests, name, new_val, set_cbk]() {
+	  CameraRequest::startSetParam(requests, name, new_val, set_cbk);
+	});
+    }
+    m_acks.push_back([change_info]() mutable { change_info.succeeded(); });
+  }
+
   void wait()
   {
     if (m_parallel) {
       RequestList::const_iterator it, end = m_list.end();
       for (it = m_list.begin(); it != end; ++it)
 	wait(*it);
+    } else {
+      // all the queued PUTs are finished before the first error is thrown
+      std::exception_ptr error;
+      ResultList::iterator it, end = m_results.end();
+      for (it = m_results.begin(); it != end; ++it) {
+	try {
+	  it->get();
+	} catch (...) {
+	  if (!error)
+	    error = std::current_exception();
+	}
+      }
+      m_results.clear();
+      if (error)
+	std::rethrow_exception(error);
     }
+    AckList::iterator it, end = m_acks.end();
+    for (it = m_acks.begin(); it != end; ++it)
+      (*it)();
+    m_acks.clear();
   }
 
+  bool empty() const
+  { return m_list.empty() && m_results.empty(); }
+
   ParamReq operator [](Name name)
   { return m_map[name]; }
 
 private:
   typedef std::list<ParamReq> RequestList;
   typedef std::map<Name, ParamReq> RequestMap;
+  typedef std::list<std::function<void()> > AckList;
+  typedef std::list<Camera::AsyncResult> ResultList;
 
   void add(Name name, ParamReq req)
   {
@@ -216,6 +438,8 @@ private:
   bool m_parallel;
   RequestList m_list;
   RequestMap m_map;
+  ResultList m_results;
+  AckList m_acks;
 };
 
 } // namespace Eiger
@@ -26,8 +26,10 @@
 
 #include "EigerDecompress.h"
 #include "EigerStream.h"
+#include "EigerThreadPlacement.h"
 
 #include <eigerapi/Requests.h>
+#include <eigerapi/Trace.h>
 
 #include "processlib/LinkTask.h"
 #include "processlib/ProcessExceptions.h"
@@ -75,6 +77,8 @@ Data _DecompressTask::process(Data& out)
 {
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR1(out.frameNumber);
+  ThreadPlacement::registerPoolThread(ThreadPlacement::Decompress,
+				      "decompress");
   static const std::string plugin_key = "eiger_data";
   Data::SidebandContainer::Optional plugin_data = out.sideband.get(plugin_key);
   if (!plugin_data)
@@ -86,11 +90,41 @@ Data _DecompressTask::process(Data& out)
   img_data->getMsgDataNSize(msg_data, msg_size);
   int depth = img_data->decomp_fdim.getDepth();
   const Camera::CompressionType& type = img_data->comp_type;
-  bool expand = (out.depth() != depth);
   int nb_pixels = out.size() / out.depth();
+  bool decompress = (type != Camera::NoCompression);
+  DEB_TRACE() << DEB_VAR4(depth, out.depth(), type, decompress);
+  double trace_start = Trace::is_active() ? Trace::now() : 0;
+  img_data->decodeStarted();
+  Decompress::decode(msg_data, type, depth, out.data(), out.depth(), nb_pixels);
+  img_data->decodeDone();
+  if (trace_start > 0)
+    Trace::complete("decompress", "frame", trace_start, Trace::now(),
+		    out.frameNumber);
+
+  if(decompress) {
+    // out data is the decompressed image, add sideband compression blob
+    static const std::string comp_lz4 = "comp_lz4";
+    static const std::string comp_bs_lz4 = "comp_bshuffle_lz4";
+    const std::string& key = (type == Camera::LZ4) ? comp_lz4 : comp_bs_lz4;
+    std::shared_ptr<void> p(img_data->msg, msg_data);
+    sideband::BlobList blob_list{{p, msg_size}};
+    DEB_TRACE() << DEB_VAR2(key, blob_list.size());
+    out.sideband.insert(
+        key,
+        std::make_shared<sideband::CompressedData>(out.dimensions, depth, std::move(blob_list))
+    );
+  }
+
+  return out;
+}
+
+void Decompress::decode(void *msg_data, Camera::CompressionType type,
+			int depth,
+			void *dst, int dst_depth, int nb_pixels)
+{
+  bool expand = (dst_depth != depth);
   int size = nb_pixels * depth;
   bool decompress = (type != Camera::NoCompression);
-  DEB_TRACE() << DEB_VAR5(depth, out.depth(), expand, type, decompress);
   HeapPtr<void> aux_buffer;
   if(expand && decompress) {
     void *ptr;
@@ -98,7 +132,7 @@ Data _DecompressTask::process(Data& out)
       throw ProcessException("Can't allocate temporary memory");
     aux_buffer.reset(ptr);
   }
-  void *lima_buffer = out.data();
+  void *lima_buffer = dst;
   void *decompress_out = aux_buffer ? aux_buffer.get() : lima_buffer;
   int return_code = 0;
   if(type == Camera::LZ4) {
@@ -120,13 +154,13 @@ Data _DecompressTask::process(Data& out)
     char ErrorBuff[1024];
     snprintf(ErrorBuff,sizeof(ErrorBuff),
 	     "_DecompressTask: decompression failed, (error code: %d) (data size %d)",
-	     return_code,out.size());
+	     return_code,nb_pixels * dst_depth);
     throw ProcessException(ErrorBuff);
   }
 
   if(expand) {
     void *expand_src = decompress ? decompress_out : msg_data;
-    if(out.depth() == 2)
+    if(dst_depth == 2)
       _expand_8_to_16(expand_src, lima_buffer, nb_pixels);
     else if(depth == 1) 
       _expand_8_to_32(expand_src, lima_buffer, nb_pixels);
@@ -134,22 +168,6 @@ Data _DecompressTask::process(Data& out)
       _expand_16_to_32(expand_src, lima_buffer, nb_pixels);
   } else if(!decompress)
     memcpy(lima_buffer, msg_data, size);
-
-  if(decompress) {
-    // out data is the decompressed image, add sideband compression blob
-    static const std::string comp_lz4 = "comp_lz4";
-    static const std::string comp_bs_lz4 = "comp_bshuffle_lz4";
-    const std::string& key = (type == Camera::LZ4) ? comp_lz4 : comp_bs_lz4;
-    std::shared_ptr<void> p(img_data->msg, msg_data);
-    sideband::BlobList blob_list{{p, msg_size}};
-    DEB_TRACE() << DEB_VAR2(key, blob_list.size());
-    out.sideband.insert(
-        key,
-        std::make_shared<sideband::CompressedData>(out.dimensions, depth, std::move(blob_list))
-    );
-  }
-
-  return out;
 }
 
 Decompress::Decompress() :
@@ -27,6 +27,8 @@
 #include "lima/Debug.h"
 #include "lima/HwReconstructionCtrlObj.h"
 
+#include "EigerCamera.h"
+
 namespace lima
 {
   namespace Eiger
@@ -42,6 +44,12 @@ namespace lima
       virtual LinkTask* getReconstructionTask();
 
       void setActive(bool);
+
+      // decode nb_pixels of depth bytes from a stream message into dst,
+      // expanded to dst_depth if larger. Throws ProcessException
+      static void decode(void *msg_data, Camera::CompressionType type,
+			 int depth,
+			 void *dst, int dst_depth, int nb_pixels);
     private:
       LinkTask* m_decompress_task;
     };
@@ -29,7 +29,12 @@
 #include "EigerSavingCtrlObj.h"
 #include "EigerStream.h"
 #include "EigerDecompress.h"
+#include "EigerMetricsServer.h"
+#include "EigerMonitor.h"
+#include "EigerPerformanceLog.h"
 #include "EigerRoiCtrlObj.h"
+#include "EigerThreadPlacement.h"
+#include "lima/Timestamp.h"
 #include <unistd.h>
 
 using namespace lima;
@@ -40,8 +45,10 @@ using namespace std;
 //-----------------------------------------------------
 // @brief Ctor
 //-----------------------------------------------------
-Interface::Interface(Camera& cam,const char* mmap_file) :
-m_cam(cam)
+Interface::Interface(Camera& cam,const char* mmap_file,
+		     long long hugepage_size,int numa_node) :
+m_cam(cam),
+m_filewriter_stream(false)
 {
   DEB_CONSTRUCTOR();
   m_det_info = new DetInfoCtrlObj(cam);
@@ -63,13 +70,22 @@ m_cam(cam)
   m_event = new EventCtrlObj(cam);
   m_cap_list.push_back(HwCap(m_event));
 
-  m_stream = new Stream(cam,mmap_file);
+  m_stream = new Stream(cam,mmap_file,hugepage_size,numa_node);
   
   HwBufferCtrlObj* buffer = m_stream->getBufferCtrlObj();
   m_cap_list.push_back(HwCap(buffer));	
 
   m_decompress = new Decompress();
   m_cap_list.push_back(HwCap(m_decompress));
+
+  m_monitor = new Monitor(cam);
+
+  m_metrics = new MetricsServer();
+
+  m_perf_log = new PerformanceLog(cam);
+  auto series_end = [this](bool ok) { _logAcquisition(ok); };
+  m_stream->setSeriesEndCallback(series_end);
+  m_saving->setSeriesEndCallback(series_end);
 }
 
 //-----------------------------------------------------
@@ -84,6 +100,9 @@ Interface::~Interface()
     delete m_saving;
     delete m_stream;
     delete m_decompress;
+    delete m_monitor;
+    delete m_metrics;
+    delete m_perf_log;
 }
 
 //-----------------------------------------------------
@@ -114,6 +133,16 @@ void Interface::prepareAcq()
     DEB_MEMBER_FUNCT();
 
     bool use_filewriter = m_saving->isActive(); 
+    bool use_stream = !use_filewriter;
+    if (use_filewriter) {
+      AutoMutex lock(m_prepare_lock);
+      use_stream = m_filewriter_stream;
+    }
+    // the previous acquisition did not end normally
+    _logAcquisition(false);
+
+    PrepareTiming timing;
+    Timestamp t0 = Timestamp::now();
 
     if (m_cam.getStatus() == Camera::Armed) {
       m_cam.disarm();
@@ -123,30 +152,48 @@ void Interface::prepareAcq()
       if (use_filewriter)
 	usleep(2e6);
     }
-    // in case of previous acq. aborted, the last file is still on the DCU
-    // clear the DCU storage to prevent a new acquistion with same file prefix
-    // to transfer the old file.
-    if (use_filewriter)
-      m_cam.deleteMemoryFiles();
-	
-    m_stream->setActive(!use_filewriter);
-    m_decompress->setActive(!use_filewriter);
+    timing.disarm = Timestamp::now() - t0;
 
-    m_stream->resetStatistics();
+    // the stream is (de)activated while the detector parameters are sent,
+    // the Camera lock is released meanwhile
+    auto stream_setup = [&]() {
+      Timestamp t = Timestamp::now();
+      m_stream->setFileWriterActive(use_filewriter);
+      m_stream->setActive(use_stream);
+      m_decompress->setActive(use_stream);
+      m_stream->resetStatistics();
+      timing.stream = Timestamp::now() - t;
+    };
 
     try {
-      m_cam.prepareAcq();
+      // in case of previous acq. aborted, the last file is still on the DCU
+      // clear the DCU storage to prevent a new acquistion with same file prefix
+      // to transfer the old file.
+      m_cam._prepareAcq(use_filewriter, stream_setup, timing);
       int serie_id; m_cam.getSerieId(serie_id);
       m_saving->setSerieId(serie_id);
-      if (!use_filewriter) {
+      // the written frames are reported in the Lima frame numbers
+      int lima_decimation = 1;
+      if (use_filewriter && use_stream)
+	m_stream->getLimaDecimation(lima_decimation);
+      m_saving->setLimaDecimation(lima_decimation);
+      if (use_stream) {
+	Timestamp t = Timestamp::now();
 	double stream_armed_timeout = 5.0;
-	m_stream->waitArmed(stream_armed_timeout);
+	m_stream->waitArmed(stream_armed_timeout, serie_id);
+	timing.stream_armed = Timestamp::now() - t;
       }
     } catch (...) {
       m_saving->stop();
       m_stream->stop();
       throw;
     }
+
+    timing.total = Timestamp::now() - t0;
+    DEB_TRACE() << DEB_VAR1(timing);
+    AutoMutex lock(m_prepare_lock);
+    m_prepare_timing = timing;
+    m_prepare_start = t0;
 }
 
 //-----------------------------------------------------
@@ -161,11 +208,40 @@ void Interface::startAcq()
     m_cam.getNbTriggeredFrames(nb_trig_frames);
     // start data retrieval subsystems only in first call
     if ((trig_mode != IntTrigMult) || (nb_trig_frames == 0)) {
-      // either we use eiger saving or the raw stream
+      // eiger saving, the raw stream or both
       if(m_saving->isActive())
 	m_saving->start();
-      else
+      if(m_stream->isActive())
 	m_stream->start();
+
+      // the configuration is read here: the series end is reported
+      // by the acquisition threads
+      if (m_perf_log->isActive()) {
+	PerformanceLog::Record record;
+	bool use_filewriter = m_saving->isActive();
+	bool use_stream = m_stream->isActive();
+	record.mode = !use_filewriter ? "stream" :
+		      use_stream ? "filewriter+stream" : "filewriter";
+	m_cam.getSerieId(record.serie_id);
+	m_cam.getDetectorModel(record.detector_model);
+	m_cam.getDetectorType(record.detector_type);
+	m_cam.getApiVersion(record.api_version);
+	m_cam.getImageType(record.image_type);
+	m_cam.getCompressionType(record.compression);
+	record.trig_mode = trig_mode;
+	m_cam.getNbFrames(record.nb_frames);
+	m_cam.getExpTime(record.exp_time);
+	double lat_time;
+	m_cam.getLatTime(lat_time);
+	record.frame_time = record.exp_time + lat_time;
+	{
+	  AutoMutex lock(m_prepare_lock);
+	  record.start = m_prepare_start;
+	  record.prepare = m_prepare_timing;
+	}
+	record.acq_start = Timestamp::now();
+	m_perf_log->acqStarted(record);
+      }
     }
 
     m_cam.startAcq();
@@ -213,7 +289,11 @@ void Interface::getStatus(StatusType& status)
 	      switch(saving_status)
 		{
 		case SavingCtrlObj::IDLE:
-		  status.set(HwInterface::StatusType::Ready);break;
+		  if (m_stream->isRunning())
+		    status.set(HwInterface::StatusType::Readout);
+		  else
+		    status.set(HwInterface::StatusType::Ready);
+		  break;
 		case SavingCtrlObj::RUNNING:
 		  status.set(HwInterface::StatusType::Readout);break;
 		default:
@@ -270,6 +350,196 @@ void Interface::latchStreamStatistics(StreamStatistics& stat, bool reset)
      m_stream->latchStatistics(stat, reset);
 }
 
+void Interface::latchTransferStatistics(TransferStatistics& stat, bool reset)
+{
+     DEB_MEMBER_FUNCT();
+     m_saving->latchStatistics(stat, reset);
+}
+
+void Interface::setMirrorDirectories(const std::list<std::string>& dirs)
+{
+     DEB_MEMBER_FUNCT();
+     m_saving->setMirrorDirectories(dirs);
+}
+
+void Interface::getMirrorDirectories(std::list<std::string>& dirs)
+{
+     DEB_MEMBER_FUNCT();
+     m_saving->getMirrorDirectories(dirs);
+}
+
+void Interface::setFileWriterStream(bool enabled)
+{
+     DEB_MEMBER_FUNCT();
+     DEB_PARAM() << DEB_VAR1(enabled);
+     AutoMutex lock(m_prepare_lock);
+     m_filewriter_stream = enabled;
+}
+
+void Interface::getFileWriterStream(bool& enabled)
+{
+     DEB_MEMBER_FUNCT();
+     AutoMutex lock(m_prepare_lock);
+     enabled = m_filewriter_stream;
+     DEB_RETURN() << DEB_VAR1(enabled);
+}
+
+void Interface::setStreamDecimation(int decimation)
+{
+     DEB_MEMBER_FUNCT();
+     m_stream->setDecimation(decimation);
+}
+
+void Interface::getStreamDecimation(int& decimation)
+{
+     DEB_MEMBER_FUNCT();
+     m_stream->getDecimation(decimation);
+}
+
+void Interface::setMonitorRate(double rate)
+{
+     DEB_MEMBER_FUNCT();
+     m_monitor->setRate(rate);
+}
+
+void Interface::getMonitorRate(double& rate)
+{
+     DEB_MEMBER_FUNCT();
+     m_monitor->getRate(rate);
+}
+
+void Interface::getMonitorImage(Data& image)
+{
+     DEB_MEMBER_FUNCT();
+     m_monitor->getLastImage(image);
+}
+
+void Interface::setStreamPreviewRate(double max_rate)
+{
+     DEB_MEMBER_FUNCT();
+     m_stream->setPreviewRate(max_rate);
+}
+
+void Interface::getStreamPreviewRate(double& max_rate)
+{
+     DEB_MEMBER_FUNCT();
+     m_stream->getPreviewRate(max_rate);
+}
+
+void Interface::setStreamPreviewBinning(int bin)
+{
+     DEB_MEMBER_FUNCT();
+     m_stream->setPreviewBinning(bin);
+}
+
+void Interface::getStreamPreviewBinning(int& bin)
+{
+     DEB_MEMBER_FUNCT();
+     m_stream->getPreviewBinning(bin);
+}
+
+void Interface::getStreamPreviewImage(Data& image)
+{
+     DEB_MEMBER_FUNCT();
+     m_stream->getPreviewImage(image);
+}
+
+void Interface::getStreamBackpressureHistory(Data& history)
+{
+     DEB_MEMBER_FUNCT();
+     m_stream->getBackpressureHistory(history);
+}
+
+void Interface::setThreadCpus(const std::string& thread_class,
+			      const std::string& cpus)
+{
+     DEB_MEMBER_FUNCT();
+     ThreadPlacement::ThreadClass cls;
+     cls = ThreadPlacement::getThreadClass(thread_class);
+     ThreadPlacement::setCpus(cls, cpus);
+}
+
+void Interface::getThreadCpus(const std::string& thread_class,
+			      std::string& cpus)
+{
+     DEB_MEMBER_FUNCT();
+     ThreadPlacement::ThreadClass cls;
+     cls = ThreadPlacement::getThreadClass(thread_class);
+     ThreadPlacement::getCpus(cls, cpus);
+}
+
+void Interface::setReceiveFifoPriority(int priority)
+{
+     DEB_MEMBER_FUNCT();
+     ThreadPlacement::setReceiveFifoPriority(priority);
+}
+
+void Interface::getReceiveFifoPriority(int& priority)
+{
+     DEB_MEMBER_FUNCT();
+     ThreadPlacement::getReceiveFifoPriority(priority);
+}
+
+void Interface::getThreadPlacement(std::list<std::string>& placement)
+{
+     DEB_MEMBER_FUNCT();
+     ThreadPlacement::getPlacement(placement);
+}
+
+void Interface::getLastPrepareTiming(PrepareTiming& timing)
+{
+     DEB_MEMBER_FUNCT();
+     AutoMutex lock(m_prepare_lock);
+     timing = m_prepare_timing;
+}
+
+void Interface::setPerformanceLogPath(const std::string& path)
+{
+     DEB_MEMBER_FUNCT();
+     m_perf_log->setPath(path);
+}
+
+void Interface::getPerformanceLogPath(std::string& path)
+{
+     DEB_MEMBER_FUNCT();
+     m_perf_log->getPath(path);
+}
+
+void Interface::setMetricsPort(int port)
+{
+     DEB_MEMBER_FUNCT();
+     m_metrics->setPort(port);
+}
+
+void Interface::getMetricsPort(int& port)
+{
+     DEB_MEMBER_FUNCT();
+     m_metrics->getPort(port);
+}
+
+//-----------------------------------------------------
+// @brief complete the record of the started acquisition
+// with its statistics and queue it. Called from the Zmq
+// or download threads, only lock-free or local locks
+//-----------------------------------------------------
+void Interface::_logAcquisition(bool ok)
+{
+     DEB_MEMBER_FUNCT();
+     DEB_PARAM() << DEB_VAR1(ok);
+     PerformanceLog::Record record;
+     if (!m_perf_log->acqEnded(record))
+       return;
+
+     record.end = Timestamp::now();
+     record.ok = ok;
+     m_cam.getNbHwAcquiredFrames(record.nb_acquired);
+     m_stream->latchStatistics(record.stream);
+     m_saving->latchStatistics(record.transfer);
+     m_cam.getTriggerLatency(record.trigger_latency);
+     m_cam._getFirstFrameLatency(record.first_frame_latency);
+     m_perf_log->add(record);
+}
+
 //-----------------------------------------------------
 // @brief return true if the detector model support HW ROI
 //-----------------------------------------------------
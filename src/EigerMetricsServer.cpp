@@ -0,0 +1,253 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9 
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <eigerapi/Metrics.h>
+
+#include "EigerMetricsServer.h"
+#include "EigerThreadPlacement.h"
+#include "lima/Exceptions.h"
+
+using namespace lima;
+using namespace lima::Eiger;
+using namespace eigerapi;
+
+//		      --- Server thread ---
+class MetricsServer::_ServerThread : public Thread
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"MetricsServer::_ServerThread","Eiger");
+
+public:
+  _ServerThread(MetricsServer& server) : m_server(server) { start(); }
+
+protected:
+  virtual void threadFunction();
+
+private:
+  MetricsServer&	m_server;
+};
+
+void MetricsServer::_ServerThread::threadFunction()
+{
+  DEB_MEMBER_FUNCT();
+  ThreadPlacement::Registration placement(ThreadPlacement::Polling,
+					  "metrics server");
+
+  Cond& cond = m_server.m_cond;
+  AutoMutex lock(cond.mutex());
+  while (!m_server.m_quit) {
+    int listen_fd = m_server.m_listen_fd;
+    m_server.m_polled_fd = listen_fd;
+    cond.broadcast();
+
+    AutoMutexUnlock u(lock);
+    struct pollfd fds[2];
+    fds[0].fd = m_server.m_pipes[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = listen_fd;
+    fds[1].events = POLLIN;
+    int nb_fds = (listen_fd >= 0) ? 2 : 1;
+    if (poll(fds, nb_fds, -1) < 0) {
+      if (errno != EINTR)
+	DEB_ERROR() << "poll: " << strerror(errno);
+      continue;
+    }
+    if (fds[0].revents) {
+      char buffer[16];
+      if (read(m_server.m_pipes[0], buffer, sizeof(buffer)) < 0)
+	DEB_ERROR() << "Something wrong happened!";
+    } else if ((nb_fds > 1) && fds[1].revents) {
+      int fd = accept(listen_fd, NULL, NULL);
+      if (fd >= 0) {
+	m_server._serve(fd);
+	close(fd);
+      }
+    }
+  }
+  m_server.m_polled_fd = -1;
+  cond.broadcast();
+}
+
+//		      --- MetricsServer class ---
+const double MetricsServer::REQUEST_TIMEOUT = 1.0;
+
+MetricsServer::MetricsServer() :
+  m_port(0),
+  m_listen_fd(-1),
+  m_polled_fd(-1),
+  m_quit(false)
+{
+  DEB_CONSTRUCTOR();
+  if (pipe(m_pipes))
+    THROW_HW_ERROR(Error) << "Can't open pipe";
+  m_thread.reset(new _ServerThread(*this));
+}
+
+MetricsServer::~MetricsServer()
+{
+  DEB_DESTRUCTOR();
+  {
+    AutoMutex lock(m_cond.mutex());
+    m_quit = true;
+    _wakeUp();
+  }
+  m_thread->join();
+  if (m_listen_fd >= 0)
+    close(m_listen_fd);
+  close(m_pipes[0]), close(m_pipes[1]);
+}
+
+void MetricsServer::setPort(int port)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(port);
+  if ((port < 0) || (port > 65535))
+    THROW_HW_ERROR(InvalidValue) << "Invalid metrics port: " << port;
+
+  AutoMutex lock(m_cond.mutex());
+  if (port == m_port)
+    return;
+  int listen_fd = port ? _listen(port) : -1;
+  int prev_fd = m_listen_fd;
+  m_listen_fd = listen_fd;
+  m_port = port;
+  // the previous socket is closed once the thread stopped polling it
+  _wakeUp();
+  while ((prev_fd >= 0) && (m_polled_fd == prev_fd))
+    m_cond.wait();
+  if (prev_fd >= 0)
+    close(prev_fd);
+}
+
+void MetricsServer::getPort(int& port) const
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_cond.mutex());
+  port = m_port;
+  DEB_RETURN() << DEB_VAR1(port);
+}
+
+void MetricsServer::render(std::string& text)
+{
+  Metrics::render(text);
+
+  std::list<ThreadPlacement::CpuTime> cpu_times;
+  ThreadPlacement::getCpuTimes(cpu_times);
+  const std::string name = "eiger_thread_cpu_seconds_total";
+  text += "# HELP " + name + " CPU time consumed by the plugin threads\n";
+  text += "# TYPE " + name + " counter\n";
+  std::list<ThreadPlacement::CpuTime>::const_iterator i;
+  for (i = cpu_times.begin(); i != cpu_times.end(); ++i) {
+    const char *cls = ThreadPlacement::getThreadClassName(i->cls);
+    std::string labels = std::string("class=\"") + cls + "\"," +
+			 "name=\"" + Metrics::escape(i->name) + "\"";
+    Metrics::render_sample(text, name, labels, i->seconds);
+  }
+}
+
+int MetricsServer::_listen(int port)
+{
+  DEB_MEMBER_FUNCT();
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    THROW_HW_ERROR(Error) << "Can't create metrics socket: "
+			  << strerror(errno);
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) ||
+      listen(fd, 4)) {
+    int error = errno;
+    close(fd);
+    THROW_HW_ERROR(Error) << "Can't listen on 127.0.0.1:" << port << ": "
+			  << strerror(error);
+  }
+  return fd;
+}
+
+// one request per connection, read until the end of the headers
+void MetricsServer::_serve(int fd)
+{
+  DEB_MEMBER_FUNCT();
+  std::string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == std::string::npos) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if ((poll(&pfd, 1, int(REQUEST_TIMEOUT * 1000)) <= 0) ||
+	(request.size() > 8192))
+      return;
+    ssize_t nb_read = read(fd, buffer, sizeof(buffer));
+    if (nb_read <= 0)
+      return;
+    request.append(buffer, nb_read);
+  }
+
+  std::string request_line = request.substr(0, request.find("\r\n"));
+  DEB_TRACE() << DEB_VAR1(request_line);
+  std::string status, body;
+  if ((request_line.compare(0, 13, "GET /metrics ") == 0) ||
+      (request_line.compare(0, 13, "GET /metrics?") == 0)) {
+    status = "200 OK";
+    render(body);
+  } else {
+    status = "404 Not Found";
+    body = "Not found, the metrics are on /metrics\n";
+  }
+
+  std::string response = "HTTP/1.1 " + status + "\r\n"
+    "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+    "Content-Length: " + std::to_string(body.size()) + "\r\n"
+    "Connection: close\r\n\r\n" + body;
+  const char *data = response.data();
+  size_t len = response.size();
+  while (len > 0) {
+    ssize_t written = send(fd, data, len, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR)
+	continue;
+      DEB_WARNING() << "Metrics response: " << strerror(errno);
+      return;
+    }
+    data += written, len -= written;
+  }
+}
+
+void MetricsServer::_wakeUp()
+{
+  DEB_MEMBER_FUNCT();
+  if (write(m_pipes[1], "|", 1) == -1)
+    DEB_ERROR() << "Something wrong happened!";
+}
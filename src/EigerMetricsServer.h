@@ -0,0 +1,76 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9 
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERMETRICSSERVER_H
+#define EIGERMETRICSSERVER_H
+
+#include <memory>
+#include <string>
+
+#include "lima/Debug.h"
+#include "lima/ThreadUtils.h"
+
+namespace lima
+{
+  namespace Eiger
+  {
+    // Local Prometheus endpoint: GET /metrics returns the process
+    // metrics (eigerapi::Metrics) and the CPU time of the plugin threads
+    // in the text exposition format. It only listens on 127.0.0.1 and
+    // serves one request at a time from its own thread
+    class MetricsServer
+    {
+      DEB_CLASS_NAMESPC(DebModCamera,"MetricsServer","Eiger");
+    public:
+      MetricsServer();
+      ~MetricsServer();
+
+      // 0 (default) disables the endpoint
+      void setPort(int port);
+      void getPort(int& port) const;
+
+      static void render(std::string& text);
+
+    private:
+      class _ServerThread;
+      friend class _ServerThread;
+
+      static const double REQUEST_TIMEOUT;
+
+      int _listen(int port);
+      void _serve(int fd);
+      void _wakeUp();
+
+      mutable Cond	m_cond;
+      int		m_port;
+      int		m_listen_fd;
+      // the socket the thread is polling, closed once released
+      int		m_polled_fd;
+      int		m_pipes[2];
+      bool		m_quit;
+
+      std::unique_ptr<_ServerThread> m_thread;
+    };
+  }
+}
+#endif	// EIGERMETRICSSERVER_H
@@ -0,0 +1,294 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9 
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <endian.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "EigerCameraRequests.h"
+#include "EigerMonitor.h"
+#include "EigerTestHooks.h"
+#include "EigerThreadPlacement.h"
+#include "lima/Exceptions.h"
+
+using namespace lima;
+using namespace lima::Eiger;
+using namespace eigerapi;
+
+typedef Requests::MonitorImageReq MonitorImageReq;
+
+//		      --- Poll thread ---
+class Monitor::_PollThread : public Thread
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"Monitor::_PollThread","Eiger");
+
+public:
+  _PollThread(Monitor& monitor) : m_monitor(monitor) { start(); }
+
+protected:
+  virtual void threadFunction();
+
+private:
+  Monitor&		m_monitor;
+};
+
+void Monitor::_PollThread::threadFunction()
+{
+  DEB_MEMBER_FUNCT();
+  ThreadPlacement::Registration placement(ThreadPlacement::Polling,
+					  "monitor polling");
+
+  Cond& cond = m_monitor.m_cond;
+  AutoMutex lock(cond.mutex());
+  Timestamp next_fetch = Timestamp::now();
+  while (!m_monitor.m_quit) {
+    if (m_monitor.m_rate <= 0) {
+      cond.wait();
+      next_fetch = Timestamp::now();
+      continue;
+    }
+    // woken up by a rate change or the quit
+    double delay = next_fetch - Timestamp::now();
+    if (delay > 0) {
+      cond.wait(delay);
+      continue;
+    }
+    next_fetch = Timestamp::now() + 1 / m_monitor.m_rate;
+
+    Data image;
+    bool ok;
+    {
+      AutoMutexUnlock u(lock);
+      ok = m_monitor._fetchImage(image);
+    }
+    if (ok && (m_monitor.m_rate > 0)) {
+      image.frameNumber = m_monitor.m_nb_images++;
+      m_monitor.m_last_image = image;
+    }
+  }
+}
+
+//			 --- Monitor class ---
+Monitor::Monitor(Camera& cam) :
+  m_cam(cam),
+  m_rate(0),
+  m_quit(false),
+  m_nb_images(0)
+{
+  DEB_CONSTRUCTOR();
+  m_thread.reset(new _PollThread(*this));
+}
+
+Monitor::~Monitor()
+{
+  DEB_DESTRUCTOR();
+  {
+    AutoMutex lock(m_cond.mutex());
+    m_quit = true;
+    m_cond.broadcast();
+  }
+  m_thread->join();
+}
+
+void Monitor::setRate(double rate)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(rate);
+  if (rate < 0)
+    THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(rate);
+
+  AutoMutex lock(m_cond.mutex());
+  bool enabled = (rate > 0);
+  if (enabled != (m_rate > 0)) {
+    _setMonitorMode(enabled);
+    m_last_image = Data();
+    m_nb_images = 0;
+    m_last_error.clear();
+  }
+  m_rate = rate;
+  m_cond.broadcast();
+}
+
+void Monitor::getRate(double& rate) const
+{
+  AutoMutex lock(m_cond.mutex());
+  rate = m_rate;
+}
+
+void Monitor::getLastImage(Data& image) const
+{
+  AutoMutex lock(m_cond.mutex());
+  image = m_last_image;
+}
+
+void Monitor::_setMonitorMode(bool enabled)
+{
+  DEB_MEMBER_FUNCT();
+  std::string enable_str = enabled ? "enabled" : "disabled";
+  DEB_TRACE() << "MONITOR_MODE:" << DEB_VAR1(enable_str);
+  setEigerCachedParam(m_cam,Requests::MONITOR_MODE,m_mode_str,enable_str);
+}
+
+bool Monitor::_fetchImage(Data& image)
+{
+  DEB_MEMBER_FUNCT();
+  MonitorImageReq req = m_cam.m_requests->get_monitor_image();
+  std::string error;
+  try {
+    req->wait();
+    _decodeTiff(req->get_data(), image);
+  } catch (const eigerapi::EigerException& e) {
+    // no image yet is a 404, the request is finished anyway
+    m_cam.m_requests->cancel(req);
+    error = req->get_url() + ":" + e.what();
+  } catch (Exception& e) {
+    error = e.getErrMsg();
+  }
+
+  AutoMutex lock(m_cond.mutex());
+  if (!error.empty() && (error != m_last_error))
+    DEB_WARNING() << "Monitor image: " << error;
+  m_last_error = error;
+  return error.empty();
+}
+
+// The DCU serves uncompressed single strip or multi strip TIFF images
+void Monitor::_decodeTiff(const std::vector<char>& tiff, Data& image)
+{
+  DEB_STATIC_FUNCT();
+
+  const unsigned char *p = (const unsigned char *) tiff.data();
+  size_t size = tiff.size();
+  if ((size < 8) || ((p[0] != 'I') && (p[0] != 'M')) || (p[1] != p[0]))
+    THROW_HW_ERROR(Error) << "Invalid TIFF header";
+  bool little = (p[0] == 'I');
+
+  auto check = [&](size_t offset, size_t len) {
+    if ((offset > size) || (len > size - offset))
+      THROW_HW_ERROR(Error) << "Truncated TIFF";
+  };
+  auto read16 = [&](size_t offset) -> unsigned int {
+    check(offset, 2);
+    return little ? (p[offset] | (p[offset + 1] << 8)) :
+		    ((p[offset] << 8) | p[offset + 1]);
+  };
+  auto read32 = [&](size_t offset) -> unsigned int {
+    unsigned int lo = read16(offset + (little ? 0 : 2));
+    unsigned int hi = read16(offset + (little ? 2 : 0));
+    return lo | (hi << 16);
+  };
+  if (read16(2) != 42)
+    THROW_HW_ERROR(Error) << "Invalid TIFF magic number";
+
+  // first IFD only: tag -> values (SHORT or LONG)
+  std::map<int, std::vector<unsigned int> > tags;
+  size_t ifd = read32(4);
+  int nb_entries = read16(ifd);
+  for (int i = 0; i < nb_entries; ++i) {
+    size_t entry = ifd + 2 + i * 12;
+    int tag = read16(entry), type = read16(entry + 2);
+    unsigned int count = read32(entry + 4);
+    if ((type != 3) && (type != 4))
+      continue;
+    size_t item_size = (type == 3) ? 2 : 4;
+    size_t values = entry + 8;
+    if (count * item_size > 4)
+      values = read32(values);
+    check(values, count * item_size);
+    std::vector<unsigned int>& v = tags[tag];
+    for (unsigned int j = 0; j < count; ++j)
+      v.push_back((type == 3) ? read16(values + j * 2) :
+				read32(values + j * 4));
+  }
+  auto get = [&](int tag, unsigned int def) {
+    auto t = tags.find(tag);
+    return ((t != tags.end()) && !t->second.empty()) ? t->second[0] : def;
+  };
+
+  enum { WIDTH = 256, HEIGHT = 257, BITS = 258, COMPRESSION = 259,
+	 STRIP_OFFSETS = 273, SAMPLES = 277, STRIP_BYTES = 279,
+	 SAMPLE_FORMAT = 339 };
+  unsigned int width = get(WIDTH, 0), height = get(HEIGHT, 0);
+  unsigned int bits = get(BITS, 1), format = get(SAMPLE_FORMAT, 1);
+  if ((get(COMPRESSION, 1) != 1) || (get(SAMPLES, 1) != 1))
+    THROW_HW_ERROR(NotSupported) << "Compressed or multi-sample TIFF";
+
+  Data::TYPE type;
+  if ((bits == 8) && (format == 1))
+    type = Data::UINT8;
+  else if ((bits == 8) && (format == 2))
+    type = Data::INT8;
+  else if ((bits == 16) && (format == 1))
+    type = Data::UINT16;
+  else if ((bits == 16) && (format == 2))
+    type = Data::INT16;
+  else if ((bits == 32) && (format == 1))
+    type = Data::UINT32;
+  else if ((bits == 32) && (format == 2))
+    type = Data::INT32;
+  else if ((bits == 32) && (format == 3))
+    type = Data::FLOAT;
+  else
+    THROW_HW_ERROR(NotSupported) << "TIFF " << DEB_VAR2(bits, format);
+
+  const std::vector<unsigned int>& offsets = tags[STRIP_OFFSETS];
+  const std::vector<unsigned int>& byte_counts = tags[STRIP_BYTES];
+  size_t depth = bits / 8;
+  size_t data_size = size_t(width) * height * depth;
+  if (!data_size || offsets.empty() || (offsets.size() != byte_counts.size()))
+    THROW_HW_ERROR(Error) << "Invalid TIFF image: "
+			  << DEB_VAR3(width, height, offsets.size());
+
+  Buffer *buffer = new Buffer(data_size);
+  image.type = type;
+  image.dimensions.clear();
+  image.dimensions.push_back(width);
+  image.dimensions.push_back(height);
+  image.timestamp = Timestamp::now();
+  image.setBuffer(buffer);
+  buffer->unref();
+
+  char *dst = (char *) image.data();
+  size_t filled = 0;
+  for (unsigned int i = 0; i < offsets.size(); ++i) {
+    size_t len = std::min<size_t>(byte_counts[i], data_size - filled);
+    check(offsets[i], len);
+    memcpy(dst + filled, p + offsets[i], len);
+    filled += len;
+  }
+  if (filled != data_size)
+    THROW_HW_ERROR(Error) << "TIFF strips too short: "
+			  << DEB_VAR2(filled, data_size);
+
+  bool host_little = (htole16(0x1234) == 0x1234);
+  if ((depth > 1) && (little != host_little)) {
+    for (size_t i = 0; i < data_size; i += depth)
+      std::reverse(dst + i, dst + i + depth);
+  }
+}
+
+void TestHooks::decodeMonitorTiff(const std::vector<char>& tiff, Data& image)
+{
+  Monitor::_decodeTiff(tiff, image);
+}
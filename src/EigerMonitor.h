@@ -0,0 +1,79 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9 
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERMONITOR_H
+#define EIGERMONITOR_H
+
+#include "lima/Debug.h"
+#include "processlib/Data.h"
+
+#include "EigerCamera.h"
+
+namespace lima
+{
+  namespace Eiger
+  {
+    // Low rate live preview through the DCU monitor interface: the
+    // last image is fetched periodically and decoded once into its own
+    // buffer, no Lima frame buffer is used
+    class Monitor
+    {
+      DEB_CLASS_NAMESPC(DebModCamera,"Monitor","Eiger");
+    public:
+      Monitor(Camera& cam);
+      ~Monitor();
+
+      // preview rate (Hz), 0 disables the DCU monitor
+      void setRate(double rate);
+      void getRate(double& rate) const;
+
+      // empty if none yet. The frameNumber counts the images
+      // fetched since the monitor was enabled
+      void getLastImage(Data& image) const;
+
+    private:
+      class _PollThread;
+      friend class _PollThread;
+      friend class TestHooks;
+
+      template <typename T>
+      using Cache = Camera::Cache<T>;
+
+      void _setMonitorMode(bool enabled);
+      bool _fetchImage(Data& image);
+      static void _decodeTiff(const std::vector<char>& tiff, Data& image);
+
+      Camera&		m_cam;
+      mutable Cond	m_cond;
+      double		m_rate;
+      bool		m_quit;
+      Cache<std::string> m_mode_str;
+      Data		m_last_image;
+      int		m_nb_images;
+      std::string	m_last_error;
+
+      std::unique_ptr<_PollThread> m_thread;
+    };
+  }
+}
+#endif	// EIGERMONITOR_H
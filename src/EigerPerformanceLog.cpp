@@ -0,0 +1,312 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9 
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include <json/json.h>
+
+#include "EigerPerformanceLog.h"
+#include "EigerThreadPlacement.h"
+#include "lima/Exceptions.h"
+
+using namespace lima;
+using namespace lima::Eiger;
+
+//		      --- Writer thread ---
+class PerformanceLog::_WriterThread : public Thread
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"PerformanceLog::_WriterThread","Eiger");
+
+public:
+  _WriterThread(PerformanceLog& log) : m_log(log) { start(); }
+
+protected:
+  virtual void threadFunction();
+
+private:
+  PerformanceLog&	m_log;
+};
+
+void PerformanceLog::_WriterThread::threadFunction()
+{
+  DEB_MEMBER_FUNCT();
+  ThreadPlacement::Registration placement(ThreadPlacement::Polling,
+					  "performance log");
+
+  Cond& cond = m_log.m_cond;
+  AutoMutex lock(cond.mutex());
+  while (true) {
+    while (!m_log.m_quit && m_log.m_records.empty())
+      cond.wait();
+    if (m_log.m_records.empty())	// quit once drained
+      break;
+
+    Record record(std::move(m_log.m_records.front()));
+    m_log.m_records.pop_front();
+    std::string path = m_log.m_path;
+    if (path.empty())
+      continue;
+    AutoMutexUnlock u(lock);
+    m_log._write(path, record);
+  }
+}
+
+//		      --- PerformanceLog class ---
+PerformanceLog::PerformanceLog(Camera& cam) :
+  m_cam(cam),
+  m_quit(false),
+  m_pending(false)
+{
+  DEB_CONSTRUCTOR();
+  m_thread.reset(new _WriterThread(*this));
+}
+
+PerformanceLog::~PerformanceLog()
+{
+  DEB_DESTRUCTOR();
+  {
+    AutoMutex lock(m_cond.mutex());
+    m_quit = true;
+    m_cond.broadcast();
+  }
+  m_thread->join();
+}
+
+void PerformanceLog::setPath(const std::string& path)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(path);
+  AutoMutex lock(m_cond.mutex());
+  m_path = path;
+}
+
+void PerformanceLog::getPath(std::string& path) const
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_cond.mutex());
+  path = m_path;
+  DEB_RETURN() << DEB_VAR1(path);
+}
+
+bool PerformanceLog::isActive() const
+{
+  AutoMutex lock(m_cond.mutex());
+  return !m_path.empty();
+}
+
+void PerformanceLog::acqStarted(Record& record)
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_cond.mutex());
+  m_started = record;
+  m_pending = true;
+}
+
+bool PerformanceLog::acqEnded(Record& record)
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_cond.mutex());
+  bool pending = m_pending;
+  if (pending)
+    record = m_started;
+  m_pending = false;
+  DEB_RETURN() << DEB_VAR1(pending);
+  return pending;
+}
+
+void PerformanceLog::add(Record& record)
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_cond.mutex());
+  if (m_path.empty())
+    return;
+  m_records.emplace_back(std::move(record));
+  m_cond.broadcast();
+}
+
+// nearest rank, sorted not empty
+double PerformanceLog::_percentile(const std::vector<double>& sorted,
+				   double p)
+{
+  int rank = int(std::ceil(p / 100 * sorted.size()));
+  return sorted[std::max(rank, 1) - 1];
+}
+
+template <typename T>
+static std::string _toString(const T& val)
+{
+  std::ostringstream os;
+  os << val;
+  return os.str();
+}
+
+static std::string _isoTime(Timestamp tstamp)
+{
+  if (!tstamp.isSet())
+    return "";
+  time_t secs = time_t(tstamp);
+  int ms = int((double(tstamp) - secs) * 1000);
+  struct tm tm;
+  gmtime_r(&secs, &tm);
+  char buffer[64];
+  size_t len = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
+  snprintf(buffer + len, sizeof(buffer) - len, ".%03dZ", ms);
+  return buffer;
+}
+
+void PerformanceLog::_write(const std::string& path, const Record& record)
+{
+  DEB_MEMBER_FUNCT();
+
+  // the REST request is done here, once
+  if (m_host_name.empty()) {
+    char host_name[256];
+    if (gethostname(host_name, sizeof(host_name)) == 0) {
+      host_name[sizeof(host_name) - 1] = 0;
+      m_host_name = host_name;
+    }
+    try {
+      m_cam.getSoftwareVersion(m_software_version);
+    } catch (Exception& e) {
+      DEB_WARNING() << "Could not get the software version: "
+		    << e.getErrMsg();
+    }
+  }
+
+  Json::Value root;
+  root["start"] = _isoTime(record.start);
+  root["end"] = _isoTime(record.end);
+  root["host"] = m_host_name;
+  root["ok"] = record.ok;
+  root["mode"] = record.mode;
+  root["serie_id"] = record.serie_id;
+
+  Json::Value& detector = root["detector"];
+  detector["model"] = record.detector_model;
+  detector["type"] = record.detector_type;
+  detector["api_version"] = record.api_version;
+  detector["software_version"] = m_software_version;
+
+  Json::Value& acq = root["acquisition"];
+  acq["image_type"] = _toString(record.image_type);
+  acq["compression"] = _toString(record.compression);
+  acq["trigger_mode"] = _toString(record.trig_mode);
+  acq["nb_frames"] = record.nb_frames;
+  acq["exposure_time"] = record.exp_time;
+  acq["frame_time"] = record.frame_time;
+  double acq_time = record.end - record.acq_start;
+  acq["acq_time"] = acq_time;
+
+  const PrepareTiming& prepare = record.prepare;
+  Json::Value& prepare_json = root["prepare"];
+  prepare_json["disarm"] = prepare.disarm;
+  prepare_json["clear"] = prepare.clear;
+  prepare_json["stream"] = prepare.stream;
+  prepare_json["params"] = prepare.params;
+  prepare_json["arm"] = prepare.arm;
+  prepare_json["stream_armed"] = prepare.stream_armed;
+  prepare_json["total"] = prepare.total;
+
+  if (record.mode != "filewriter") {
+    const StreamStatistics& stream = record.stream;
+    Json::Value& stream_json = root["stream"];
+    // along the filewriter, the stream frames are not counted
+    if (record.mode == "stream") {
+      stream_json["frames_acquired"] = record.nb_acquired;
+      stream_json["frames_dropped"] = std::max(record.nb_frames -
+					       record.nb_acquired, 0);
+      if (acq_time > 0)
+	stream_json["frame_rate"] = record.nb_acquired / acq_time;
+    }
+    stream_json["ave_size"] = stream.ave_size();
+    stream_json["ave_time"] = stream.ave_time();
+    stream_json["ave_speed"] = stream.ave_speed();
+    stream_json["recent_speed"] = stream.recent_speed();
+    stream_json["ave_queue_depth"] = stream.ave_queue_depth();
+    stream_json["max_queue_depth"] = stream.max_queue_depth();
+    stream_json["nb_stalls"] = stream.nb_stalls();
+    stream_json["stall_time"] = stream.stall_time();
+    stream_json["max_lima_occupancy"] = stream.max_lima_occupancy();
+    stream_json["max_decompress_depth"] = stream.max_decompress_depth();
+    stream_json["max_zmq_backlog"] = stream.max_zmq_backlog();
+    stream_json["buffer_wait_time"] = stream.buffer_wait_time();
+  }
+
+  if (record.mode != "stream") {
+    const TransferStatistics& transfer = record.transfer;
+    Json::Value& transfer_json = root["transfer"];
+    transfer_json["nb_files"] = transfer.n();
+    transfer_json["ave_size"] = transfer.ave_size();
+    transfer_json["ave_time"] = transfer.ave_time();
+    transfer_json["ave_speed"] = transfer.ave_speed();
+    transfer_json["throughput"] = transfer.throughput();
+    transfer_json["ave_wait"] = transfer.ave_wait();
+    transfer_json["max_in_flight"] = transfer.max_in_flight;
+    transfer_json["nb_errors"] = transfer.nb_errors;
+    transfer_json["nb_retries"] = transfer.nb_retries;
+    transfer_json["nb_mirror_errors"] = transfer.nb_mirror_errors;
+  }
+
+  const TriggerLatency& latency = record.trigger_latency;
+  if (latency.n()) {
+    std::vector<double> sorted(record.first_frame_latency);
+    std::sort(sorted.begin(), sorted.end());
+    Json::Value& latency_json = root["trigger_latency"];
+    latency_json["n"] = latency.n();
+    latency_json["ave_first"] = latency.ave_first();
+    latency_json["std_first"] = latency.std_first();
+    latency_json["max_first"] = latency.max_first();
+    if (!sorted.empty()) {
+      latency_json["p50_first"] = _percentile(sorted, 50);
+      latency_json["p90_first"] = _percentile(sorted, 90);
+      latency_json["p99_first"] = _percentile(sorted, 99);
+    }
+    latency_json["ave_last"] = latency.ave_last();
+    latency_json["ave_command"] = latency.ave_command();
+    latency_json["ave_lag"] = latency.ave_lag();
+  }
+
+  Json::StreamWriterBuilder wbuilder;
+  wbuilder["indentation"] = "";
+  std::string line = Json::writeString(wbuilder, root) + "\n";
+
+  // reopened for each record: the file can be rotated meanwhile
+  FILE *file = fopen(path.c_str(), "a");
+  bool ok = file && (fwrite(line.data(), 1, line.size(), file) == line.size());
+  if (file && fclose(file))
+    ok = false;
+  if (!ok) {
+    char errno_buffer[256];
+    char *errno_msg = strerror_r(errno, errno_buffer, sizeof(errno_buffer));
+    DEB_ERROR() << "Could not write the performance log: "
+		<< DEB_VAR2(path, errno_msg);
+  }
+}
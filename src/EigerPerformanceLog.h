@@ -0,0 +1,109 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9 
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERPERFORMANCELOG_H
+#define EIGERPERFORMANCELOG_H
+
+#include <deque>
+#include <vector>
+
+#include "lima/Debug.h"
+#include "lima/Timestamp.h"
+
+#include "EigerCamera.h"
+#include "EigerStatistics.h"
+
+namespace lima
+{
+  namespace Eiger
+  {
+    // Performance history: one JSON line appended to a file for each
+    // acquisition. The records are filled at the series end and only
+    // queued there, they are formatted and written by its own thread
+    class PerformanceLog
+    {
+      DEB_CLASS_NAMESPC(DebModCamera,"PerformanceLog","Eiger");
+    public:
+      struct Record
+      {
+	Timestamp start;		// prepareAcq
+	Timestamp acq_start;		// first startAcq
+	Timestamp end;
+	bool ok;
+	std::string mode;		// stream, filewriter or both
+	int serie_id;
+	std::string detector_model;
+	std::string detector_type;
+	std::string api_version;
+	ImageType image_type;
+	Camera::CompressionType compression;
+	TrigMode trig_mode;
+	int nb_frames;
+	int nb_acquired;		// stream frames only
+	double exp_time;
+	double frame_time;
+	PrepareTiming prepare;
+	StreamStatistics stream;
+	TransferStatistics transfer;
+	TriggerLatency trigger_latency;
+	// TRIGGER sent to the first frame, per trigger
+	std::vector<double> first_frame_latency;
+      };
+
+      PerformanceLog(Camera& cam);
+      ~PerformanceLog();
+
+      // records appended to path, empty (default) disables the log
+      void setPath(const std::string& path);
+      void getPath(std::string& path) const;
+      bool isActive() const;
+
+      // the configuration, at the acquisition start
+      void acqStarted(Record& record);
+      // the started acquisition not logged yet, false if none
+      bool acqEnded(Record& record);
+      void add(Record& record);
+
+    private:
+      class _WriterThread;
+      friend class _WriterThread;
+
+      void _write(const std::string& path, const Record& record);
+      static double _percentile(const std::vector<double>& sorted, double p);
+
+      Camera&		m_cam;
+      mutable Cond	m_cond;
+      std::string	m_path;
+      bool		m_quit;
+      std::deque<Record> m_records;
+      Record		m_started;
+      bool		m_pending;
+      // read by the writer thread once
+      std::string	m_software_version;
+      std::string	m_host_name;
+
+      std::unique_ptr<_WriterThread> m_thread;
+    };
+  }
+}
+#endif	// EIGERPERFORMANCELOG_H
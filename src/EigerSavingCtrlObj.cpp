@@ -22,17 +22,36 @@
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
 #include <algorithm>
+#include "lima/Timestamp.h"
 #include "EigerSavingCtrlObj.h"
 #include "EigerCameraRequests.h"
+#include "EigerThreadPlacement.h"
 
 #include <eigerapi/Requests.h>
 #include <eigerapi/EigerDefines.h>
+#include <eigerapi/Metrics.h>
 
 using namespace lima;
 using namespace lima::Eiger;
 using namespace eigerapi;
 
-const int MAX_SIMULTANEOUS_DOWNLOAD = 4;
+/*----------------------------------------------------------------------------
+			       METRICS
+----------------------------------------------------------------------------*/
+static struct SavingMetrics
+{
+  Metrics::Counter files{"eiger_filewriter_files_downloaded_total",
+			 "Files downloaded from the detector filewriter"};
+  Metrics::Counter bytes{"eiger_filewriter_bytes_downloaded_total",
+			 "Bytes downloaded from the detector filewriter"};
+  Metrics::Counter errors{"eiger_filewriter_download_errors_total",
+			  "Filewriter file downloads failed"};
+  Metrics::Histogram duration{"eiger_filewriter_download_duration_seconds",
+			      "Filewriter file download duration",
+			      {0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100,
+			       250}};
+} s_metrics;
+
 /*----------------------------------------------------------------------------
 			     HDF5 HEADER
 ----------------------------------------------------------------------------*/
@@ -56,6 +75,204 @@ static HeaderKey2Index available_header[] = {
   {"phi_start",Requests::HEADER_PHI_START},
   {"wavelength",Requests::HEADER_WAVELENGTH},
 };
+/*----------------------------------------------------------------------------
+			    Download scheduler
+----------------------------------------------------------------------------*/
+// Decides how many files are downloaded in parallel. It is protected by
+// the SavingCtrlObj lock.
+//  - the limit climbs while the measured throughput improves
+//  - when the DCU buffer runs low, fewer files are fetched with more
+//    HTTP ranges each, so the oldest ones finish (and are freed) first
+//  - new downloads are paused while the local disk write latency is high
+class SavingCtrlObj::_DownloadScheduler
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"SavingCtrlObj::_DownloadScheduler","Eiger");
+public:
+  static const int INITIAL_DOWNLOAD = 2;
+  static const int MAX_SIMULTANEOUS_DOWNLOAD = 8;
+
+  _DownloadScheduler();
+
+  void reset(int nb_files);
+  void download_started();
+  void download_finished(long long size);
+  void update_buffer_free(double buffer_free);
+  void update_write_latency(double latency);
+
+  bool can_start(int nb_running) const;
+  // HTTP ranges of the next file, -1 for the Requests default
+  int get_nb_ranges(int default_nb_ranges) const;
+private:
+  void _end_window();
+
+  int		m_limit;
+  int		m_direction;
+  int		m_max_limit;
+  // throughput over the time with at least one download running
+  int		m_running;
+  Timestamp	m_busy_start;
+  double	m_busy_time;
+  long long	m_window_bytes;
+  int		m_window_files;
+  double	m_last_throughput;
+  // DCU memory
+  double	m_buffer_capacity;
+  bool		m_dcu_low;
+  // local disk write time per MB
+  double	m_latency_baseline;
+  bool		m_disk_slow;
+};
+
+// hysteresis thresholds
+static const double DCU_LOW_RATIO = 0.25;
+static const double DCU_OK_RATIO = 0.5;
+static const double LATENCY_PAUSE_RATIO = 4.;
+static const double LATENCY_RESUME_RATIO = 2.;
+// below 5 ms/MB (200 MB/s) the disk is never considered slow
+static const double MIN_PAUSE_LATENCY = 5e-3;
+
+SavingCtrlObj::_DownloadScheduler::_DownloadScheduler() :
+  m_buffer_capacity(0)
+{
+  reset(MAX_SIMULTANEOUS_DOWNLOAD);
+}
+
+void SavingCtrlObj::_DownloadScheduler::reset(int nb_files)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(nb_files);
+
+  // small runs: never more downloads than files (+ master file)
+  m_max_limit = std::max(1,std::min(MAX_SIMULTANEOUS_DOWNLOAD,nb_files + 1));
+  m_limit = std::min(INITIAL_DOWNLOAD,m_max_limit);
+  m_direction = 1;
+  m_running = 0;
+  m_busy_time = 0.;
+  m_window_bytes = 0;
+  m_window_files = 0;
+  m_last_throughput = 0.;
+  m_dcu_low = false;
+  m_latency_baseline = 0.;
+  m_disk_slow = false;
+}
+
+void SavingCtrlObj::_DownloadScheduler::download_started()
+{
+  if(!m_running++)
+    m_busy_start = Timestamp::now();
+}
+
+void SavingCtrlObj::_DownloadScheduler::download_finished(long long size)
+{
+  if(m_running > 0 && !--m_running)
+    m_busy_time += Timestamp::now() - m_busy_start;
+  m_window_bytes += size;
+  if(++m_window_files >= m_limit)
+    _end_window();
+}
+
+void SavingCtrlObj::_DownloadScheduler::_end_window()
+{
+  DEB_MEMBER_FUNCT();
+
+  if(m_running)
+    {
+      Timestamp now = Timestamp::now();
+      m_busy_time += now - m_busy_start;
+      m_busy_start = now;
+    }
+  if(m_busy_time <= 0.)
+    return;
+
+  double throughput = m_window_bytes / m_busy_time;
+  if(m_last_throughput > 0.)
+    {
+      // worse: turn back. No gain from one more download: go down
+      if(throughput < m_last_throughput * 0.95)
+	m_direction = -m_direction;
+      else if(m_direction > 0 && throughput < m_last_throughput * 1.05)
+	m_direction = -1;
+    }
+  m_limit = std::max(1,std::min(m_max_limit,m_limit + m_direction));
+  m_last_throughput = throughput;
+  DEB_TRACE() << DEB_VAR3(throughput,m_limit,m_direction);
+
+  m_busy_time = 0.;
+  m_window_bytes = 0;
+  m_window_files = 0;
+}
+
+void SavingCtrlObj::_DownloadScheduler::update_buffer_free(double buffer_free)
+{
+  DEB_MEMBER_FUNCT();
+
+  m_buffer_capacity = std::max(m_buffer_capacity,buffer_free);
+  if(m_buffer_capacity <= 0.)
+    return;
+
+  double ratio = buffer_free / m_buffer_capacity;
+  bool dcu_low = m_dcu_low ? ratio < DCU_OK_RATIO : ratio < DCU_LOW_RATIO;
+  if(dcu_low != m_dcu_low)
+    DEB_TRACE() << "DCU buffer " << (dcu_low ? "low" : "ok") << ": "
+		<< DEB_VAR2(buffer_free,m_buffer_capacity);
+  m_dcu_low = dcu_low;
+}
+
+void SavingCtrlObj::_DownloadScheduler::update_write_latency(double latency)
+{
+  DEB_MEMBER_FUNCT();
+
+  if(latency <= 0.)
+    return;
+  if(m_latency_baseline <= 0. || latency < m_latency_baseline)
+    m_latency_baseline = latency;
+
+  bool disk_slow;
+  if(m_disk_slow)
+    disk_slow = latency > std::max(LATENCY_RESUME_RATIO * m_latency_baseline,
+				   MIN_PAUSE_LATENCY);
+  else
+    disk_slow = latency > std::max(LATENCY_PAUSE_RATIO * m_latency_baseline,
+				   MIN_PAUSE_LATENCY);
+  if(disk_slow != m_disk_slow)
+    DEB_TRACE() << "Disk write " << (disk_slow ? "slow" : "ok") << ": "
+		<< DEB_VAR2(latency,m_latency_baseline);
+  m_disk_slow = disk_slow;
+}
+
+bool SavingCtrlObj::_DownloadScheduler::can_start(int nb_running) const
+{
+  // a filling DCU buffer is worse than a slow disk
+  if(m_disk_slow && !m_dcu_low && nb_running > 0)
+    return false;
+  int limit = m_dcu_low ? std::max(1,m_limit / 2) : m_limit;
+  return nb_running < limit;
+}
+
+int SavingCtrlObj::_DownloadScheduler::get_nb_ranges(int default_nb_ranges) const
+{
+  if(!m_dcu_low || default_nb_ranges <= 1)
+    return -1;
+  return 2 * default_nb_ranges;
+}
+
+/*----------------------------------------------------------------------------
+			    File discovery
+----------------------------------------------------------------------------*/
+// polling period around the predicted completion of a file, not below
+// the measured listing round trip
+static const double MIN_POLL_DELAY = 5e-3;
+static const double MAX_TIGHT_POLL_DELAY = 20e-3;
+// the DCU buffer fill is only used for scheduling: polled slowly
+static const double BUFFER_FREE_POLL_PERIOD = 1.;
+
+static std::string _data_file_name(const std::string& prefix, int file_nb)
+{
+  char file_nb_str[32];
+  snprintf(file_nb_str,sizeof(file_nb_str),"%.6d",file_nb);
+  return prefix + "_data_" + file_nb_str + ".h5";
+}
+
 /*----------------------------------------------------------------------------
 			    Polling thread
 ----------------------------------------------------------------------------*/
@@ -75,12 +292,27 @@ private:
 SavingCtrlObj::SavingCtrlObj(Camera& cam) :
   HwSavingCtrlObj(HwSavingCtrlObj::COMMON_HEADER,false),
   m_cam(cam),
+  m_sync_gen(0),
   m_nb_file_to_watch(0),
   m_nb_file_transfer_started(0),
   m_concurrent_download(0),
   m_poll_master_file(false),
+  m_waiting_time(0.),
+  m_nb_file_listed(0),
+  m_nb_frames(0),
+  m_frame_period(0.),
+  m_list_rtt(0.),
+  m_mirror_errors_base(0),
+  m_stat_mirror_errors_base(0),
+  m_lima_decimation(1),
+  m_series_end_pending(false),
   m_quit(false)
 {
+  DEB_CONSTRUCTOR();
+
+  _syncCaches();
+
+  m_scheduler = new _DownloadScheduler();
   m_polling_thread = new _PollingThread(*this,this->m_cam.m_requests);
   m_polling_thread->start();
   // Known keys for common header
@@ -99,13 +331,16 @@ class SavingCtrlObj::_EndDownloadCallback : public CurlLoop::FutureRequest::Call
 {
   DEB_CLASS_NAMESPC(DebModCamera,"SavingCtrlObj::_EndDownloadCallback","Eiger");
 public:
-  _EndDownloadCallback(SavingCtrlObj&,const std::string &filename);
+  _EndDownloadCallback(SavingCtrlObj&,const std::string &filename,
+		       TransferReq transfer);
 
   virtual void status_changed(CurlLoop::FutureRequest::Status,
 			      std::string error);
 private:
   SavingCtrlObj&	m_saving;
   std::string		m_filename;
+  std::weak_ptr<Requests::Transfer> m_transfer;
+  Timestamp		m_start_ts;
 };
 
 /*----------------------------------------------------------------------------
@@ -114,6 +349,7 @@ private:
 SavingCtrlObj::~SavingCtrlObj()
 {
   delete m_polling_thread;
+  delete m_scheduler;
 }
 
 void SavingCtrlObj::getPossibleSaveFormat(std::list<std::string> &format_list) const
@@ -160,14 +396,28 @@ void SavingCtrlObj::setSerieId(int value)
   m_serie_id = value;
 }
 
+void SavingCtrlObj::setLimaDecimation(int decimation)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(decimation);
+
+  AutoMutex lock(m_cond.mutex());
+  m_lima_decimation = decimation;
+}
+
 SavingCtrlObj::Status SavingCtrlObj::getStatus()
 {
   DEB_MEMBER_FUNCT();
+  // the copies to the mirror directories are part of the saving
+  int nb_pending_mirrors = m_cam.m_requests->get_nb_pending_mirrors();
+  int nb_mirror_errors = m_cam.m_requests->get_nb_mirror_errors();
   AutoMutex lock(m_cond.mutex());
   bool status = m_poll_master_file ||
-    (m_nb_file_to_watch != m_nb_file_transfer_started);
-  DEB_RETURN() << DEB_VAR2(status,m_error_msg);
-  if(m_error_msg.empty())
+    (m_nb_file_to_watch != m_nb_file_transfer_started) ||
+    (nb_pending_mirrors > 0);
+  nb_mirror_errors -= m_mirror_errors_base;
+  DEB_RETURN() << DEB_VAR3(status,m_error_msg,nb_mirror_errors);
+  if(m_error_msg.empty() && nb_mirror_errors <= 0)
     return status ? RUNNING : IDLE;
   else
     return ERROR;
@@ -181,28 +431,95 @@ void SavingCtrlObj::stop()
   m_poll_master_file = false;
 }
 
+// the current values are cached so only changed ones are sent in
+// prepareAcq. They are read again after a detector (re)synchronization
+void SavingCtrlObj::_syncCaches()
+{
+  DEB_MEMBER_FUNCT();
+  m_sync_gen = m_cam.m_sync_gen;
+  getEigerParam(m_cam,Requests::FILEWRITER_MODE,m_mode_str);
+  getEigerParam(m_cam,Requests::NIMAGES_PER_FILE,m_frames_per_file_cache);
+  getEigerParam(m_cam,Requests::FILEWRITER_NAME_PATTERN,m_name_pattern);
+}
+
 void SavingCtrlObj::_setActive(bool active, int)
 {
   DEB_MEMBER_FUNCT();
 
+  if(m_sync_gen != m_cam.m_sync_gen)
+    _syncCaches();
   const char *active_str = active ? "enabled" : "disabled";
   DEB_TRACE() << "FILEWRITER_MODE: " << DEB_VAR1(active_str);
-  setEigerParam(m_cam,Requests::FILEWRITER_MODE,active_str);
+  setEigerCachedParam(m_cam,Requests::FILEWRITER_MODE,m_mode_str,active_str);
 }
 
 void SavingCtrlObj::_prepare(int)
 {
   DEB_MEMBER_FUNCT();
 
+  if(m_sync_gen != m_cam.m_sync_gen)
+    _syncCaches();
   int frames_per_file = int(m_frames_per_file);
   DEB_TRACE() << "NIMAGES_PER_FILE: " << DEB_VAR1(frames_per_file);
-  setEigerParam(m_cam,Requests::NIMAGES_PER_FILE,frames_per_file);
+  setEigerCachedParam(m_cam,Requests::NIMAGES_PER_FILE,
+		      m_frames_per_file_cache,frames_per_file);
+  // always sent: if changed by another client, the polled file names
+  // would be wrong
   DEB_TRACE() << "FILEWRITER_NAME_PATTERN: " << DEB_VAR1(m_prefix);
-  setEigerParam(m_cam,Requests::FILEWRITER_NAME_PATTERN,m_prefix);
+  setEigerCachedParamForce(m_cam,Requests::FILEWRITER_NAME_PATTERN,
+			   m_name_pattern,m_prefix,true);
 
+  int nb_mirror_errors = m_cam.m_requests->get_nb_mirror_errors();
   AutoMutex lock(m_cond.mutex());
   m_nb_file_transfer_started = m_nb_file_to_watch = 0;
+  m_nb_file_listed = 0;
+  m_listed_files.clear();
   m_poll_master_file = true;
+  m_mirror_errors_base = m_stat_mirror_errors_base = nb_mirror_errors;
+  m_transfer_stat.reset(Timestamp::now());
+}
+
+void SavingCtrlObj::setMirrorDirectories(const std::list<std::string>& directories)
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_cond.mutex());
+  m_mirror_directories = directories;
+}
+
+void SavingCtrlObj::getMirrorDirectories(std::list<std::string>& directories)
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_cond.mutex());
+  directories = m_mirror_directories;
+}
+
+void SavingCtrlObj::_get_target_paths(const std::string& directory,
+				      const std::string& file_name,
+				      std::vector<std::string>& paths)
+{
+  paths.push_back(directory + "/" + file_name);
+  std::list<std::string>::const_iterator i, end = m_mirror_directories.end();
+  for(i = m_mirror_directories.begin();i != end;++i)
+    paths.push_back(*i + "/" + file_name);
+}
+
+void SavingCtrlObj::latchStatistics(TransferStatistics& stat, bool reset)
+{
+  DEB_MEMBER_FUNCT();
+  int nb_pending_mirrors = m_cam.m_requests->get_nb_pending_mirrors();
+  int nb_mirror_errors = m_cam.m_requests->get_nb_mirror_errors();
+  Timestamp now = Timestamp::now();
+  AutoMutex lock(m_cond.mutex());
+  m_transfer_stat.latch(now);
+  stat = m_transfer_stat;
+  stat.nb_pending_mirrors = nb_pending_mirrors;
+  stat.nb_mirror_errors = nb_mirror_errors - m_stat_mirror_errors_base;
+  if (reset)
+    {
+      m_transfer_stat.reset(now);
+      m_stat_mirror_errors_base = nb_mirror_errors;
+    }
+  DEB_RETURN() << DEB_VAR1(stat);
 }
 
 void SavingCtrlObj::_start(int)
@@ -212,17 +529,29 @@ void SavingCtrlObj::_start(int)
 
   int nb_frames;	m_cam.getNbFrames(nb_frames);
   double expo_time;	m_cam.getExpTime(expo_time);
+  double lat_time;	m_cam.getLatTime(lat_time);
+  TrigMode trig_mode;	m_cam.getTrigMode(trig_mode);
 
   AutoMutex lock(m_cond.mutex());
   m_nb_file_transfer_started = 0;
+  m_series_end_pending = true;
   m_nb_file_to_watch = nb_frames / m_frames_per_file;
   if(nb_frames % m_frames_per_file) ++m_nb_file_to_watch;
 
   m_waiting_time = (expo_time * std::min(nb_frames,int(m_frames_per_file))) / 2.;
+  m_scheduler->reset(m_nb_file_to_watch);
+
+  // file completion is predicted from the frame time with internal
+  // trigger, otherwise from the arrival of the previous files
+  m_nb_file_listed = 0;
+  m_file_listed_ts.clear();
+  m_nb_frames = nb_frames;
+  m_frame_period = (trig_mode == IntTrig) ? expo_time + lat_time : 0.;
+  m_start_ts = Timestamp::now();
   
   m_cond.broadcast();
   
-  DEB_TRACE() << DEB_VAR2(m_nb_file_to_watch,m_waiting_time);
+  DEB_TRACE() << DEB_VAR3(m_nb_file_to_watch,m_waiting_time,m_frame_period);
 }
 //----------------------------------------------------------------------------
 //
@@ -249,18 +578,22 @@ SavingCtrlObj::_PollingThread::~_PollingThread()
 void SavingCtrlObj::_PollingThread::threadFunction()
 {
   DEB_MEMBER_FUNCT();
+  ThreadPlacement::Registration placement(ThreadPlacement::Polling,
+					  "saving polling");
 
   Camera::ApiGeneration api;
   m_saving.m_cam.getApiGeneration(api);
   Requests::PARAM_NAME ls_name = ((api == Camera::Eiger1) ? Requests::FILEWRITER_LS :
 							    Requests::FILEWRITER_LS2);
+  bool poll_buffer_free = true;
+  Timestamp last_buffer_free;
 
   AutoMutex lock(m_saving.m_cond.mutex());
   
   while(!m_saving.m_quit)
     {
       while(!m_saving.m_quit &&
-	    (m_saving.m_concurrent_download >= MAX_SIMULTANEOUS_DOWNLOAD ||
+	    (!m_saving.m_scheduler->can_start(m_saving.m_concurrent_download) ||
 	     (!m_saving.m_poll_master_file &&
 	      (m_saving.m_nb_file_to_watch == 
 	       m_saving.m_nb_file_transfer_started))))
@@ -292,129 +625,209 @@ void SavingCtrlObj::_PollingThread::threadFunction()
 
       //Ls request
       std::vector<std::string> files;
+      double buffer_free = -1;
+      double list_rtt;
       {
 	AutoMutexUnlock u(lock);
+	Timestamp list_start = Timestamp::now();
 	getEigerParam(m_saving.m_cam,ls_name,files);
+	Timestamp now = Timestamp::now();
+	list_rtt = now - list_start;
+	if(poll_buffer_free &&
+	   (!last_buffer_free.isSet() ||
+	    now - last_buffer_free >= BUFFER_FREE_POLL_PERIOD))
+	  {
+	    last_buffer_free = now;
+	    try
+	      {
+		getEigerParam(m_saving.m_cam,Requests::FILEWRITER_BUFFER_FREE,
+			      buffer_free);
+	      }
+	    catch(Exception&)
+	      {
+		DEB_WARNING() << "FILEWRITER_BUFFER_FREE not available, "
+			      << "download scheduling ignores DCU memory";
+		poll_buffer_free = false;
+	      }
+	  }
       }
+      m_saving.m_list_rtt = (m_saving.m_list_rtt > 0.) ?
+			    (3 * m_saving.m_list_rtt + list_rtt) / 4. : list_rtt;
+      if(buffer_free >= 0)
+	{
+	  m_saving.m_scheduler->update_buffer_free(buffer_free);
+	  m_saving.m_transfer_stat.add_buffer_free(buffer_free,Timestamp::now());
+	}
+      m_saving.m_scheduler->update_write_latency(m_requests->get_transfer_write_latency());
+
+      // only the names not seen in a previous listing are looked at
+      m_saving._update_listed_files(files,prefix);
 
       // try to download master file
       if(m_saving.m_poll_master_file)
 	{
-	  std::ostringstream src_file_name;
-	  src_file_name << prefix <<  "_master.h5";
-	  bool master_file_found = false;
-	  for(std::vector<std::string>::iterator i = files.begin();
-	      !master_file_found && i != files.end();++i)
-	    master_file_found = *i == src_file_name.str();
-
-	  if(master_file_found)
+	  std::string master_file_name = prefix + "_master.h5";
+	  if(m_saving.m_listed_files.count(master_file_name))
 	    {
-	      std::string master_file_name = prefix + "_master.h5";
-	      std::string dest_path = directory + "/" + master_file_name;
+	      std::vector<std::string> dest_paths;
+	      m_saving._get_target_paths(directory,master_file_name,dest_paths);
 	      TransferReq master_file_req;
-	      master_file_req = startEigerTransfer(m_saving.m_cam,
-						   src_file_name.str(),
-						   dest_path,lock);
+	      // small file: one range, no size probe
+	      master_file_req = startEigerTransferRanges(m_saving.m_cam,
+							 master_file_name,
+							 dest_paths,lock,1);
 	      if (!master_file_req) {
 		// stop the loop
 		m_saving.m_nb_file_to_watch = m_saving.m_nb_file_transfer_started = 0;
 		continue;
 	      }
-	      CallbackPtr end_cbk(new _EndDownloadCallback(m_saving,src_file_name.str()));
+	      CallbackPtr end_cbk(new _EndDownloadCallback(m_saving,master_file_name,
+							   master_file_req));
+	      m_saving.m_poll_master_file = false;
+	      m_saving._download_started(0.);
 	      {
 		AutoMutexUnlock u(lock);
 		master_file_req->register_callback(end_cbk);
 	      }
-	      m_saving.m_poll_master_file = false;
-	      ++m_saving.m_concurrent_download;
 	    }
 	}
       
-      if(m_saving.m_nb_file_transfer_started < m_saving.m_nb_file_to_watch)
+      // data files are closed in order: start the listed ones
+      while(m_saving.m_nb_file_transfer_started < m_saving.m_nb_file_listed &&
+	    m_saving.m_scheduler->can_start(m_saving.m_concurrent_download))
 	{
 	  int next_file_nb = m_saving.m_nb_file_transfer_started + 1;
-
-	  std::sort(files.begin(),files.end());
-	  char file_nb[32];
-	  snprintf(file_nb,sizeof(file_nb),"%.6d",next_file_nb);
-
-	  std::ostringstream src_file_name;
-	  src_file_name << prefix << "_data_"  << file_nb << ".h5";
-	  
-	  //init find the first file_name of the list
-	  std::vector<std::string>::iterator file_name = files.begin();
-	  for(;file_name != files.end();++file_name)
-	    if(*file_name == src_file_name.str()) break;
-
-	  for(;file_name != files.end() &&
-		m_saving.m_concurrent_download < MAX_SIMULTANEOUS_DOWNLOAD;
-	      ++file_name,++next_file_nb)
+	  std::string src_file_name = _data_file_name(prefix,next_file_nb);
+
+	  DEB_TRACE() << "Start transfer file: " << DEB_VAR1(src_file_name);
+	  std::vector<std::string> dest_paths;
+	  m_saving._get_target_paths(directory,src_file_name,dest_paths);
+	  TransferReq file_req;
+	  int nb_ranges = m_saving.m_scheduler->
+	    get_nb_ranges(m_requests->get_transfer_nb_ranges());
+	  file_req = startEigerTransferRanges(m_saving.m_cam,
+					      src_file_name,
+					      dest_paths,lock,nb_ranges);
+	  if (!file_req) {
+	    // stop the loop
+	    m_saving.m_nb_file_to_watch = m_saving.m_nb_file_transfer_started = 0;
+	    break;
+	  }
+	  ++m_saving.m_nb_file_transfer_started;
+	  double listed_ts = m_saving.m_file_listed_ts[next_file_nb - 1];
+	  m_saving._download_started(Timestamp::now() - listed_ts);
+	  CallbackPtr end_cbk(new _EndDownloadCallback(m_saving,src_file_name,
+						       file_req));
+	  {
+	    AutoMutexUnlock u(lock);
+	    file_req->register_callback(end_cbk);
+	  }
+
+	  if(m_saving.m_callback)
 	    {
-
-	      snprintf(file_nb,sizeof(file_nb),"%.6d",next_file_nb);
-	      src_file_name.clear();src_file_name.seekp(0);
-	      src_file_name << prefix << "_data_"
-			    << file_nb << ".h5";
-	      if(*file_name == src_file_name.str()) // will start the transfer
-		{
-		  if(next_file_nb > m_saving.m_nb_file_to_watch)
-		    {
-		      DEB_WARNING() << "Something weird happened " 
-				    << DEB_VAR2(next_file_nb,m_saving.m_nb_file_to_watch);
-		      break;
-		    }
-
-		  DEB_TRACE() << "Start transfer file: " << DEB_VAR1(*file_name);
-		  std::string dest_path = directory + "/" + src_file_name.str();
-		  TransferReq file_req;
-		  file_req = startEigerTransfer(m_saving.m_cam,
-						src_file_name.str(),
-						dest_path,lock);
-		  if (!file_req) {
-		    // stop the loop
-		    m_saving.m_nb_file_to_watch = m_saving.m_nb_file_transfer_started = 0;
-		    break;
-		  }
-		  ++m_saving.m_nb_file_transfer_started,++m_saving.m_concurrent_download;
-		  CallbackPtr end_cbk(new _EndDownloadCallback(m_saving,src_file_name.str()));
-		  {
-		    AutoMutexUnlock u(lock);
-		    file_req->register_callback(end_cbk);
-		  }
-
-		  if(m_saving.m_callback)
-		    {
-		      int written_frame = m_saving.m_nb_file_transfer_started * frames_per_file;
-		      if(written_frame > total_nb_frames)
-			written_frame = total_nb_frames;
-		      
-		      //lima index start at 0
-		      --written_frame;
-		      bool continueFlag;
-		      {
-			AutoMutexUnlock u(lock);
-			continueFlag = m_saving.m_callback->newFrameWritten(written_frame);
-		      }
-		      if(!continueFlag) // stop the loop
-			m_saving.m_nb_file_to_watch = m_saving.m_nb_file_transfer_started = 0;
-		    }
-		}
-	      else
-		break;
+	      int written_frame = m_saving.m_nb_file_transfer_started * frames_per_file;
+	      if(written_frame > total_nb_frames)
+		written_frame = total_nb_frames;
+	      
+	      //lima index start at 0
+	      --written_frame;
+	      // frames passed to Lima by a decimated stream
+	      written_frame /= m_saving.m_lima_decimation;
+	      bool continueFlag;
+	      {
+		AutoMutexUnlock u(lock);
+		continueFlag = m_saving.m_callback->newFrameWritten(written_frame);
+	      }
+	      if(!continueFlag) // stop the loop
+		m_saving.m_nb_file_to_watch = m_saving.m_nb_file_transfer_started = 0;
 	    }
 	}
 
-      m_saving.m_cond.wait(m_saving.m_waiting_time);
+      m_saving.m_cond.wait(m_saving._next_poll_delay());
+    }
+}
+
+void SavingCtrlObj::_update_listed_files(const std::vector<std::string>& files,
+					 const std::string& prefix)
+{
+  DEB_MEMBER_FUNCT();
+
+  bool new_file = false;
+  for(std::vector<std::string>::const_iterator i = files.begin();
+      i != files.end();++i)
+    new_file |= m_listed_files.insert(*i).second;
+  if(!new_file)
+    return;
+
+  int nb_listed = m_nb_file_listed;
+  while(nb_listed < m_nb_file_to_watch &&
+	m_listed_files.count(_data_file_name(prefix,nb_listed + 1)))
+    ++nb_listed;
+  if(nb_listed == m_nb_file_listed)
+    return;
+
+  Timestamp now = Timestamp::now();
+  int frames_per_file = m_frames_per_file;
+  if(m_nb_file_listed > 0)
+    {
+      int nb_frames = std::min(nb_listed * frames_per_file,m_nb_frames) -
+		      m_nb_file_listed * frames_per_file;
+      double period = (now - m_last_file_ts) / nb_frames;
+      m_frame_period = (m_frame_period > 0.) ?
+		       (m_frame_period + period) / 2. : period;
     }
+  m_file_listed_ts.resize(nb_listed,now);
+  m_nb_file_listed = nb_listed;
+  m_last_file_ts = now;
+  DEB_TRACE() << DEB_VAR2(m_nb_file_listed,m_frame_period);
+}
+
+double SavingCtrlObj::_next_poll_delay()
+{
+  // nothing to predict, only the master file may be left
+  if(m_nb_file_listed >= m_nb_file_to_watch || m_frame_period <= 0.)
+    return m_waiting_time;
+
+  int frames_per_file = m_frames_per_file;
+  int next_file_frames = std::min(frames_per_file,
+				  m_nb_frames - m_nb_file_listed * frames_per_file);
+  Timestamp ref = m_nb_file_listed ? m_last_file_ts : m_start_ts;
+  double until_due = (ref + m_frame_period * next_file_frames) - Timestamp::now();
+
+  // sleep until due, then poll tightly and back off if it is late
+  double tight = std::max(std::max(MIN_POLL_DELAY,m_list_rtt),
+			  std::min(MAX_TIGHT_POLL_DELAY,
+				   m_frame_period * frames_per_file / 50.));
+  double delay = (until_due > tight) ? until_due :
+					std::max(tight,-until_due / 4.);
+  if(m_waiting_time > 0.)
+    delay = std::min(delay,m_waiting_time);
+  return delay;
+}
+
+void SavingCtrlObj::_download_started(double wait)
+{
+  ++m_concurrent_download;
+  m_scheduler->download_started();
+  m_transfer_stat.start(wait,Timestamp::now());
 }
 
 void SavingCtrlObj::_download_finished(std::string filename, bool ok,
-				       std::string error)
+				       std::string error, long long size,
+				       double elapsed, int nb_retries)
 {
   DEB_MEMBER_FUNCT();
-  DEB_PARAM() << DEB_VAR3(filename, ok, error);
+  DEB_PARAM() << DEB_VAR6(filename, ok, error, size, elapsed, nb_retries);
 
   m_cam.newFrameAcquired();
+  if(ok)
+    {
+      s_metrics.files.add();
+      s_metrics.bytes.add(size);
+      s_metrics.duration.observe(elapsed);
+    }
+  else
+    s_metrics.errors.add();
 
   AutoMutex lock(m_cond.mutex());
   if(!ok)
@@ -428,16 +841,39 @@ void SavingCtrlObj::_download_finished(std::string filename, bool ok,
     }
 
   --m_concurrent_download;
+  m_transfer_stat.end(ok,size,elapsed,nb_retries,Timestamp::now());
+  m_scheduler->download_finished(size);
+  m_scheduler->update_write_latency(m_cam.m_requests->get_transfer_write_latency());
   m_cond.broadcast();
+
+  bool series_end = (m_series_end_pending && !m_poll_master_file &&
+		     (m_nb_file_transfer_started == m_nb_file_to_watch) &&
+		     !m_concurrent_download);
+  if(series_end && m_series_end_cb)
+    {
+      m_series_end_pending = false;
+      bool series_ok = m_error_msg.empty();
+      lock.unlock();
+      m_series_end_cb(series_ok);
+    }
+}
+
+void SavingCtrlObj::setSeriesEndCallback(SeriesEndCallback cb)
+{
+  DEB_MEMBER_FUNCT();
+  m_series_end_cb = cb;
 }
 
 /*----------------------------------------------------------------------------
 		      class _EndDownloadCallback
 ----------------------------------------------------------------------------*/
 SavingCtrlObj::_EndDownloadCallback::_EndDownloadCallback(SavingCtrlObj& saving,
-							  const std::string& filename) :
+							  const std::string& filename,
+							  TransferReq transfer) :
   m_saving(saving),
-  m_filename(filename)
+  m_filename(filename),
+  m_transfer(transfer),
+  m_start_ts(Timestamp::now())
 {
 }
 
@@ -447,5 +883,9 @@ status_changed(CurlLoop::FutureRequest::Status status, std::string error)
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR2(status, error);
   bool ok = (status == CurlLoop::FutureRequest::OK);
-  m_saving._download_finished(m_filename, ok, error);
+  double elapsed = Timestamp::now() - m_start_ts;
+  TransferReq transfer = m_transfer.lock();
+  long long size = transfer ? transfer->get_download_size() : 0;
+  int nb_retries = transfer ? transfer->get_nb_retries() : 0;
+  m_saving._download_finished(m_filename, ok, error, size, elapsed, nb_retries);
 }
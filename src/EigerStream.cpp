@@ -24,16 +24,25 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <limits>
 #include <map>
 #include <set>
+#include <type_traits>
 
 #include <zmq.h>
 
 #include "EigerCameraRequests.h"
+#include "EigerDecompress.h"
+#include "EigerBufferAllocMgr.h"
 #include <eigerapi/EigerDefines.h>
+#include <eigerapi/Metrics.h>
+#include <eigerapi/Trace.h>
 
 #include "lima/Exceptions.h"
+#include "processlib/ProcessExceptions.h"
 #include "EigerStream.h"
+#include "EigerThreadPlacement.h"
 
 //#define _BSD_SOURCE
 #include <endian.h>
@@ -42,6 +51,36 @@ using namespace lima;
 using namespace lima::Eiger;
 using namespace eigerapi;
 
+//			--- Metrics ---
+static struct StreamMetrics
+{
+  Metrics::Counter frames_received{"eiger_stream_frames_received_total",
+				   "Frames received on the stream"};
+  Metrics::Counter bytes_received{"eiger_stream_bytes_received_total",
+				  "Frame data bytes received on the stream"};
+  Metrics::Counter frames_ignored{"eiger_stream_frames_ignored_total",
+				  "Frames received after a stop, not passed "
+				  "to Lima"};
+  Metrics::Counter sequence_errors{"eiger_stream_sequence_errors_total",
+				   "Frames received out of sequence"};
+  Metrics::Counter dispatch_stalls{"eiger_stream_dispatch_stalls_total",
+				   "Frames pushed to a full dispatch queue"};
+  Metrics::Counter stall_time{"eiger_stream_dispatch_stall_seconds_total",
+			      "Time waited on a full dispatch queue"};
+  Metrics::Counter buffer_wait{"eiger_stream_buffer_wait_seconds_total",
+			       "Time the dispatch waited for a free Lima "
+			       "buffer"};
+  Metrics::Gauge lima_occupancy{"eiger_stream_lima_occupancy",
+				"Frames passed to Lima, not yet decoded"};
+  Metrics::Gauge decompress_depth{"eiger_stream_decompress_depth",
+				  "Frames passed to Lima, decoding not "
+				  "started"};
+  Metrics::Gauge dispatch_depth{"eiger_stream_dispatch_depth",
+				"Frames in the dispatch queue"};
+  Metrics::Gauge zmq_backlog{"eiger_stream_zmq_backlog",
+			     "Messages pending on the stream socket"};
+} s_metrics;
+
 //			--- Message struct ---
 struct Stream::Message
 {
@@ -65,6 +104,29 @@ struct Stream::Message
 };
 
 //		      --- Stream::ImageData ---
+Stream::ImageData::~ImageData()
+{
+  Trace::instant("buffer released", "frame", frameid);
+  if (!decode_started)
+    decodeStarted();
+  if (!decode_done)
+    decodeDone();
+}
+
+void Stream::ImageData::decodeStarted()
+{
+  decode_started = true;
+  if (lima_counters)
+    ++lima_counters->decode_started;
+}
+
+void Stream::ImageData::decodeDone()
+{
+  decode_done = true;
+  if (lima_counters)
+    ++lima_counters->decode_done;
+}
+
 void Stream::ImageData::getMsgDataNSize(void*& data, size_t& size) const
 {
   msg->get_msg_data_n_size(data, size);
@@ -103,6 +165,237 @@ std::ostream& lima::Eiger::operator <<(std::ostream& os,
 	    << ">";
 }
 
+//		      --- Dispatch thread ---
+// The frames are passed to Lima (buffer wait, HwAddData, newFrameReady
+// and disarm) by this thread, so slow Lima callbacks or REST requests do
+// not stall the socket draining. The Zmq thread pushes them into a
+// single-producer single-consumer ring: the slots are handed over through
+// the atomic indexes, the Cond is only used by the side that must sleep
+class Stream::_DispatchThread : public Thread
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"Stream::_DispatchThread","Eiger");
+
+public:
+  struct Frame {
+    int frameid;
+    ImageDataPtr img_data;
+    bool ext_trigger;
+    bool filewriter_active;
+  };
+
+  _DispatchThread(Stream& stream);
+  virtual ~_DispatchThread();
+
+  // called by the Zmq thread: blocks while the ring is full
+  void push(Frame& frame, int& depth, double& stall_time);
+  // wait until all the pushed frames are dispatched
+  void drain();
+  // a dispatch error was reported since the last check
+  bool checkFailed();
+
+protected:
+  virtual void threadFunction();
+
+private:
+  static const unsigned QUEUE_SIZE = 64;	// power of 2
+  static const unsigned QUEUE_MASK = QUEUE_SIZE - 1;
+
+  template <typename P>
+  void _sleepUntil(std::atomic<bool>& waiting, P ready);
+  void _wakeUp(std::atomic<bool>& waiting);
+
+  void _dispatch(Frame& frame);
+  bool _waitLimaFrame(int frameid);
+
+  Stream&		m_stream;
+  Cond			m_ring_cond;
+  std::vector<Frame>	m_ring;
+  // head is written by the Zmq thread, tail once the frame is dispatched
+  std::atomic<unsigned>	m_head;
+  std::atomic<unsigned>	m_tail;
+  std::atomic<bool>	m_consumer_waiting;
+  std::atomic<bool>	m_producer_waiting;
+  std::atomic<bool>	m_failed;
+  bool			m_quit;
+};
+
+Stream::_DispatchThread::_DispatchThread(Stream& stream)
+  : m_stream(stream),
+    m_ring(QUEUE_SIZE),
+    m_head(0),
+    m_tail(0),
+    m_consumer_waiting(false),
+    m_producer_waiting(false),
+    m_failed(false),
+    m_quit(false)
+{
+  DEB_CONSTRUCTOR();
+  start();
+}
+
+Stream::_DispatchThread::~_DispatchThread()
+{
+  DEB_DESTRUCTOR();
+  {
+    AutoMutex lock(m_ring_cond.mutex());
+    m_quit = true;
+    m_ring_cond.broadcast();
+  }
+  join();
+}
+
+// The waiting flag is set before checking the indexes, and the other side
+// checks it after updating them: one of them always sees the other
+template <typename P>
+void Stream::_DispatchThread::_sleepUntil(std::atomic<bool>& waiting, P ready)
+{
+  AutoMutex lock(m_ring_cond.mutex());
+  waiting = true;
+  while (!ready())
+    m_ring_cond.wait();
+  waiting = false;
+}
+
+inline void Stream::_DispatchThread::_wakeUp(std::atomic<bool>& waiting)
+{
+  if (waiting) {
+    AutoMutex lock(m_ring_cond.mutex());
+    m_ring_cond.broadcast();
+  }
+}
+
+void Stream::_DispatchThread::push(Frame& frame, int& depth,
+				   double& stall_time)
+{
+  unsigned head = m_head.load(std::memory_order_relaxed);
+  stall_time = 0;
+  if (head - m_tail == QUEUE_SIZE) {
+    Timestamp t0 = Timestamp::now();
+    _sleepUntil(m_producer_waiting,
+		[&]() { return (head - m_tail != QUEUE_SIZE); });
+    stall_time = Timestamp::now() - t0;
+  }
+  m_ring[head & QUEUE_MASK] = std::move(frame);
+  m_head = head + 1;
+  depth = head + 1 - m_tail;
+  _wakeUp(m_consumer_waiting);
+}
+
+void Stream::_DispatchThread::drain()
+{
+  DEB_MEMBER_FUNCT();
+  _sleepUntil(m_producer_waiting, [&]() { return (m_tail == m_head); });
+}
+
+bool Stream::_DispatchThread::checkFailed()
+{
+  return m_failed.exchange(false);
+}
+
+void Stream::_DispatchThread::threadFunction()
+{
+  DEB_MEMBER_FUNCT();
+  ThreadPlacement::Registration placement(ThreadPlacement::Dispatch,
+					  "stream dispatch");
+
+  while (true) {
+    unsigned tail = m_tail.load(std::memory_order_relaxed);
+    if (m_head == tail) {
+      _sleepUntil(m_consumer_waiting,
+		  [&]() { return (m_quit || (m_head != tail)); });
+      if (m_head == tail)
+	break;
+    }
+
+    Frame& frame = m_ring[tail & QUEUE_MASK];
+    try {
+      _dispatch(frame);
+    } catch (Exception& e) {
+      std::ostringstream err_msg;
+      err_msg << "Stream dispatch error: " << e.getErrMsg();
+      Event *event = new Event(Hardware, Event::Error, Event::Camera,
+			       Event::CamFault, err_msg.str());
+      DEB_EVENT(*event) << DEB_VAR1(*event);
+      m_stream.m_cam.reportEvent(event);
+      m_failed = true;
+    }
+    frame.img_data.reset();
+    m_tail = tail + 1;
+    _wakeUp(m_producer_waiting);
+  }
+}
+
+void Stream::_DispatchThread::_dispatch(Frame& frame)
+{
+  DEB_MEMBER_FUNCT();
+  int frameid = frame.frameid;
+
+  bool trace = Trace::is_active();
+  double t0 = trace ? Trace::now() : 0;
+  Timestamp wait_start = Timestamp::now();
+  if (!_waitLimaFrame(frameid)) {
+    DEB_TRACE() << "Stopped: ignoring data";
+    return;
+  }
+  m_stream._addBufferWait(Timestamp::now() - wait_start);
+  double t1 = trace ? Trace::now() : 0;
+  if (trace)
+    Trace::complete("buffer wait", "frame", t0, t1, frameid);
+
+  HwFrameInfoType frame_info;
+  frame_info.acq_frame_nb = frameid;
+  StdBufferCbMgr *buffer_mgr = m_stream.m_buffer_mgr;
+  frame.img_data->lima_counters = m_stream.m_lima_counters;
+  ++m_stream.m_lima_counters->dispatched;
+  HwAddData("eiger_data", frame_info, frame.img_data);
+  double t2 = trace ? Trace::now() : 0;
+  if (trace)
+    Trace::complete("HwAddData", "frame", t1, t2, frameid);
+
+  Camera& cam = m_stream.m_cam;
+  // the acquired frames and the disarm are then managed by the saving
+  if (!frame.filewriter_active)
+    cam.newFrameAcquired();
+  bool continue_flag = buffer_mgr->newFrameReady(frame_info);
+  if (trace)
+    Trace::complete("newFrameReady", "frame", t2, Trace::now(), frameid);
+  if (frame.filewriter_active)
+    return;
+  bool do_disarm = (frame.ext_trigger && cam.allFramesAcquired());
+  if (!continue_flag && !do_disarm) {
+    DEB_WARNING() << "Unexpected " << DEB_VAR1(continue_flag) << ": "
+		  << "Disarming camera";
+    do_disarm = true;
+  }
+  if (do_disarm)
+    cam.disarm();
+}
+
+bool Stream::_DispatchThread::_waitLimaFrame(int frameid)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(frameid);
+
+  bool stopped;
+  bool available = false;
+  Cond& cond = m_stream.m_cond;
+  AutoMutex lock(cond.mutex());
+  while (true) {
+    State state = m_stream.m_state;
+    stopped = ((state == Stopped) || (state == Aborting) ||
+	       (state == Quitting));
+    if (stopped || available)
+      break;
+    typedef SoftBufferCtrlObj::Sync BufferSync;
+    BufferSync::Status status = m_stream.m_buffer_sync->wait(frameid);
+    if (status == BufferSync::AVAILABLE)
+      available = true;
+    else if (status != BufferSync::INTERRUPTED)
+      THROW_HW_ERROR(Error) << "Buffer sync wait error: " << status;
+  }
+  return !stopped;
+}
+
 //		      --- Zmq thread ---
 class Stream::_ZmqThread : public Thread
 {
@@ -121,8 +414,9 @@ private:
 				 MessageList& pending_messages);
   Json::Value _get_json_header(MessagePtr &msg);
   bool _read_zmq_messages(void *stream_socket);
+  bool _chainNextSeries();
+  void _readCameraConfig();
   void _checkCompression(const StreamInfo& info);
-  void _waitLimaFrame(int frameid);
 
   Stream&		m_stream;
   Cond&			m_cond;
@@ -132,6 +426,8 @@ private:
   void*			m_zmq_context;
   bool          	m_stopped;
   bool			m_ext_trigger;
+  bool			m_filewriter_active;
+  int			m_decimation;
   CompressionType	m_comp_type;
   bool			m_waiting_global_header;
   FrameDim		m_decomp_fdim;
@@ -139,12 +435,16 @@ private:
 
   Timestamp		m_last_data_tstamp;
   int			m_last_frame;
+  int			m_zmq_backlog;
 };
 
 Stream::_ZmqThread::_ZmqThread(Stream& stream)
   : m_stream(stream),
     m_cond(m_stream.m_cond),
-    m_state(m_stream.m_state)
+    m_state(m_stream.m_state),
+    m_filewriter_active(false),
+    m_decimation(1),
+    m_zmq_backlog(0)
 {
   DEB_CONSTRUCTOR();
 
@@ -223,7 +523,9 @@ Stream::_ZmqThread::_get_global_header(const Json::Value& stream_header,
 void Stream::_ZmqThread::threadFunction()
 {
   DEB_MEMBER_FUNCT();
-  
+  ThreadPlacement::Registration placement(ThreadPlacement::Receive,
+					  "stream receive");
+
   AutoMutex lock(m_cond.mutex());
   m_state = Idle;
   while (1) {
@@ -280,20 +582,19 @@ void Stream::_ZmqThread::_run_sequence()
 
   {
     AutoMutex lock(m_cond.mutex());
-    TrigMode trigger_mode;
-    cam.getTrigMode(trigger_mode);
-    m_ext_trigger = ((trigger_mode != IntTrig) &&
-		     (trigger_mode != IntTrigMult));
-    cam.getCompressionType(m_comp_type);
+    _readCameraConfig();
 
     DEB_TRACE() << "Connected to " << stream_endpoint;
     m_state = Connected;
+    m_stream.m_chained = false;
     m_cond.broadcast();
   }
 
   m_stopped = false;
   m_waiting_global_header = true;
   m_last_frame = -1;
+  m_zmq_backlog = 0;
+  m_stream.m_dispatch->checkFailed();
 
   int read_pipe = m_stream.m_pipes[0];
 
@@ -307,11 +608,19 @@ void Stream::_ZmqThread::_run_sequence()
   while(continue_flag) {	// reading loop
     DEB_TRACE() << "Enter poll";
     long timeout_ms = m_stopped ? 2000 : -1;
-    if (zmq_poll(items,2,timeout_ms) <= 0) {
+    // only poll with timeout if nothing is queued yet
+    int nb_ready = zmq_poll(items,2,0);
+    bool queued = (nb_ready > 0);
+    if (nb_ready == 0)
+      nb_ready = zmq_poll(items,2,timeout_ms);
+    if (nb_ready <= 0) {
       DEB_ERROR() << "No (end) message received after Abort";
       break;
     }
     DEB_TRACE() << "Exit poll";
+    // frames in a row found already queued in the socket
+    bool stream_ready = (items[1].revents & ZMQ_POLLIN);
+    m_zmq_backlog = (queued && stream_ready) ? (m_zmq_backlog + 1) : 0;
 
     if(items[0].revents & ZMQ_POLLIN) { // reading synchro pipe
       char buffer[1024];
@@ -342,6 +651,24 @@ void Stream::_ZmqThread::_run_sequence()
       }
     }
   }
+
+  // the sequence is over once Lima got all the received frames
+  m_stream.m_dispatch->drain();
+}
+
+void Stream::_ZmqThread::_readCameraConfig()
+{
+  DEB_MEMBER_FUNCT();
+  Camera& cam = m_stream.m_cam;
+  TrigMode trigger_mode;
+  cam.getTrigMode(trigger_mode);
+  m_ext_trigger = ((trigger_mode != IntTrig) &&
+		   (trigger_mode != IntTrigMult));
+  cam.getCompressionType(m_comp_type);
+  m_filewriter_active = m_stream.m_filewriter_active;
+  m_decimation = m_filewriter_active ? m_stream.m_lima_decimation : 1;
+  DEB_TRACE() << DEB_VAR4(m_ext_trigger, m_comp_type, m_filewriter_active,
+			  m_decimation);
 }
 
 bool Stream::_ZmqThread::_read_zmq_messages(void *stream_socket)
@@ -350,6 +677,7 @@ bool Stream::_ZmqThread::_read_zmq_messages(void *stream_socket)
 
   MessageList pending_messages;
   pending_messages.reserve(9);
+  double trace_start = 0;
   int more;
   do {
     MessagePtr msg(new Stream::Message());
@@ -366,6 +694,8 @@ bool Stream::_ZmqThread::_read_zmq_messages(void *stream_socket)
 	<< "Error receiving zmq message: "
 	<< DEB_VAR3(errno, errno_msg, pending_messages.size());
     }
+    if (pending_messages.empty() && Trace::is_active())
+      trace_start = Trace::now();
     more = zmq_msg_more(zmq_msg);
     pending_messages.emplace_back(msg);
   } while(more);
@@ -389,18 +719,33 @@ bool Stream::_ZmqThread::_read_zmq_messages(void *stream_socket)
     return true;
   } else if (is_global_header) {
     Json::Value header = _get_global_header(stream_header,pending_messages);
+    int serie_id = stream_header.get("series",-1).asInt();
     m_waiting_global_header = false;
     AutoMutex lock(m_cond.mutex());
+    // the configuration might have changed since the socket was connected
+    if (m_stream.m_chained)
+      _readCameraConfig();
     m_state = Armed;
-    DEB_TRACE() << "Global header received: " << DEB_VAR1(m_state);
+    m_stream.m_armed_serie_id = serie_id;
+    DEB_TRACE() << "Global header received: " << DEB_VAR2(m_state, serie_id);
     m_cond.broadcast();
     return true;
   } else if(htype.find("dimage-") != std::string::npos) {
     int frameid = stream_header.get("frame",-1).asInt();
     DEB_TRACE() << DEB_VAR1(frameid);
-    if (frameid != m_last_frame + 1)
+    if (frameid != m_last_frame + 1) {
+      s_metrics.sequence_errors.add();
       THROW_HW_ERROR(Error) << "Bad frame number: " << frameid << ", "
 			    << "expected " << m_last_frame + 1;
+    }
+    // i.e. an external trigger before startAcq: the series is not
+    // passed to Lima. Checked once, the next frames follow the first
+    if (frameid == 0) {
+      AutoMutex lock(m_cond.mutex());
+      if ((m_state == Connected) || (m_state == Armed))
+	THROW_HW_ERROR(Error) << "Frame received before the acquisition "
+			      << "start: " << DEB_VAR1(m_state);
+    }
     m_last_frame = frameid;
     //stream_header.get("hash","md5sum")
     if (nb_messages < 3)
@@ -452,51 +797,105 @@ bool Stream::_ZmqThread::_read_zmq_messages(void *stream_socket)
     if (frameid == 0)
       DEB_TRACE() << DEB_VAR1(config_header["start_time"].asString());
 
-    if (!m_stopped)
-      _waitLimaFrame(frameid);
+    if (trace_start > 0)
+      Trace::complete("zmq receive", "frame", trace_start, Trace::now(),
+		      frameid);
 
-    if (m_stopped) {
-      DEB_TRACE() << "Stopped: ignoring data";
-      return true;
-    }
+    ImageDataPtr img_data = std::make_shared<ImageData>(pending_messages[2],
+							 m_decomp_fdim,
+							 m_comp_type,
+							 frameid);
+    m_stream._updatePreview(img_data, frameid, data_rx_tstamp);
+    m_stream.m_cam._frameReceived(frameid, data_rx_tstamp);
 
-    HwFrameInfoType frame_info;
-    frame_info.acq_frame_nb = frameid;
-    StdBufferCbMgr *buffer_mgr = m_stream.m_buffer_mgr;
     int data_size = data_header.get("size",-1).asInt();
-    HwAddData("eiger_data", frame_info,
-	      std::make_shared<ImageData>(pending_messages[2], m_decomp_fdim,
-					  m_comp_type));
-    {
-      AutoMutex stat_lock(m_stream.m_stat_lock);
-      if (frameid > 0) {
-	double transfer_time = data_rx_tstamp - m_last_data_tstamp;
-	m_stream.m_stat.add(data_size, transfer_time);
-      }
-      m_last_data_tstamp = data_rx_tstamp;
+    s_metrics.frames_received.add();
+    if (data_size > 0)
+      s_metrics.bytes_received.add(data_size);
+    if (frameid > 0) {
+      double transfer_time = data_rx_tstamp - m_last_data_tstamp;
+      m_stream.m_stat.update([&](StreamStatistics& stat) {
+	  stat.add(data_size, transfer_time, data_rx_tstamp);
+	});
     }
+    m_last_data_tstamp = data_rx_tstamp;
 
-    Camera& cam = m_stream.m_cam;
-    cam.newFrameAcquired();
-    bool continue_flag = buffer_mgr->newFrameReady(frame_info);
-    bool do_disarm = (m_ext_trigger && cam.allFramesAcquired());
-    if (!continue_flag && !do_disarm) {
-      DEB_WARNING() << "Unexpected " << DEB_VAR1(continue_flag) << ": "
-		    << "Disarming camera";
-      do_disarm = true;
+    // the filewriter archives all the frames: Lima only gets a decimated
+    // live feed, numbered consecutively
+    if (frameid % m_decimation)
+      return true;
+    int lima_frameid = frameid / m_decimation;
+
+    if (m_stopped) {
+      DEB_TRACE() << "Stopped: ignoring data";
+      s_metrics.frames_ignored.add();
+      return true;
+    } else if (m_stream.m_dispatch->checkFailed()) {
+      return false;
     }
-    if (do_disarm)
-      cam.disarm();
+
+    _DispatchThread::Frame frame{lima_frameid, img_data, m_ext_trigger,
+				 m_filewriter_active};
+    int depth;
+    double stall_time;
+    m_stream.m_dispatch->push(frame, depth, stall_time);
+    m_stream._addBackpressure(data_rx_tstamp, m_zmq_backlog, depth,
+			      stall_time);
     return true;
   } else if (htype.find("dseries_end-") != std::string::npos) {
     DEB_TRACE() << "Finishing";
-    return false;
+    m_stream.m_dispatch->drain();
+    if (!m_filewriter_active && m_stream.m_series_end_cb)
+      m_stream.m_series_end_cb(!m_stopped);
+    return _chainNextSeries();
   } else {
     DEB_WARNING() << "Unknown header: " << htype;
     return true;
   }
 }
 
+// In series chaining mode the socket is kept connected at the end of
+// a series, waiting for the next global header. The series armed in
+// advance but cancelled before being used also keep the socket
+bool Stream::_ZmqThread::_chainNextSeries()
+{
+  DEB_MEMBER_FUNCT();
+
+  Camera& cam = m_stream.m_cam;
+  bool chaining;
+  cam.getSeriesChaining(chaining);
+  {
+    AutoMutex lock(m_cond.mutex());
+    bool cancelled = (m_stream.m_chained && (m_state == Armed));
+    bool finished = (m_state == Running);
+    DEB_TRACE() << DEB_VAR4(chaining, cancelled, finished, m_state);
+    if (!cancelled && !(chaining && finished))
+      return false;
+    if (cancelled) {
+      m_state = Connected;
+      m_waiting_global_header = true;
+      m_cond.broadcast();
+      return true;
+    }
+  }
+
+  // arm the next series before the acquisition is seen as finished
+  cam._seriesFinished();
+
+  AutoMutex lock(m_cond.mutex());
+  if (m_state != Running)
+    return false;
+  DEB_TRACE() << "Waiting for next series";
+  m_stream.m_chained = true;
+  m_state = Connected;
+  m_stopped = false;
+  m_waiting_global_header = true;
+  m_last_frame = -1;
+  m_stream.m_dispatch->checkFailed();
+  m_cond.broadcast();
+  return true;
+}
+
 void Stream::_ZmqThread::_checkCompression(const StreamInfo& info)
 {
   DEB_MEMBER_FUNCT();
@@ -536,39 +935,58 @@ void Stream::_ZmqThread::_checkCompression(const StreamInfo& info)
     THROW_HW_ERROR(Error) << "Unexpected compression type: " << comp_type;
 }
 
-void Stream::_ZmqThread::_waitLimaFrame(int frameid)
-{
-  DEB_MEMBER_FUNCT();
-  DEB_PARAM() << DEB_VAR1(frameid);
-
-  bool available = false;
-  AutoMutex lock(m_cond.mutex());
-  while (true) {
-    m_stopped = ((m_state == Stopped) || (m_state == Aborting));
-    if (m_stopped || available)
-      break;
-    typedef SoftBufferCtrlObj::Sync BufferSync;
-    BufferSync::Status status = m_stream.m_buffer_sync->wait(frameid);
-    if (status == BufferSync::AVAILABLE)
-      available = true;
-    else if (status != BufferSync::INTERRUPTED)
-      THROW_HW_ERROR(Error) << "Buffer sync wait error: " << status;
-  }
-}
-
 //			 --- Stream class ---
 inline bool Stream::_isRunning() const
 {
   return ((m_state != Idle) && (m_state != Failed));
 }
 
-Stream::Stream(Camera& cam,const char* mmap_file) :
+inline bool Stream::_isChainedReady() const
+{
+  return (m_chained && ((m_state == Connected) || (m_state == Armed)));
+}
+
+Stream::Stream(Camera& cam,const char* mmap_file,long long hugepage_size,
+	       int numa_node) :
   m_cam(cam),
-  m_header_detail(OFF)
+  m_header_detail(OFF),
+  m_chained(false),
+  m_armed_serie_id(-1),
+  m_filewriter_active(false),
+  m_decimation(1),
+  m_lima_decimation(1),
+  m_preview_enabled(false),
+  m_preview_rate(0),
+  m_preview_bin(1),
+  m_preview_frame(-1),
+  m_preview_seq(0),
+  m_preview_image_seq(0),
+  m_preview_image_bin(1),
+  m_buffer_wait_total(0),
+  m_lima_counters(std::make_shared<LimaFrameCounters>())
 {
   DEB_CONSTRUCTOR();
 
-  m_buffer_alloc_mgr = mmap_file ? new MmapFileBufferAllocMgr(mmap_file) : NULL;
+  m_buffer_alloc_mgr = NULL;
+  if (mmap_file) {
+    m_buffer_alloc_mgr = new MmapFileBufferAllocMgr(mmap_file);
+  } else if (hugepage_size) {
+    if (numa_node < 0)
+      numa_node = HugePageBufferAllocMgr::getHostNumaNode(
+						cam.getDetectorHost());
+    m_buffer_alloc_mgr = new HugePageBufferAllocMgr(hugepage_size,
+						    numa_node);
+    // keep the receive thread next to the NIC and the buffers
+    std::string cpus;
+    ThreadPlacement::getCpus(ThreadPlacement::Receive, cpus);
+    if ((numa_node >= 0) && cpus.empty()) {
+      cpus = HugePageBufferAllocMgr::getNumaNodeCpus(numa_node);
+      DEB_TRACE() << "Receive thread on NUMA node " << numa_node << ": "
+		  << DEB_VAR1(cpus);
+      if (!cpus.empty())
+	ThreadPlacement::setCpus(ThreadPlacement::Receive, cpus);
+    }
+  }
   m_buffer_ctrl_obj = new SoftBufferCtrlObj(m_buffer_alloc_mgr);
 
   
@@ -583,6 +1001,7 @@ Stream::Stream(Camera& cam,const char* mmap_file) :
     THROW_HW_ERROR(Error) << "Can't open pipe";
 
   m_state = Init;
+  m_dispatch.reset(new _DispatchThread(*this));
   m_thread.reset(new _ZmqThread(*this));
 
   AutoMutex lock(m_cond.mutex());
@@ -603,6 +1022,7 @@ Stream::~Stream()
   }
 
   m_thread->join();
+  m_dispatch.reset();
 
   close(m_pipes[0]),close(m_pipes[1]);
   delete m_buffer_ctrl_obj;
@@ -635,6 +1055,7 @@ void Stream::start()
     THROW_HW_ERROR(Error) << "Stream is not Armed (no global header)";
   DEB_TRACE() << "Running";
   m_state = Running;
+  m_chained = false;
   m_buffer_mgr->setStartTimestamp(Timestamp::now());
 }
 
@@ -642,6 +1063,9 @@ void Stream::stop()
 {
   DEB_MEMBER_FUNCT();
   AutoMutex aLock(m_cond.mutex());
+  // keep the connection waiting for the next chained series
+  if (_isChainedReady())
+    return;
   bool connected = (m_state == Connected);
   if (!_isRunning() || connected) {
     if (connected)
@@ -693,7 +1117,7 @@ bool Stream::isRunning() const
   DEB_MEMBER_FUNCT();
   AutoMutex aLock(m_cond.mutex());
   DEB_TRACE() << DEB_VAR1(m_state);
-  bool running = _isRunning();
+  bool running = (_isRunning() && !_isChainedReady());
   DEB_RETURN() << DEB_VAR1(running);
   return running;
 }
@@ -710,6 +1134,41 @@ void Stream::setHeaderDetail(Stream::HeaderDetail detail)
   m_header_detail = detail;
 }
 
+bool Stream::isActive() const
+{
+  AutoMutex lock(m_cond.mutex());
+  return m_active;
+}
+
+void Stream::setFileWriterActive(bool active)
+{
+  AutoMutex lock(m_cond.mutex());
+  m_filewriter_active = active;
+  m_lima_decimation = active ? m_decimation : 1;
+}
+
+void Stream::setDecimation(int decimation)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(decimation);
+  if (decimation < 1)
+    THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(decimation);
+  AutoMutex lock(m_cond.mutex());
+  m_decimation = decimation;
+}
+
+void Stream::getDecimation(int& decimation) const
+{
+  AutoMutex lock(m_cond.mutex());
+  decimation = m_decimation;
+}
+
+void Stream::getLimaDecimation(int& decimation) const
+{
+  AutoMutex lock(m_cond.mutex());
+  decimation = m_lima_decimation;
+}
+
 void Stream::setActive(bool active)
 {
   DEB_MEMBER_FUNCT();
@@ -720,7 +1179,8 @@ void Stream::setActive(bool active)
 
   bool is_ready = ((m_state == Connected) || (m_state == Armed));
   bool do_abort = (!active && is_ready);
-  if(!do_abort && _isRunning()) {
+  bool keep_chained = (active && _isChainedReady());
+  if(!do_abort && !keep_chained && _isRunning()) {
     DEB_WARNING() << "Stream is Running: Aborting!";
     do_abort = true;
   }
@@ -763,14 +1223,19 @@ void Stream::setActive(bool active)
   }
 }
 
-void Stream::waitArmed(double timeout)
+void Stream::waitArmed(double timeout, int serie_id)
 {
   DEB_MEMBER_FUNCT();
-  DEB_PARAM() << DEB_VAR1(timeout);
+  DEB_PARAM() << DEB_VAR2(timeout, serie_id);
   AutoMutex lock(m_cond.mutex());
   Timestamp t0 = Timestamp::now();
-  DEB_TRACE() << DEB_VAR1(m_state);
-  while(m_state == Connected) {
+  DEB_TRACE() << DEB_VAR2(m_state, m_armed_serie_id);
+  // a chained connection can hold the header of a cancelled series
+  auto other_serie = [&]() {
+    return ((m_state == Armed) && (serie_id >= 0) &&
+	    (m_armed_serie_id >= 0) && (m_armed_serie_id != serie_id));
+  };
+  while((m_state == Connected) || other_serie()) {
     double elapsed = Timestamp::now() - t0;
     if (elapsed >= timeout)
       break;
@@ -778,7 +1243,7 @@ void Stream::waitArmed(double timeout)
   }
   if (m_state == Failed)
     m_state = Idle;
-  if (m_state != Armed)
+  if ((m_state != Armed) || other_serie())
     THROW_HW_ERROR(Error) << "Global header not received";
 }
 
@@ -798,16 +1263,275 @@ void Stream::getLastStreamInfo(StreamInfo& last_info)
 void Stream::resetStatistics()
 {
   DEB_MEMBER_FUNCT();
-  AutoMutex stat_lock(m_stat_lock);
   m_stat.reset();
+  m_dispatch_stat.reset();
 }
 
 void Stream::latchStatistics(StreamStatistics& stat, bool reset)
 {
   DEB_MEMBER_FUNCT();
-  AutoMutex stat_lock(m_stat_lock);
-  stat = m_stat;
-  if (reset)
-    m_stat.reset();
+  m_stat.latch(stat, reset);
+  StreamStatistics dispatch_stat;
+  m_dispatch_stat.latch(dispatch_stat, reset);
+  stat.merge(dispatch_stat);
   DEB_RETURN() << DEB_VAR1(stat);
 }
+
+void Stream::setSeriesEndCallback(SeriesEndCallback cb)
+{
+  DEB_MEMBER_FUNCT();
+  m_series_end_cb = cb;
+}
+
+const double Stream::BACKPRESSURE_PERIOD = 0.1;
+
+// Dispatch thread
+void Stream::_addBufferWait(double wait)
+{
+  m_dispatch_stat.update([&](StreamStatistics& stat) {
+      stat.stat_buffer_wait.add(wait);
+    });
+  double total = m_buffer_wait_total.load(std::memory_order_relaxed);
+  m_buffer_wait_total.store(total + wait, std::memory_order_relaxed);
+  s_metrics.buffer_wait.add(wait);
+}
+
+// Zmq thread, after each frame push
+void Stream::_addBackpressure(Timestamp tstamp, int zmq_backlog,
+			      int dispatch_depth, double stall_time)
+{
+  const LimaFrameCounters& counters = *m_lima_counters;
+  int dispatched = counters.dispatched;
+  int lima_occupancy = dispatched - counters.decode_done;
+  int decompress_depth = dispatched - counters.decode_started;
+  m_stat.update([&](StreamStatistics& stat) {
+      stat.add_dispatch(dispatch_depth, stall_time);
+      stat.add_backpressure(lima_occupancy, decompress_depth, zmq_backlog);
+    });
+  if (stall_time > 0) {
+    s_metrics.dispatch_stalls.add();
+    s_metrics.stall_time.add(stall_time);
+  }
+  s_metrics.lima_occupancy.set(lima_occupancy);
+  s_metrics.decompress_depth.set(decompress_depth);
+  s_metrics.dispatch_depth.set(dispatch_depth);
+  s_metrics.zmq_backlog.set(zmq_backlog);
+
+  if (m_history_tstamp.isSet() &&
+      (tstamp - m_history_tstamp < BACKPRESSURE_PERIOD))
+    return;
+  m_history_tstamp = tstamp;
+  BackpressureSample sample{tstamp, lima_occupancy, decompress_depth,
+			    zmq_backlog, dispatch_depth,
+			    m_buffer_wait_total.load()};
+  AutoMutex lock(m_history_lock);
+  if (m_history.size() == BACKPRESSURE_SAMPLES)
+    m_history.pop_front();
+  m_history.push_back(sample);
+}
+
+void Stream::getBackpressureHistory(Data& history)
+{
+  DEB_MEMBER_FUNCT();
+  const int nb_columns = 6;
+  AutoMutex lock(m_history_lock);
+  int nb_samples = m_history.size();
+  Data data;
+  if (nb_samples) {
+    Buffer *buffer = new Buffer(nb_samples * nb_columns * sizeof(double));
+    data.setBuffer(buffer);
+    buffer->unref();
+    double *p = (double *) data.data();
+    for (const auto& sample : m_history) {
+      *p++ = sample.time;
+      *p++ = sample.lima_occupancy;
+      *p++ = sample.decompress_depth;
+      *p++ = sample.zmq_backlog;
+      *p++ = sample.dispatch_depth;
+      *p++ = sample.buffer_wait;
+    }
+    data.type = Data::DOUBLE;
+    data.dimensions.push_back(nb_columns);
+    data.dimensions.push_back(nb_samples);
+  }
+  history = data;
+  DEB_RETURN() << DEB_VAR1(nb_samples);
+}
+
+void Stream::setPreviewRate(double max_rate)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(max_rate);
+  if (max_rate < 0)
+    THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(max_rate);
+  AutoMutex lock(m_preview_lock);
+  m_preview_rate = max_rate;
+  m_preview_enabled = (max_rate > 0);
+  if (max_rate == 0) {
+    m_preview_data.reset();
+    m_preview_image = Data();
+  }
+}
+
+void Stream::getPreviewRate(double& max_rate) const
+{
+  AutoMutex lock(m_preview_lock);
+  max_rate = m_preview_rate;
+}
+
+void Stream::setPreviewBinning(int bin)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(bin);
+  if (bin < 1)
+    THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(bin);
+  AutoMutex lock(m_preview_lock);
+  m_preview_bin = bin;
+}
+
+void Stream::getPreviewBinning(int& bin) const
+{
+  AutoMutex lock(m_preview_lock);
+  bin = m_preview_bin;
+}
+
+// called for every frame by the Zmq thread: only keeps a reference
+void Stream::_updatePreview(ImageDataPtr img_data, int frameid,
+			    Timestamp tstamp)
+{
+  if (!m_preview_enabled)
+    return;
+  AutoMutex lock(m_preview_lock);
+  if ((m_preview_rate <= 0) ||
+      (m_preview_data && (tstamp - m_preview_tstamp < 1 / m_preview_rate)))
+    return;
+  m_preview_data = img_data;
+  m_preview_frame = frameid;
+  m_preview_tstamp = tstamp;
+  ++m_preview_seq;
+}
+
+void Stream::getPreviewImage(Data& image)
+{
+  DEB_MEMBER_FUNCT();
+
+  ImageDataPtr img_data;
+  int frameid, bin;
+  Timestamp tstamp;
+  unsigned long seq;
+  {
+    AutoMutex lock(m_preview_lock);
+    if (!m_preview_data || ((m_preview_image_seq == m_preview_seq) &&
+			    (m_preview_image_bin == m_preview_bin))) {
+      image = m_preview_image;
+      return;
+    }
+    img_data = m_preview_data;
+    frameid = m_preview_frame;
+    tstamp = m_preview_tstamp;
+    seq = m_preview_seq;
+    bin = m_preview_bin;
+  }
+
+  // decoded by the caller thread, without any lock held
+  Data decoded;
+  try {
+    _decodePreview(*img_data, bin, decoded);
+  } catch (ProcessException& e) {
+    THROW_HW_ERROR(Error) << "Preview decoding error: " << e.getErrMsg();
+  }
+  decoded.frameNumber = frameid;
+  decoded.timestamp = tstamp;
+
+  AutoMutex lock(m_preview_lock);
+  if (seq > m_preview_image_seq) {
+    m_preview_image = decoded;
+    m_preview_image_seq = seq;
+    m_preview_image_bin = bin;
+  }
+  image = decoded;
+}
+
+template <typename T>
+static void _binPreview(const void *src_data, int width, int height, int bin,
+			unsigned int *dst)
+{
+  // the masked/defective pixels are flagged with the maximum value
+  const T masked = std::numeric_limits<T>::max();
+  const unsigned long long max_sum = std::numeric_limits<unsigned int>::max() - 1;
+  const T *src = (const T *) src_data;
+  int out_width = width / bin, out_height = height / bin;
+  std::vector<unsigned long long> sums(out_width);
+  std::vector<char> valid(out_width);
+  for (int y = 0; y < out_height; ++y) {
+    std::fill(sums.begin(), sums.end(), 0);
+    std::fill(valid.begin(), valid.end(), 0);
+    for (int j = 0; j < bin; ++j) {
+      const T *row = src + size_t(y * bin + j) * width;
+      for (int x = 0; x < out_width * bin; ++x) {
+	T v = row[x];
+	if ((v == masked) || (std::is_signed<T>::value && (v < 0)))
+	  continue;
+	sums[x / bin] += v;
+	valid[x / bin] = 1;
+      }
+    }
+    for (int x = 0; x < out_width; ++x)
+      *dst++ = valid[x] ? std::min(sums[x], max_sum) : max_sum + 1;
+  }
+}
+
+void Stream::_decodePreview(const ImageData& img_data, int bin, Data& image)
+{
+  DEB_STATIC_FUNCT();
+
+  const FrameDim& fdim = img_data.decomp_fdim;
+  Size size = fdim.getSize();
+  int width = size.getWidth(), height = size.getHeight();
+  int depth = fdim.getDepth();
+  ImageType image_type = fdim.getImageType();
+  bool is_signed = ((image_type == Bpp8S) || (image_type == Bpp16S) ||
+		    (image_type == Bpp32S));
+
+  void *msg_data;
+  size_t msg_size;
+  img_data.getMsgDataNSize(msg_data, msg_size);
+  Buffer *buffer = new Buffer(width * height * depth);
+  Data full;
+  full.setBuffer(buffer);
+  buffer->unref();
+  Decompress::decode(msg_data, img_data.comp_type, depth, full.data(), depth,
+		     width * height);
+
+  if (bin == 1) {
+    switch (depth) {
+    case 1: full.type = is_signed ? Data::INT8 : Data::UINT8; break;
+    case 2: full.type = is_signed ? Data::INT16 : Data::UINT16; break;
+    default: full.type = is_signed ? Data::INT32 : Data::UINT32;
+    }
+    full.dimensions.push_back(width);
+    full.dimensions.push_back(height);
+    image = full;
+    return;
+  }
+
+  int out_width = width / bin, out_height = height / bin;
+  if (!out_width || !out_height)
+    THROW_HW_ERROR(InvalidValue) << "Preview " << DEB_VAR1(bin) << " too large";
+  buffer = new Buffer(out_width * out_height * sizeof(unsigned int));
+  image.setBuffer(buffer);
+  buffer->unref();
+  image.type = Data::UINT32;
+  image.dimensions.push_back(out_width);
+  image.dimensions.push_back(out_height);
+  unsigned int *dst = (unsigned int *) image.data();
+  void *src = full.data();
+  switch (image_type) {
+  case Bpp8: _binPreview<unsigned char>(src, width, height, bin, dst); break;
+  case Bpp8S: _binPreview<signed char>(src, width, height, bin, dst); break;
+  case Bpp16: _binPreview<unsigned short>(src, width, height, bin, dst); break;
+  case Bpp16S: _binPreview<short>(src, width, height, bin, dst); break;
+  case Bpp32S: _binPreview<int>(src, width, height, bin, dst); break;
+  default: _binPreview<unsigned int>(src, width, height, bin, dst);
+  }
+}
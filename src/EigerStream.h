@@ -31,9 +31,13 @@
 #include "lima/HwBufferMgr.h"
 
 #include "EigerStatistics.h"
+#include "processlib/Data.h"
 
 #include <json/json.h>
 
+#include <atomic>
+#include <deque>
+
 namespace lima
 {
   namespace Eiger
@@ -50,25 +54,49 @@ namespace lima
       enum State {Init,Idle,Starting,Connected,Failed,Armed,Running,
 		  Stopped,Aborting,Quitting};
 
+      // frames passed to Lima, whose decompression started and is done.
+      // Shared with the frames, that can outlive the Stream
+      struct LimaFrameCounters {
+	std::atomic<int> dispatched{0};
+	std::atomic<int> decode_started{0};
+	std::atomic<int> decode_done{0};
+      };
+      typedef std::shared_ptr<LimaFrameCounters> LimaFrameCountersPtr;
+
       struct ImageData : public sideband::Data {
 	MessagePtr msg;
 	FrameDim decomp_fdim;
 	CompressionType comp_type;
-
-	ImageData(MessagePtr m,	FrameDim d, CompressionType c)
-	  : msg(m), decomp_fdim(d), comp_type(c) {}
+	int frameid;
+	// set when passed to Lima
+	LimaFrameCountersPtr lima_counters;
+	bool decode_started;
+	bool decode_done;
+
+	ImageData(MessagePtr m,	FrameDim d, CompressionType c, int f = -1)
+	  : msg(m), decomp_fdim(d), comp_type(c), frameid(f),
+	    decode_started(false), decode_done(false) {}
+	// the message buffer is released. A frame dropped by Lima
+	// without decompression is counted as done
+	~ImageData();
 
 	void getMsgDataNSize(void*& data, size_t& size) const;
+	void decodeStarted();
+	void decodeDone();
       };
+      typedef std::shared_ptr<ImageData> ImageDataPtr;
 
-      Stream(Camera&,const char* mmap_file=NULL);
+      // hugepage_size (2 MB or 1 GB, 0 disables it) and numa_node (< 0:
+      // node of the detector network interface) are ignored with mmap_file
+      Stream(Camera&,const char* mmap_file=NULL,long long hugepage_size=0,
+	     int numa_node=-1);
       ~Stream();
 
       void start();
       void stop();
       void abort();
       bool isRunning() const;
-      void waitArmed(double timeout);
+      void waitArmed(double timeout, int serie_id = -1);
 
       void getHeaderDetail(HeaderDetail&) const;
       void setHeaderDetail(HeaderDetail);
@@ -76,16 +104,48 @@ namespace lima
       void setActive(bool);
       bool isActive() const;
 
+      // stream running along the filewriter: the frames are not counted
+      // and only one every decimation is passed to Lima, as frame
+      // frameid / decimation. The decimation is latched when activated
+      void setFileWriterActive(bool active);
+      void setDecimation(int decimation);
+      void getDecimation(int& decimation) const;
+      void getLimaDecimation(int& decimation) const;
+
       HwBufferCtrlObj* getBufferCtrlObj();
 
       void getLastStreamInfo(StreamInfo& info);
 
       void resetStatistics();
       void latchStatistics(StreamStatistics& stat, bool reset=false);
+      // backpressure time series, one sample at most every
+      // BACKPRESSURE_PERIOD (s) at frame push, the last
+      // BACKPRESSURE_SAMPLES kept. A DOUBLE image, one row per sample:
+      // time, lima_occupancy, decompress_depth, zmq_backlog,
+      // dispatch_depth and buffer_wait (total s)
+      void getBackpressureHistory(Data& history);
+
+      // called by the Zmq thread at the end of each series without
+      // filewriter, ok if not stopped. Set before the first acquisition
+      typedef std::function<void(bool ok)> SeriesEndCallback;
+      void setSeriesEndCallback(SeriesEndCallback cb);
+
+      // display preview: the most recent frame is kept at up to max_rate
+      // (Hz, 0 disables it) and only decoded by the preview reader,
+      // outside of the acquisition pipeline
+      void setPreviewRate(double max_rate);
+      void getPreviewRate(double& max_rate) const;
+      // bin x bin pixels summed in uint32, the masked ones excluded
+      void setPreviewBinning(int bin);
+      void getPreviewBinning(int& bin) const;
+      // empty if none yet
+      void getPreviewImage(Data& image);
 
     private:
       class _ZmqThread;
       friend class _ZmqThread;
+      class _DispatchThread;
+      friend class _DispatchThread;
 
       typedef std::vector<MessagePtr> MessageList;
 
@@ -93,6 +153,7 @@ namespace lima
       using Cache = Camera::Cache<T>;
 
       bool _isRunning() const;
+      bool _isChainedReady() const;
 
       void _send_synchro();
       void _abort();
@@ -100,6 +161,26 @@ namespace lima
       void _setStreamMode(bool enabled);
       bool _getStreamMode();
 
+      void _updatePreview(ImageDataPtr img_data, int frameid,
+			  Timestamp tstamp);
+      static void _decodePreview(const ImageData& img_data, int bin,
+				 Data& image);
+
+      struct BackpressureSample {
+	double time;
+	int lima_occupancy;
+	int decompress_depth;
+	int zmq_backlog;
+	int dispatch_depth;
+	double buffer_wait;
+      };
+      static const double BACKPRESSURE_PERIOD;
+      static const unsigned BACKPRESSURE_SAMPLES = 4096;
+
+      void _addBufferWait(double wait);
+      void _addBackpressure(Timestamp tstamp, int zmq_backlog,
+			    int dispatch_depth, double stall_time);
+
       Camera&		m_cam;
       mutable Cond	m_cond;
       bool		m_active;
@@ -107,10 +188,16 @@ namespace lima
       State		m_state;
       HeaderDetail	m_header_detail;
       Cache<std::string> m_header_detail_str;
+      bool		m_chained;
+      int		m_armed_serie_id;
+      bool		m_filewriter_active;
+      int		m_decimation;
+      int		m_lima_decimation;
 
       int		m_pipes[2];
       StreamInfo	m_last_info;
 
+      std::unique_ptr<_DispatchThread>		m_dispatch;
       std::unique_ptr<_ZmqThread>		m_thread;
 
       BufferAllocMgr*                           m_buffer_alloc_mgr;
@@ -118,8 +205,29 @@ namespace lima
       StdBufferCbMgr*				m_buffer_mgr;
       SoftBufferCtrlObj::Sync*			m_buffer_sync;
 
-      Mutex             m_stat_lock;
-      StreamStatistics	m_stat;
+      // written by the Zmq thread only
+      StatisticsShard<StreamStatistics> m_stat;
+      // written by the Dispatch thread only, merged when latched
+      StatisticsShard<StreamStatistics> m_dispatch_stat;
+      std::atomic<double> m_buffer_wait_total;
+      LimaFrameCountersPtr m_lima_counters;
+      SeriesEndCallback	m_series_end_cb;
+
+      Mutex		m_history_lock;
+      std::deque<BackpressureSample> m_history;
+      Timestamp		m_history_tstamp;
+
+      mutable Mutex	m_preview_lock;
+      std::atomic<bool>	m_preview_enabled;
+      double		m_preview_rate;
+      int		m_preview_bin;
+      ImageDataPtr	m_preview_data;
+      int		m_preview_frame;
+      Timestamp		m_preview_tstamp;
+      unsigned long	m_preview_seq;
+      Data		m_preview_image;
+      unsigned long	m_preview_image_seq;
+      int		m_preview_image_bin;
     };
 
     std::ostream& operator <<(std::ostream& os, Stream::State state);
@@ -0,0 +1,392 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9 
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+
+#include "EigerThreadPlacement.h"
+#include "EigerTestHooks.h"
+#include "lima/Exceptions.h"
+#include "lima/ThreadUtils.h"
+
+using namespace lima;
+using namespace lima::Eiger;
+
+static const char *ThreadClassNames[ThreadPlacement::NbThreadClasses] = {
+  "receive", "dispatch", "curl", "polling", "decompress",
+};
+
+// "0-3,8" style, as taskset -c
+static bool _parseCpuList(const std::string& cpus, cpu_set_t& cpu_set)
+{
+  CPU_ZERO(&cpu_set);
+  std::istringstream is(cpus);
+  std::string item;
+  bool empty = true;
+  while (std::getline(is, item, ',')) {
+    std::istringstream is_item(item);
+    int first, last;
+    char dash;
+    if (!(is_item >> first))
+      return false;
+    last = first;
+    if ((is_item >> dash) && ((dash != '-') || !(is_item >> last)))
+      return false;
+    if (!(is_item >> std::ws).eof() || (first < 0) || (last < first) ||
+	(last >= CPU_SETSIZE))
+      return false;
+    for (int cpu = first; cpu <= last; ++cpu)
+      CPU_SET(cpu, &cpu_set);
+    empty = false;
+  }
+  return !empty;
+}
+
+static std::string _formatCpuList(const cpu_set_t& cpu_set)
+{
+  std::ostringstream os;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (!CPU_ISSET(cpu, &cpu_set))
+      continue;
+    int last = cpu;
+    while ((last + 1 < CPU_SETSIZE) && CPU_ISSET(last + 1, &cpu_set))
+      ++last;
+    if (os.tellp() > 0)
+      os << ',';
+    os << cpu;
+    if (last > cpu)
+      os << '-' << last;
+    cpu = last;
+  }
+  return os.str();
+}
+
+static std::string _errorString(int error)
+{
+  char buffer[256];
+  const char *error_msg = strerror_r(error, buffer, sizeof(buffer));
+  return error_msg;
+}
+
+struct ThreadPlacement::_State
+{
+  struct Entry {
+    ThreadClass cls;
+    pthread_t thread_id;
+    std::string name;
+  };
+
+  Mutex lock;
+  std::string cpus[NbThreadClasses];
+  cpu_set_t cpu_sets[NbThreadClasses];
+  // the process affinity, restored when the pinning is removed
+  cpu_set_t default_set;
+  int fifo_priority;
+  std::list<Entry> threads;
+
+  bool isConfigured(ThreadClass cls) const
+  { return !cpus[cls].empty() || ((cls == Receive) && fifo_priority); }
+
+  int apply(ThreadClass cls, pthread_t thread_id) const
+  {
+    const cpu_set_t& cpu_set = cpus[cls].empty() ? default_set :
+						   cpu_sets[cls];
+    int ret = pthread_setaffinity_np(thread_id, sizeof(cpu_set), &cpu_set);
+    if (!ret && (cls == Receive)) {
+      struct sched_param param;
+      param.sched_priority = fifo_priority;
+      int policy = fifo_priority ? SCHED_FIFO : SCHED_OTHER;
+      ret = pthread_setschedparam(thread_id, policy, &param);
+    }
+    return ret;
+  }
+};
+
+// never destroyed: the pool threads can still register at exit
+ThreadPlacement::_State& ThreadPlacement::_getState()
+{
+  static _State *state = _createState();
+  return *state;
+}
+
+ThreadPlacement::_State *ThreadPlacement::_createState()
+{
+  DEB_STATIC_FUNCT();
+
+  _State *state = new _State();
+  if (sched_getaffinity(0, sizeof(state->default_set), &state->default_set)) {
+    CPU_ZERO(&state->default_set);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      CPU_SET(cpu, &state->default_set);
+  }
+
+  for (int i = 0; i < NbThreadClasses; ++i) {
+    std::string var = std::string("EIGER_") + ThreadClassNames[i] + "_CPUS";
+    std::transform(var.begin(), var.end(), var.begin(), ::toupper);
+    CPU_ZERO(&state->cpu_sets[i]);
+    const char *cpus = getenv(var.c_str());
+    if (!cpus || !*cpus)
+      continue;
+    if (_parseCpuList(cpus, state->cpu_sets[i]))
+      state->cpus[i] = cpus;
+    else
+      DEB_ERROR() << "Invalid " << var << ": " << cpus;
+    DEB_TRACE() << DEB_VAR2(var, state->cpus[i]);
+  }
+
+  state->fifo_priority = 0;
+  const char *priority = getenv("EIGER_RECEIVE_FIFO_PRIORITY");
+  if (priority && *priority) {
+    char *end;
+    long value = strtol(priority, &end, 10);
+    if (*end || (value < 0) || (value > sched_get_priority_max(SCHED_FIFO)))
+      DEB_ERROR() << "Invalid EIGER_RECEIVE_FIFO_PRIORITY: " << priority;
+    else
+      state->fifo_priority = value;
+    DEB_TRACE() << DEB_VAR1(state->fifo_priority);
+  }
+  return state;
+}
+
+bool ThreadPlacement::_applyClass(_State& state, ThreadClass cls,
+				  std::string& error)
+{
+  std::list<_State::Entry>::const_iterator i;
+  for (i = state.threads.begin(); i != state.threads.end(); ++i) {
+    if (i->cls != cls)
+      continue;
+    int ret = state.apply(cls, i->thread_id);
+    if (ret) {
+      error = "Could not place " + i->name + ": " + _errorString(ret);
+      return false;
+    }
+  }
+  return true;
+}
+
+ThreadPlacement::Registration::Registration(ThreadClass cls,
+					    const std::string& name)
+  : m_thread_id(pthread_self())
+{
+  registerThread(cls, m_thread_id, name);
+}
+
+ThreadPlacement::Registration::~Registration()
+{
+  unregisterThread(m_thread_id);
+}
+
+void ThreadPlacement::registerThread(ThreadClass cls, pthread_t thread_id,
+				     const std::string& name)
+{
+  DEB_STATIC_FUNCT();
+  DEB_PARAM() << DEB_VAR2(getThreadClassName(cls), name);
+
+  _State& state = _getState();
+  AutoMutex lock(state.lock);
+  state.threads.push_back({cls, thread_id, name});
+  if (!state.isConfigured(cls))
+    return;
+  int ret = state.apply(cls, thread_id);
+  if (ret)
+    DEB_WARNING() << "Could not place " << name << ": " << _errorString(ret);
+}
+
+void ThreadPlacement::unregisterThread(pthread_t thread_id)
+{
+  DEB_STATIC_FUNCT();
+  _State& state = _getState();
+  AutoMutex lock(state.lock);
+  std::list<_State::Entry>::iterator i;
+  for (i = state.threads.begin(); i != state.threads.end(); ++i) {
+    if (pthread_equal(i->thread_id, thread_id)) {
+      state.threads.erase(i);
+      break;
+    }
+  }
+}
+
+// unregisters the pool thread when it exits, its pthread_t is then
+// no longer valid
+struct _PoolThreadRegistration
+{
+  bool registered[ThreadPlacement::NbThreadClasses] = {};
+
+  ~_PoolThreadRegistration()
+  {
+    for (int cls = 0; cls < ThreadPlacement::NbThreadClasses; ++cls)
+      if (registered[cls])
+	ThreadPlacement::unregisterThread(pthread_self());
+  }
+};
+
+void ThreadPlacement::registerPoolThread(ThreadClass cls,
+					 const std::string& name)
+{
+  static thread_local _PoolThreadRegistration registration;
+  if (registration.registered[cls])
+    return;
+  registration.registered[cls] = true;
+
+  static std::atomic<int> nb_pool_threads(0);
+  std::ostringstream os;
+  os << name << " " << nb_pool_threads++;
+  registerThread(cls, pthread_self(), os.str());
+}
+
+void ThreadPlacement::setCpus(ThreadClass cls, const std::string& cpus)
+{
+  DEB_STATIC_FUNCT();
+  DEB_PARAM() << DEB_VAR2(getThreadClassName(cls), cpus);
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (!cpus.empty() && !_parseCpuList(cpus, cpu_set))
+    THROW_HW_ERROR(InvalidValue) << "Invalid CPU list: " << cpus;
+
+  _State& state = _getState();
+  AutoMutex lock(state.lock);
+  std::string prev_cpus = state.cpus[cls];
+  cpu_set_t prev_cpu_set = state.cpu_sets[cls];
+  state.cpus[cls] = cpus;
+  state.cpu_sets[cls] = cpu_set;
+  std::string error;
+  if (!_applyClass(state, cls, error)) {
+    state.cpus[cls] = prev_cpus;
+    state.cpu_sets[cls] = prev_cpu_set;
+    std::string ignored;
+    _applyClass(state, cls, ignored);
+    THROW_HW_ERROR(Error) << error;
+  }
+}
+
+void ThreadPlacement::getCpus(ThreadClass cls, std::string& cpus)
+{
+  DEB_STATIC_FUNCT();
+  _State& state = _getState();
+  AutoMutex lock(state.lock);
+  cpus = state.cpus[cls];
+  DEB_RETURN() << DEB_VAR1(cpus);
+}
+
+void ThreadPlacement::setReceiveFifoPriority(int priority)
+{
+  DEB_STATIC_FUNCT();
+  DEB_PARAM() << DEB_VAR1(priority);
+
+  int max_priority = sched_get_priority_max(SCHED_FIFO);
+  if ((priority < 0) || (priority > max_priority))
+    THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(priority) << ", "
+				 << "must be in [0, " << max_priority << "]";
+
+  _State& state = _getState();
+  AutoMutex lock(state.lock);
+  int prev_priority = state.fifo_priority;
+  state.fifo_priority = priority;
+  std::string error;
+  if (!_applyClass(state, Receive, error)) {
+    state.fifo_priority = prev_priority;
+    std::string ignored;
+    _applyClass(state, Receive, ignored);
+    THROW_HW_ERROR(Error) << error;
+  }
+}
+
+void ThreadPlacement::getReceiveFifoPriority(int& priority)
+{
+  DEB_STATIC_FUNCT();
+  _State& state = _getState();
+  AutoMutex lock(state.lock);
+  priority = state.fifo_priority;
+  DEB_RETURN() << DEB_VAR1(priority);
+}
+
+void ThreadPlacement::getPlacement(std::list<std::string>& placement)
+{
+  DEB_STATIC_FUNCT();
+  _State& state = _getState();
+  AutoMutex lock(state.lock);
+  placement.clear();
+  std::list<_State::Entry>::const_iterator i;
+  for (i = state.threads.begin(); i != state.threads.end(); ++i) {
+    std::ostringstream os;
+    os << i->name << " [" << getThreadClassName(i->cls) << "]: ";
+    cpu_set_t cpu_set;
+    if (!pthread_getaffinity_np(i->thread_id, sizeof(cpu_set), &cpu_set))
+      os << "cpus=" << _formatCpuList(cpu_set);
+    else
+      os << "cpus=?";
+    int policy;
+    struct sched_param param;
+    if (!pthread_getschedparam(i->thread_id, &policy, &param)) {
+      const char *policy_name = ((policy == SCHED_FIFO) ? "FIFO" :
+				 (policy == SCHED_RR) ? "RR" : "OTHER");
+      os << ", policy=" << policy_name
+	 << ", priority=" << param.sched_priority;
+    }
+    placement.push_back(os.str());
+  }
+}
+
+void ThreadPlacement::getCpuTimes(std::list<CpuTime>& cpu_times)
+{
+  DEB_STATIC_FUNCT();
+  _State& state = _getState();
+  AutoMutex lock(state.lock);
+  cpu_times.clear();
+  std::list<_State::Entry>::const_iterator i;
+  for (i = state.threads.begin(); i != state.threads.end(); ++i) {
+    clockid_t clock_id;
+    struct timespec ts;
+    if (pthread_getcpuclockid(i->thread_id, &clock_id) ||
+	clock_gettime(clock_id, &ts))
+      continue;
+    cpu_times.push_back({i->cls, i->name, ts.tv_sec + ts.tv_nsec * 1e-9});
+  }
+}
+
+ThreadPlacement::ThreadClass
+ThreadPlacement::getThreadClass(const std::string& name)
+{
+  DEB_STATIC_FUNCT();
+  for (int i = 0; i < NbThreadClasses; ++i)
+    if (name == ThreadClassNames[i])
+      return ThreadClass(i);
+  THROW_HW_ERROR(InvalidValue) << "Invalid thread class: " << name;
+}
+
+const char *ThreadPlacement::getThreadClassName(ThreadClass cls)
+{
+  return ThreadClassNames[cls];
+}
+
+bool TestHooks::parseCpuList(const std::string& cpus, cpu_set_t& cpu_set)
+{
+  return _parseCpuList(cpus, cpu_set);
+}
@@ -0,0 +1,99 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9 
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERTHREADPLACEMENT_H
+#define EIGERTHREADPLACEMENT_H
+
+#include <pthread.h>
+
+#include <list>
+#include <string>
+
+#include "lima/Debug.h"
+
+namespace lima
+{
+  namespace Eiger
+  {
+    // CPU placement of the plugin threads. Each thread class can be
+    // pinned to a CPU list ("0-3,8", empty for no pinning) and the
+    // receive thread can run SCHED_FIFO. The settings are process wide,
+    // they are applied at once to the registered threads and default to
+    // the environment:
+    //   EIGER_<CLASS>_CPUS, i.e. EIGER_RECEIVE_CPUS, EIGER_CURL_CPUS
+    //   EIGER_RECEIVE_FIFO_PRIORITY (1-99, 0 for normal scheduling)
+    class ThreadPlacement
+    {
+      DEB_CLASS_NAMESPC(DebModCamera,"ThreadPlacement","Eiger");
+    public:
+      enum ThreadClass {Receive, Dispatch, Curl, Polling, Decompress,
+			NbThreadClasses};
+
+      // the calling thread, for the lifetime of the object
+      class Registration
+      {
+      public:
+	Registration(ThreadClass cls, const std::string& name);
+	~Registration();
+      private:
+	pthread_t m_thread_id;
+      };
+
+      struct CpuTime
+      {
+	ThreadClass	cls;
+	std::string	name;
+	double		seconds;
+      };
+
+      static void registerThread(ThreadClass cls, pthread_t thread_id,
+				 const std::string& name);
+      static void unregisterThread(pthread_t thread_id);
+      // the calling thread is owned by a pool (i.e. processlib): only
+      // registered on the first call, unregistered when it exits
+      static void registerPoolThread(ThreadClass cls,
+				     const std::string& name);
+
+      static void setCpus(ThreadClass cls, const std::string& cpus);
+      static void getCpus(ThreadClass cls, std::string& cpus);
+      static void setReceiveFifoPriority(int priority);
+      static void getReceiveFifoPriority(int& priority);
+
+      // effective placement, one "<name>: cpus=..., policy=..." per thread
+      static void getPlacement(std::list<std::string>& placement);
+      // CPU time consumed so far by each registered thread
+      static void getCpuTimes(std::list<CpuTime>& cpu_times);
+
+      static ThreadClass getThreadClass(const std::string& name);
+      static const char *getThreadClassName(ThreadClass cls);
+
+    private:
+      struct _State;
+      static _State& _getState();
+      static _State *_createState();
+      static bool _applyClass(_State& state, ThreadClass cls,
+			      std::string& error);
+    };
+  }
+}
+#endif	// EIGERTHREADPLACEMENT_H
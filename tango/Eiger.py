@@ -46,6 +46,7 @@
 
 import PyTango
 import sys
+import numpy
 
 from Lima import Core
 from Lima.Server.AttrHelper import get_attr_string_value_list, get_attr_4u, getDictKey, getDictValue, CallableReadEnum
@@ -89,6 +90,10 @@ class Eiger(PyTango.LatestDeviceImpl):
                             'OFF':False}
         self.__ThresholdDiffMode = {'ON':True,
                                     'OFF':False}
+        self.__SeriesChaining = {'ON':True,
+                                 'OFF':False}
+        self.__TraceActive = {'ON':True,
+                              'OFF':False}
         self.__CompressionType = {'NONE': EigerAcq.Camera.NoCompression,
                                   'LZ4': EigerAcq.Camera.LZ4,
                                   'BSLZ4': EigerAcq.Camera.BSLZ4}
@@ -181,6 +186,48 @@ class Eiger(PyTango.LatestDeviceImpl):
         stream_stats_arr = self.latchStreamStatistics(False)
         attr.set_value(stream_stats_arr)
 
+#==================================================================
+#
+#    transfer_statistics
+#
+#==================================================================
+    @Core.DEB_MEMBER_FUNCT
+    def read_transfer_stats(self, attr):
+        transfer_stats_arr = self.latchTransferStatistics(False)
+        attr.set_value(transfer_stats_arr)
+
+#==================================================================
+#
+#    prepare_timing
+#
+#==================================================================
+    @Core.DEB_MEMBER_FUNCT
+    def read_prepare_timing(self, attr):
+        timing = _EigerInterface.getLastPrepareTiming()
+        attr.set_value([timing.disarm,
+                        timing.clear,
+                        timing.stream,
+                        timing.params,
+                        timing.arm,
+                        timing.stream_armed,
+                        timing.total])
+
+#==================================================================
+#
+#    trigger_latency
+#
+#==================================================================
+    @Core.DEB_MEMBER_FUNCT
+    def read_trigger_latency(self, attr):
+        latency = _EigerCamera.getTriggerLatency()
+        attr.set_value([latency.n(),
+                        latency.ave_first(),
+                        latency.std_first(),
+                        latency.max_first(),
+                        latency.ave_last(),
+                        latency.ave_command(),
+                        latency.ave_lag()])
+
     @Core.DEB_MEMBER_FUNCT
     def read_detector_ip(self, attr):
         ip_addr = self.detector_ip_address
@@ -221,6 +268,171 @@ class Eiger(PyTango.LatestDeviceImpl):
     def read_model_size(self, attr):
         attr.set_value(_EigerInterface.getModelSize())
 
+#==================================================================
+#
+#    mirror_directories
+#
+#==================================================================
+    @Core.DEB_MEMBER_FUNCT
+    def read_mirror_directories(self, attr):
+        dirs = _EigerInterface.getMirrorDirectories()
+        attr.set_value(list(dirs) if dirs else [""])
+
+    @Core.DEB_MEMBER_FUNCT
+    def write_mirror_directories(self, attr):
+        dirs = [d for d in attr.get_write_value() if d]
+        _EigerInterface.setMirrorDirectories(dirs)
+
+#==================================================================
+#
+#    performance_log_file
+#
+#==================================================================
+    @Core.DEB_MEMBER_FUNCT
+    def read_performance_log_file(self, attr):
+        attr.set_value(_EigerInterface.getPerformanceLogPath())
+
+    @Core.DEB_MEMBER_FUNCT
+    def write_performance_log_file(self, attr):
+        _EigerInterface.setPerformanceLogPath(attr.get_write_value())
+
+#==================================================================
+#
+#    metrics_port
+#
+#==================================================================
+    @Core.DEB_MEMBER_FUNCT
+    def read_metrics_port(self, attr):
+        attr.set_value(_EigerInterface.getMetricsPort())
+
+    @Core.DEB_MEMBER_FUNCT
+    def write_metrics_port(self, attr):
+        _EigerInterface.setMetricsPort(attr.get_write_value())
+
+#==================================================================
+#
+#    filewriter_stream
+#
+#==================================================================
+    @Core.DEB_MEMBER_FUNCT
+    def read_filewriter_stream(self, attr):
+        attr.set_value(_EigerInterface.getFileWriterStream())
+
+    @Core.DEB_MEMBER_FUNCT
+    def write_filewriter_stream(self, attr):
+        _EigerInterface.setFileWriterStream(attr.get_write_value())
+
+#==================================================================
+#
+#    stream_decimation
+#
+#==================================================================
+    @Core.DEB_MEMBER_FUNCT
+    def read_stream_decimation(self, attr):
+        attr.set_value(_EigerInterface.getStreamDecimation())
+
+    @Core.DEB_MEMBER_FUNCT
+    def write_stream_decimation(self, attr):
+        _EigerInterface.setStreamDecimation(attr.get_write_value())
+
+#==================================================================
+#
+#    monitor_rate, monitor_image
+#
+#==================================================================
+    @Core.DEB_MEMBER_FUNCT
+    def read_monitor_rate(self, attr):
+        attr.set_value(_EigerInterface.getMonitorRate())
+
+    @Core.DEB_MEMBER_FUNCT
+    def write_monitor_rate(self, attr):
+        _EigerInterface.setMonitorRate(attr.get_write_value())
+
+    @Core.DEB_MEMBER_FUNCT
+    def read_monitor_image(self, attr):
+        image = _EigerInterface.getMonitorImage()
+        data = image.buffer
+        if data is None or data.size == 0:
+            data = numpy.zeros((0, 0))
+        attr.set_value(data.astype(numpy.uint32))
+
+#==================================================================
+#
+#    stream_preview_rate, stream_preview_binning, stream_preview_image
+#
+#==================================================================
+    @Core.DEB_MEMBER_FUNCT
+    def read_stream_preview_rate(self, attr):
+        attr.set_value(_EigerInterface.getStreamPreviewRate())
+
+    @Core.DEB_MEMBER_FUNCT
+    def write_stream_preview_rate(self, attr):
+        _EigerInterface.setStreamPreviewRate(attr.get_write_value())
+
+    @Core.DEB_MEMBER_FUNCT
+    def read_stream_preview_binning(self, attr):
+        attr.set_value(_EigerInterface.getStreamPreviewBinning())
+
+    @Core.DEB_MEMBER_FUNCT
+    def write_stream_preview_binning(self, attr):
+        _EigerInterface.setStreamPreviewBinning(attr.get_write_value())
+
+    @Core.DEB_MEMBER_FUNCT
+    def read_stream_preview_image(self, attr):
+        image = _EigerInterface.getStreamPreviewImage()
+        data = image.buffer
+        if data is None or data.size == 0:
+            data = numpy.zeros((0, 0))
+        attr.set_value(data.astype(numpy.uint32))
+
+#==================================================================
+#
+#    stream_backpressure
+#
+#==================================================================
+    @Core.DEB_MEMBER_FUNCT
+    def read_stream_backpressure(self, attr):
+        history = _EigerInterface.getStreamBackpressureHistory()
+        data = history.buffer
+        if data is None or data.size == 0:
+            data = numpy.zeros((0, 6))
+        attr.set_value(data.astype(numpy.float64))
+
+#==================================================================
+#
+#    thread_cpus, receive_fifo_priority, thread_placement
+#
+#==================================================================
+    _ThreadClasses = ['receive', 'dispatch', 'curl', 'polling', 'decompress']
+
+    @Core.DEB_MEMBER_FUNCT
+    def read_thread_cpus(self, attr):
+        cpus = ['%s=%s' % (c, _EigerInterface.getThreadCpus(c))
+                for c in self._ThreadClasses]
+        attr.set_value(cpus)
+
+    @Core.DEB_MEMBER_FUNCT
+    def write_thread_cpus(self, attr):
+        for entry in attr.get_write_value():
+            thread_class, sep, cpus = entry.partition('=')
+            if not sep:
+                raise ValueError('Invalid entry %r, expected class=cpus' %
+                                 entry)
+            _EigerInterface.setThreadCpus(thread_class.strip(), cpus.strip())
+
+    @Core.DEB_MEMBER_FUNCT
+    def read_receive_fifo_priority(self, attr):
+        attr.set_value(_EigerInterface.getReceiveFifoPriority())
+
+    @Core.DEB_MEMBER_FUNCT
+    def write_receive_fifo_priority(self, attr):
+        _EigerInterface.setReceiveFifoPriority(attr.get_write_value())
+
+    @Core.DEB_MEMBER_FUNCT
+    def read_thread_placement(self, attr):
+        placement = _EigerInterface.getThreadPlacement()
+        attr.set_value(list(placement) if placement else [""])
+
 #==================================================================
 #
 #    Eiger command methods
@@ -250,7 +462,41 @@ class Eiger(PyTango.LatestDeviceImpl):
         return [stream_stats.n(),
                 stream_stats.ave_size(),
                 stream_stats.ave_time(),
-                stream_stats.ave_speed()]
+                stream_stats.ave_speed(),
+                stream_stats.ave_queue_depth(),
+                stream_stats.max_queue_depth(),
+                stream_stats.nb_stalls(),
+                stream_stats.stall_time(),
+                stream_stats.ave_lima_occupancy(),
+                stream_stats.max_lima_occupancy(),
+                stream_stats.ave_decompress_depth(),
+                stream_stats.max_decompress_depth(),
+                stream_stats.ave_zmq_backlog(),
+                stream_stats.max_zmq_backlog(),
+                stream_stats.ave_buffer_wait(),
+                stream_stats.buffer_wait_time(),
+                stream_stats.recent_speed()]
+
+#----------------------------------------------------------------------------
+#                      latch Transfer statistics
+#----------------------------------------------------------------------------
+    @Core.DEB_MEMBER_FUNCT
+    def latchTransferStatistics(self, reset):
+        transfer_stats = _EigerInterface.latchTransferStatistics(reset)
+        return [transfer_stats.n(),
+                transfer_stats.ave_size(),
+                transfer_stats.ave_time(),
+                transfer_stats.ave_speed(),
+                transfer_stats.throughput(),
+                transfer_stats.ave_wait(),
+                transfer_stats.in_flight,
+                transfer_stats.max_in_flight,
+                transfer_stats.nb_errors,
+                transfer_stats.nb_retries,
+                transfer_stats.buffer_free_last,
+                transfer_stats.buffer_free_trend(),
+                transfer_stats.nb_mirror_errors,
+                transfer_stats.nb_pending_mirrors]
 
 #----------------------------------------------------------------------------
 #                      reset high voltage
@@ -259,6 +505,13 @@ class Eiger(PyTango.LatestDeviceImpl):
     def resetHighVoltage(self):
         _EigerCamera.resetHighVoltage()
 
+#----------------------------------------------------------------------------
+#                      write the trace-event file
+#----------------------------------------------------------------------------
+    @Core.DEB_MEMBER_FUNCT
+    def writeTrace(self, path):
+        _EigerCamera.writeTrace(path)
+
 #==================================================================
 #
 #    EigerClass class definition
@@ -285,6 +538,15 @@ class EigerClass(PyTango.DeviceClass):
         'memory_mmap_file':
         [PyTango.DevString,
          "memory mmap file path",[]],        
+        'memory_hugepage_size':
+        [PyTango.DevString,
+         "Frame buffers in hugepages: 2M or 1G",[]],
+        'memory_numa_node':
+        [PyTango.DevLong,
+         "NUMA node of the hugepage buffers, -1 for the detector NIC node",[]],
+        'metrics_port':
+        [PyTango.DevLong,
+         "Prometheus metrics port on 127.0.0.1, 0 to disable",[]],
         }
 
 
@@ -302,9 +564,17 @@ class EigerClass(PyTango.DeviceClass):
         'latchStreamStatistics':
         [[PyTango.DevBoolean, "Reset statistics"],
          [PyTango.DevVarDoubleArray, "[<ave_size>, <ave_time>, <ave_speed>]"]],
+        'latchTransferStatistics':
+        [[PyTango.DevBoolean, "Reset statistics"],
+         [PyTango.DevVarDoubleArray, "[<n>, <ave_size>, <ave_time>, <ave_speed>, "
+          "<throughput>, <ave_wait>, <in_flight>, <max_in_flight>, <nb_errors>, "
+          "<nb_retries>, <buffer_free>, <buffer_free_trend>]"]],
         'resetHighVoltage':
         [[PyTango.DevVoid, ""],
          [PyTango.DevVoid, ""]],
+        'writeTrace':
+        [[PyTango.DevString, "Trace file path"],
+         [PyTango.DevVoid, ""]],
         }
 
 
@@ -362,6 +632,14 @@ class EigerClass(PyTango.DeviceClass):
             [[PyTango.DevString,
             PyTango.SCALAR,
             PyTango.READ_WRITE]],
+        'series_chaining':
+            [[PyTango.DevString,
+            PyTango.SCALAR,
+            PyTango.READ_WRITE]],
+        'trace_active':
+            [[PyTango.DevString,
+            PyTango.SCALAR,
+            PyTango.READ_WRITE]],
         'compression_type':
             [[PyTango.DevString,
             PyTango.SCALAR,
@@ -399,6 +677,18 @@ class EigerClass(PyTango.DeviceClass):
             PyTango.SCALAR,
             PyTango.READ]],
         'stream_stats':
+            [[PyTango.DevDouble,
+            PyTango.SPECTRUM,
+            PyTango.READ, 17]],
+        'transfer_stats':
+            [[PyTango.DevDouble,
+            PyTango.SPECTRUM,
+            PyTango.READ, 16]],
+        'prepare_timing':
+            [[PyTango.DevDouble,
+            PyTango.SPECTRUM,
+            PyTango.READ, 16]],
+        'trigger_latency':
             [[PyTango.DevDouble,
             PyTango.SPECTRUM,
             PyTango.READ, 16]],
@@ -422,6 +712,62 @@ class EigerClass(PyTango.DeviceClass):
             [[PyTango.DevBoolean,
             PyTango.SCALAR,
             PyTango.READ_WRITE]],
+        'mirror_directories':
+            [[PyTango.DevString,
+            PyTango.SPECTRUM,
+            PyTango.READ_WRITE, 8]],
+        'filewriter_stream':
+            [[PyTango.DevBoolean,
+            PyTango.SCALAR,
+            PyTango.READ_WRITE]],
+        'performance_log_file':
+            [[PyTango.DevString,
+            PyTango.SCALAR,
+            PyTango.READ_WRITE]],
+        'metrics_port':
+            [[PyTango.DevLong,
+            PyTango.SCALAR,
+            PyTango.READ_WRITE]],
+        'stream_decimation':
+            [[PyTango.DevLong,
+            PyTango.SCALAR,
+            PyTango.READ_WRITE]],
+        'monitor_rate':
+            [[PyTango.DevDouble,
+            PyTango.SCALAR,
+            PyTango.READ_WRITE]],
+        'monitor_image':
+            [[PyTango.DevULong,
+            PyTango.IMAGE,
+            PyTango.READ, 8192, 8192]],
+        'stream_backpressure':
+            [[PyTango.DevDouble,
+            PyTango.IMAGE,
+            PyTango.READ, 6, 4096]],
+        'stream_preview_rate':
+            [[PyTango.DevDouble,
+            PyTango.SCALAR,
+            PyTango.READ_WRITE]],
+        'stream_preview_binning':
+            [[PyTango.DevLong,
+            PyTango.SCALAR,
+            PyTango.READ_WRITE]],
+        'stream_preview_image':
+            [[PyTango.DevULong,
+            PyTango.IMAGE,
+            PyTango.READ, 8192, 8192]],
+        'thread_cpus':
+            [[PyTango.DevString,
+            PyTango.SPECTRUM,
+            PyTango.READ_WRITE, 8]],
+        'receive_fifo_priority':
+            [[PyTango.DevLong,
+            PyTango.SCALAR,
+            PyTango.READ_WRITE]],
+        'thread_placement':
+            [[PyTango.DevString,
+            PyTango.SPECTRUM,
+            PyTango.READ, 64]],
         }
 
 
@@ -447,6 +793,9 @@ def get_control(detector_ip_address = "0", **keys) :
         http_port = keys.pop('http_port', 80)
         stream_port = keys.pop('stream_port', 9999)
         mmap_file = keys.pop('memory_mmap_file',None)
+        hugepage_size = keys.pop('memory_hugepage_size',None)
+        numa_node = int(keys.pop('memory_numa_node',-1))
+        metrics_port = int(keys.pop('metrics_port',0))
         
         _EigerCamera = EigerAcq.Camera(detector_ip_address,
                                        http_port=http_port,
@@ -454,8 +803,19 @@ def get_control(detector_ip_address = "0", **keys) :
         if mmap_file is not None:
             print(f"Using memory map file {mmap_file}")
             _EigerInterface = EigerAcq.Interface(_EigerCamera,mmap_file.encode())
+        elif hugepage_size:
+            sizes = {'2M': 2 << 20, '1G': 1 << 30}
+            if hugepage_size.upper() not in sizes:
+                raise ValueError(f"Invalid memory_hugepage_size {hugepage_size}, "
+                                 "must be 2M or 1G")
+            print(f"Using {hugepage_size} hugepage buffers")
+            _EigerInterface = EigerAcq.Interface(_EigerCamera, None,
+                                                 sizes[hugepage_size.upper()],
+                                                 numa_node)
         else:
             _EigerInterface = EigerAcq.Interface(_EigerCamera)
+        if metrics_port:
+            _EigerInterface.setMetricsPort(metrics_port)
     return Core.CtControl(_EigerInterface)
 
 def get_tango_specific_class_n_device() :
@@ -0,0 +1,380 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2022
+// European Synchrotron Radiation Facility
+// CS40220 38043 Grenoble Cedex 9 
+// FRANCE
+//
+// Contact: lima@esrf.fr
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+
+// Unit tests of the plugin helpers, no detector needed
+
+#include <unistd.h>
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+#include "lima/Exceptions.h"
+#include "EigerStatistics.h"
+#include "EigerTestHooks.h"
+#include "BlockWriter.h"
+
+using namespace lima;
+using namespace lima::Eiger;
+
+static int nb_failed = 0;
+
+#define CHECK(cond)							\
+	do {								\
+		if (!(cond)) {						\
+			std::cerr << __FILE__ << ":" << __LINE__	\
+				  << ": check failed: " #cond		\
+				  << std::endl;				\
+			++nb_failed;					\
+		}							\
+	} while (0)
+
+#define CHECK_CLOSE(a, b, tol)	CHECK(std::fabs((a) - (b)) <= (tol))
+
+static std::vector<char> make_data(size_t size)
+{
+	std::vector<char> data(size);
+	unsigned int x = 12345;
+	for (size_t i = 0; i < size; ++i) {
+		x = x * 1103515245 + 12345;
+		data[i] = char(x >> 16);
+	}
+	return data;
+}
+
+static unsigned int adler32(const char *data, size_t size)
+{
+	eigerapi::Adler32 adler;
+	adler.update(data, size);
+	return adler.get();
+}
+
+static void test_adler32_combine()
+{
+	// larger than the 65521 modulus, and than the 5552 bytes blocks
+	std::vector<char> data = make_data(200000);
+	unsigned int whole = adler32(data.data(), data.size());
+	size_t splits[] = {0, 1, 5552, 65521, 65522, 100000, 199999, 200000};
+	for (size_t split : splits) {
+		unsigned int a1 = adler32(data.data(), split);
+		unsigned int a2 = adler32(data.data() + split,
+					  data.size() - split);
+		CHECK(eigerapi::Adler32::combine(a1, a2, data.size() - split)
+		      == whole);
+	}
+	// the empty block is neutral
+	CHECK(eigerapi::Adler32::combine(whole, eigerapi::Adler32().get(), 0)
+	      == whole);
+}
+
+static std::vector<char> read_file(const std::string& path)
+{
+	std::ifstream is(path.c_str(), std::ios::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(is),
+				 std::istreambuf_iterator<char>());
+}
+
+static void test_block_writer_flush_partial()
+{
+	typedef eigerapi::BlockWriter BlockWriter;
+	const size_t ALIGNMENT = BlockWriter::ALIGNMENT;
+	// in the current directory: tmpfs does not support O_DIRECT
+	std::string path = "test_eiger_units_block_writer.bin";
+	std::vector<char> data = make_data(3 * ALIGNMENT + 100);
+
+	eigerapi::TargetFilePtr file(new eigerapi::TargetFile(path, true));
+	if (!file->is_direct_io()) {
+		std::cout << "O_DIRECT not supported here, "
+			  << "flush_partial test skipped" << std::endl;
+		file.reset();
+		unlink(path.c_str());
+		return;
+	}
+
+	// interrupted download: only the aligned part is written
+	{
+		BlockWriter writer(file, 0);
+		CHECK(writer.write(data.data(), data.size()));
+		CHECK(writer.flush_partial());
+		CHECK(writer.get_size() == (long long) (3 * ALIGNMENT));
+		CHECK(writer.get_checksum() ==
+		      adler32(data.data(), 3 * ALIGNMENT));
+	}
+	// less than a block: nothing written, the download resumes at 0
+	{
+		BlockWriter writer(file, 3 * ALIGNMENT);
+		CHECK(writer.write(data.data() + 3 * ALIGNMENT, 100));
+		CHECK(writer.flush_partial());
+		CHECK(writer.get_size() == 0);
+	}
+	// resumed from the last written byte: the unaligned tail is padded
+	{
+		BlockWriter writer(file, 3 * ALIGNMENT);
+		CHECK(writer.write(data.data() + 3 * ALIGNMENT, 100));
+		CHECK(writer.flush());
+		CHECK(writer.get_size() == 100);
+	}
+	std::string error;
+	CHECK(file->close(data.size(), error));
+	CHECK(read_file(path) == data);
+	unlink(path.c_str());
+}
+
+static void test_statistics_merge()
+{
+	// large offset: the naive sum of squares loses the std
+	std::vector<double> values;
+	for (int i = 0; i < 1000; ++i)
+		values.push_back(1e9 + (i % 7) - 3 + 0.5 * (i % 2));
+
+	Statistics<double> whole, first, second, empty;
+	for (size_t i = 0; i < values.size(); ++i) {
+		whole.add(values[i]);
+		(i < 300 ? first : second).add(values[i]);
+	}
+	Statistics<double> merged = first;
+	merged.merge(second);
+	CHECK(merged.n == whole.n);
+	CHECK_CLOSE(merged.ave(), whole.ave(), 1e-6);
+	CHECK_CLOSE(merged.std(), whole.std(), 1e-6);
+	CHECK(merged.xmin == whole.xmin);
+	CHECK(merged.xmax == whole.xmax);
+	CHECK(whole.std() > 1);
+
+	// merging with or into an empty one is a copy
+	merged.merge(empty);
+	CHECK(merged.n == whole.n);
+	empty.merge(whole);
+	CHECK(empty.n == whole.n);
+	CHECK_CLOSE(empty.std(), whole.std(), 1e-9);
+
+	// the min and max come from the first sample, not from 0
+	Statistics<int> negative;
+	negative.add(-5);
+	negative.add(-2);
+	CHECK(negative.xmin == -5);
+	CHECK(negative.xmax == -2);
+}
+
+static void test_rolling_ratio()
+{
+	const double tau = 10;
+	RollingRatio ratio(tau);
+	CHECK(ratio.ratio() == 0);
+
+	// constant speed: 100 bytes per second
+	for (int i = 1; i <= 100; ++i)
+		ratio.add(100, 1, i);
+	CHECK_CLOSE(ratio.ratio(), 100, 1e-9);
+
+	// the old samples fade out after a few tau
+	for (int i = 101; i <= 200; ++i)
+		ratio.add(300, 1, i);
+	CHECK_CLOSE(ratio.ratio(), 300, 1e-2);
+
+	// two shards of the same samples merge to the whole
+	RollingRatio whole(tau), even(tau), odd(tau);
+	for (int i = 1; i <= 50; ++i) {
+		double x = 10 * i;
+		whole.add(x, 1, i);
+		((i % 2) ? odd : even).add(x, 1, i);
+	}
+	RollingRatio merged = odd;
+	merged.merge(even);
+	CHECK_CLOSE(merged.ratio(), whole.ratio(), 1e-9);
+	CHECK(merged.t == whole.t);
+}
+
+// minimal TIFF: a single IFD with SHORT and LONG tags, one strip per row
+static std::vector<char> make_tiff(bool little, int width, int height,
+				   int bits, int format, int compression,
+				   const std::vector<char>& pixels)
+{
+	std::vector<char> tiff;
+	auto put = [&](unsigned int value, int size) {
+		for (int i = 0; i < size; ++i) {
+			int shift = little ? (i * 8) : ((size - 1 - i) * 8);
+			tiff.push_back(char(value >> shift));
+		}
+	};
+	struct Tag { int tag, type; unsigned int value; };
+	size_t row_size = size_t(width) * bits / 8;
+	const int nb_tags = 9;
+	size_t ifd_size = 2 + nb_tags * 12 + 4;
+	size_t offsets_pos = 8 + ifd_size;
+	size_t counts_pos = offsets_pos + height * 4;
+	size_t pixels_pos = counts_pos + height * 4;
+	Tag tags[nb_tags] = {
+		{256, 3, (unsigned int) width},
+		{257, 3, (unsigned int) height},
+		{258, 3, (unsigned int) bits},
+		{259, 3, (unsigned int) compression},
+		{273, 4, (unsigned int) offsets_pos},
+		{277, 3, 1},
+		{278, 3, 1},
+		{279, 4, (unsigned int) counts_pos},
+		{339, 3, (unsigned int) format},
+	};
+
+	tiff.push_back(little ? 'I' : 'M');
+	tiff.push_back(little ? 'I' : 'M');
+	put(42, 2);
+	put(8, 4);
+	put(nb_tags, 2);
+	for (const Tag& t : tags) {
+		bool strips = (t.tag == 273) || (t.tag == 279);
+		put(t.tag, 2);
+		put(t.type, 2);
+		put(strips ? height : 1, 4);
+		if (strips && (height == 1))
+			put((t.tag == 273) ? pixels_pos : row_size, 4);
+		else if (t.type == 3) {
+			put(t.value, 2);
+			put(0, 2);
+		} else
+			put(t.value, 4);
+	}
+	put(0, 4);
+	for (int i = 0; i < height; ++i)
+		put(pixels_pos + i * row_size, 4);
+	for (int i = 0; i < height; ++i)
+		put(row_size, 4);
+	tiff.insert(tiff.end(), pixels.begin(), pixels.end());
+	return tiff;
+}
+
+static bool decode_fails(const std::vector<char>& tiff)
+{
+	Data image;
+	try {
+		TestHooks::decodeMonitorTiff(tiff, image);
+	} catch (Exception&) {
+		return true;
+	}
+	return false;
+}
+
+static void test_decode_tiff()
+{
+	const int width = 3, height = 2;
+	unsigned int values[width * height] = {0, 1, 258, 65535, 1000, 7};
+
+	for (int little = 0; little < 2; ++little) {
+		// 16 bits unsigned, in the file byte order
+		std::vector<char> pixels;
+		for (unsigned int v : values) {
+			char lo = char(v), hi = char(v >> 8);
+			pixels.push_back(little ? lo : hi);
+			pixels.push_back(little ? hi : lo);
+		}
+		std::vector<char> tiff = make_tiff(little, width, height, 16,
+						   1, 1, pixels);
+		Data image;
+		TestHooks::decodeMonitorTiff(tiff, image);
+		CHECK(image.type == Data::UINT16);
+		CHECK(image.dimensions.size() == 2);
+		CHECK(image.dimensions[0] == width);
+		CHECK(image.dimensions[1] == height);
+		const unsigned short *p = (const unsigned short *) image.data();
+		for (int i = 0; i < width * height; ++i)
+			CHECK(p[i] == values[i]);
+
+		// signed 32 bits
+		std::vector<char> pixels32;
+		for (unsigned int v : values) {
+			unsigned int x = -int(v);
+			for (int b = 0; b < 4; ++b)
+				pixels32.push_back(char(x >> ((little ? b : 3 - b) * 8)));
+		}
+		tiff = make_tiff(little, width, height, 32, 2, 1, pixels32);
+		TestHooks::decodeMonitorTiff(tiff, image);
+		CHECK(image.type == Data::INT32);
+		const int *q = (const int *) image.data();
+		for (int i = 0; i < width * height; ++i)
+			CHECK(q[i] == -int(values[i]));
+	}
+
+	std::vector<char> pixels(width * height * 2);
+	std::vector<char> tiff = make_tiff(true, width, height, 16, 1, 1,
+					   pixels);
+	CHECK(!decode_fails(tiff));
+	// compressed
+	CHECK(decode_fails(make_tiff(true, width, height, 16, 1, 5, pixels)));
+	// unsupported pixel format
+	CHECK(decode_fails(make_tiff(true, width, height, 12, 1, 1, pixels)));
+	// invalid header
+	std::vector<char> bad = tiff;
+	bad[0] = 'X';
+	CHECK(decode_fails(bad));
+	// truncated strips
+	bad.assign(tiff.begin(), tiff.end() - 3);
+	CHECK(decode_fails(bad));
+	CHECK(decode_fails(std::vector<char>()));
+}
+
+static bool cpu_list(const std::string& cpus, std::vector<int>& list)
+{
+	cpu_set_t cpu_set;
+	list.clear();
+	if (!TestHooks::parseCpuList(cpus, cpu_set))
+		return false;
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+		if (CPU_ISSET(cpu, &cpu_set))
+			list.push_back(cpu);
+	return true;
+}
+
+static void test_parse_cpu_list()
+{
+	std::vector<int> list;
+	CHECK(cpu_list("3", list) && (list == std::vector<int>{3}));
+	CHECK(cpu_list("0-3,8", list) &&
+	      (list == std::vector<int>{0, 1, 2, 3, 8}));
+	CHECK(cpu_list("5,1-2", list) && (list == std::vector<int>{1, 2, 5}));
+	CHECK(cpu_list("2-2", list) && (list == std::vector<int>{2}));
+	CHECK(cpu_list(" 1 , 4 ", list) && (list == std::vector<int>{1, 4}));
+
+	const char *invalid[] = {"", ",", "a", "1-", "-1", "3-1", "1-2-3",
+				 "1,,2", "1x", "99999"};
+	for (const char *cpus : invalid)
+		CHECK(!cpu_list(cpus, list));
+}
+
+int main(int argc, char *argv[])
+{
+	test_adler32_combine();
+	test_block_writer_flush_partial();
+	test_statistics_merge();
+	test_rolling_ratio();
+	test_decode_tiff();
+	test_parse_cpu_list();
+
+	if (nb_failed)
+		std::cerr << nb_failed << " check(s) failed" << std::endl;
+	else
+		std::cout << "All tests passed" << std::endl;
+	return nb_failed ? 1 : 0;
+}
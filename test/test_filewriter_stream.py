@@ -0,0 +1,119 @@
+from Lima import Core, Eiger
+import time
+import sys
+import getopt
+from threading import Event
+
+# Stream along the filewriter with decimation: Lima must get the frames
+# 0, 1, 2 ... (detector frame n is Lima frame n / decimation), and its
+# acquired and saved frame counts must end on the same last frame
+
+class TestFileWriterStream:
+
+  class Cb(Core.CtControl.ImageStatusCallback):
+    def __init__(self, acquired, end, nb_lima_frames):
+      super().__init__()
+      self.last_acquired = -1
+      self.acquired = acquired
+      self.end = end
+      self.nb_lima_frames = nb_lima_frames
+
+    def imageStatusChanged(self, status):
+      if status.LastImageAcquired == self.last_acquired:
+        return
+
+      self.acquired.append(status.LastImageAcquired)
+      self.last_acquired = status.LastImageAcquired
+
+      if self.last_acquired == self.nb_lima_frames - 1:
+        self.end.set()
+
+  def __init__(self, hw_inter):
+    self.hw_inter = hw_inter
+    self.ct = Core.CtControl(self.hw_inter)
+    self.acq = self.ct.acquisition()
+    self.saving = self.ct.saving()
+
+  def run(self, nb_frames, expo_time, decimation, directory):
+    nb_lima_frames = (nb_frames + decimation - 1) // decimation
+
+    self.hw_inter.setFileWriterStream(True)
+    self.hw_inter.setStreamDecimation(decimation)
+
+    self.saving.setManagedMode(Core.CtSaving.Hardware)
+    self.saving.setFormat(Core.CtSaving.HDF5)
+    self.saving.setDirectory(directory)
+    self.saving.setPrefix(f"test_decimation_{int(time.time())}")
+    self.saving.setSavingMode(Core.CtSaving.AutoFrame)
+
+    self.acq.setTriggerMode(Core.IntTrig)
+    self.acq.setAcqNbFrames(nb_frames)
+    self.acq.setAcqExpoTime(expo_time)
+
+    acquired = []
+    end = Event()
+    cb = self.Cb(acquired, end, nb_lima_frames)
+    cb.setRatePolicy(cb.RateAllFrames)
+    self.ct.registerImageStatusCallback(cb)
+
+    self.ct.prepareAcq()
+    print(f"Starting acquisition: nb_frames={nb_frames}, "
+          f"decimation={decimation} ...")
+    self.ct.startAcq()
+    timeout = 10 + nb_frames * expo_time
+    if not end.wait(timeout):
+      print(f"Timeout: last Lima frame {cb.last_acquired}, "
+            f"expected {nb_lima_frames - 1}")
+      return False
+    while self.ct.getStatus().AcquisitionStatus != Core.AcqReady:
+      time.sleep(0.01)
+
+    ok = True
+    if acquired != list(range(nb_lima_frames)):
+      print(f"Lima frames not consecutive: {acquired}")
+      ok = False
+    status = self.ct.getStatus().ImageCounters
+    if status.LastImageAcquired != nb_lima_frames - 1:
+      print(f"Invalid LastImageAcquired: {status.LastImageAcquired}, "
+            f"expected {nb_lima_frames - 1}")
+      ok = False
+    if status.LastImageSaved != status.LastImageAcquired:
+      print(f"LastImageSaved {status.LastImageSaved} does not match "
+            f"LastImageAcquired {status.LastImageAcquired}")
+      ok = False
+    print("OK" if ok else "FAILED")
+    return ok
+
+
+if __name__ == '__main__':
+  verbose = False
+  nb_frames = 10
+  expo_time = 0.01
+  decimation = 3
+  directory = '/tmp'
+
+  opts, args = getopt.getopt(sys.argv[1:], 'vn:e:d:p:')
+  for opt, val in opts:
+    if opt == '-v':
+      verbose = True
+    if opt == '-n':
+      nb_frames = int(val)
+    if opt == '-e':
+      expo_time = float(val)
+    if opt == '-d':
+      decimation = int(val)
+    if opt == '-p':
+      directory = val
+
+  host = args[0]
+
+  if verbose:
+    db = Core.DebParams
+    db.setTypeFlagsNameList(['Funct','Trace','Param','Return','Warning','Fatal'])
+
+  cam = Eiger.Camera(host)
+  hw_inter = Eiger.Interface(cam)
+
+  test = TestFileWriterStream(hw_inter)
+  ok = test.run(nb_frames, expo_time, decimation, directory)
+  sys.exit(0 if ok else 1)